@@ -282,6 +282,8 @@ void pred_main(algo_data_t *wd)
                 #pragma omp critical (PRED_ARCHIVE__CGP_POP)
                 {
                     pred_calculate_phenotype(arc_get(wd->pred_archive, 0)->genome);
+                    // predicted fitness of known phenotypes has changed
+                    ga_invalidate_fitness_cache(wd->cgp_population);
                 }
 
                 new_used_length = ((pred_genome_t) arc_get(wd->pred_archive, 0)->genome)->used_pixels;
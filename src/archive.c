@@ -106,7 +106,8 @@ void arc_destroy(archive_t arc)
  *
  * Chromosome is copied into place and pointer to it is returned.
  *
- * Chromosome is reevaluated using `arc->methods.fitness` (if set).
+ * Chromosome is reevaluated using `arc->methods.fitness` (if set)
+ * and `arc->methods.stored` is notified (if set).
  *
  * @param  arc
  * @param  chr
@@ -123,6 +124,10 @@ ga_chr_t arc_insert(archive_t arc, ga_chr_t chr)
         dst->has_fitness = true;
     }
 
+    if (arc->methods.stored != NULL) {
+        arc->methods.stored(dst, arc->pointer);
+    }
+
     if (arc->stored == 0 || ga_is_better(arc->problem_type, dst->fitness, arc->best_chromosome_ever->fitness)) {
         ga_copy_chr(arc->best_chromosome_ever, dst, arc->methods.copy_genome);
     }
@@ -29,6 +29,12 @@
 #include "ga.h"
 
 
+/**
+ * Notifies about chromosome stored on given real index of ring buffer
+ */
+typedef void (*arc_stored_func_t)(ga_chr_t chr, int real_index);
+
+
  /**
   * User-defined methods
   */
@@ -42,6 +48,10 @@
 
      /* fitness function */
      ga_fitness_func_t fitness;
+
+     /* optional, called after item is inserted (e.g. to cache data
+        derived from it) */
+     arc_stored_func_t stored;
  } arc_func_vect_t;
 
 
@@ -97,7 +107,8 @@ void arc_destroy(archive_t arc);
  *
  * Chromosome is copied into place and pointer to it is returned.
  *
- * Chromosome is reevaluated using `arc->methods.fitness` (if set).
+ * Chromosome is reevaluated using `arc->methods.fitness` (if set)
+ * and `arc->methods.stored` is notified (if set).
  *
  * @param  arc
  * @param  chr
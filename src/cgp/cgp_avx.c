@@ -23,36 +23,10 @@
 #include <immintrin.h>
 
 #include "cgp_avx.h"
+#include "../cpu.h"
 #include "../random.h"
 
 
-#define CURRENT(x) \
-  (x == 0? current0 \
-    : x == 1? current1 \
-    : x == 2? current2 \
-    : current3)
-
-#define ASSIGN_CURRENT(x, val) do { \
-  if (x == 0) current0 = (val); \
-  else if (x == 1) current1 = (val); \
-  else if (x == 2) current2 = (val); \
-  else if (x == 3) current3 = (val); \
-  else assert(false); \
-} while(0);
-
-#define LOAD_INPUT(reg, idx) do { \
-    if ((idx) < CGP_INPUTS) reg = inputs[(idx)]; \
-    else if ((idx) == CGP_INPUTS + offset) reg = prev0; \
-    else if ((idx) == CGP_INPUTS + offset + 1) reg = prev1; \
-    else if ((idx) == CGP_INPUTS + offset + 2) reg = prev2; \
-    else if ((idx) == CGP_INPUTS + offset + 3) reg = prev3; \
-    else { \
-        fprintf(stderr, "Invalid index %d, (range %d-%d)\n", \
-            idx, CGP_INPUTS + offset, CGP_INPUTS + offset + 3); \
-        assert(false); \
-    } \
-} while(0);
-
 #define UCFMT1 "%u"
 #define UCFMT4 UCFMT1 ", " UCFMT1 ", " UCFMT1 ", " UCFMT1
 #define UCFMT16 UCFMT4 ", " UCFMT4 ", " UCFMT4 ", " UCFMT4
@@ -70,12 +44,171 @@
 } while(0);
 
 
+/**
+ * Evaluates instructions on value slots using AVX2 instructions.
+ * Result of k-th instruction is stored into slot `first_slot + k`.
+ * @param instrs
+ * @param count
+ * @param first_slot
+ * @param values
+ */
+CPU_TARGET_AVX2
+void cgp_eval_instrs_avx(const cgp_instr_t *instrs, int count, int first_slot,
+    __m256i_aligned *values)
+{
+#ifndef AVX2
+    assert(false);
+#else
+    // 0xFF constant
+    const __m256i FF = _mm256_set1_epi8(0xFF);
+
+    for (int i = 0; i < count; i++) {
+        const cgp_instr_t *instr = &(instrs[i]);
+
+        register __m256i A = values[instr->inputs[0]];
+        register __m256i B = values[instr->inputs[1]];
+        register __m256i Y;
+        register __m256i TMP;
+        register __m256i mask;
+
+        switch (instr->function) {
+            case c255:
+                Y = FF;
+                break;
+
+            case identity:
+                Y = A;
+                break;
+
+            case inversion:
+                Y = _mm256_sub_epi8(FF, A);
+                break;
+
+            case b_or:
+                Y = _mm256_or_si256(A, B);
+                break;
+
+            case b_not1or2:
+                // we don't have NOT instruction, we need to XOR with FF
+                Y = _mm256_xor_si256(FF, A);
+                Y = _mm256_or_si256(Y, B);
+                break;
+
+            case b_and:
+                Y = _mm256_and_si256(A, B);
+                break;
+
+            case b_nand:
+                Y = _mm256_and_si256(A, B);
+                Y = _mm256_xor_si256(FF, Y);
+                break;
+
+            case b_xor:
+                Y = _mm256_xor_si256(A, B);
+                break;
+
+            case rshift1:
+                // no SR instruction for 8bit data, we need to shift
+                // 16 bits and apply mask
+                // IN : [ 1 2 3 4 5 6 7 8 | A B C D E F G H]
+                // SHR: [ 0 1 2 3 4 5 6 7 | 8 A B C D E F G]
+                // MSK: [ 0 1 2 3 4 5 6 7 | 0 A B C D E F G]
+                mask = _mm256_set1_epi8(0x7F);
+                Y = _mm256_srli_epi16(A, 1);
+                Y = _mm256_and_si256(Y, mask);
+                break;
+
+            case rshift2:
+                // similar to rshift1
+                // IN : [ 1 2 3 4 5 6 7 8 | A B C D E F G H]
+                // SHR: [ 0 0 1 2 3 4 5 6 | 7 8 A B C D E F]
+                // MSK: [ 0 0 1 2 3 4 5 6 | 0 0 A B C D E F]
+                mask = _mm256_set1_epi8(0x3F);
+                Y = _mm256_srli_epi16(A, 2);
+                Y = _mm256_and_si256(Y, mask);
+                break;
+
+            case swap:
+                // SWAP(A, B) (((A & 0x0F) << 4) | ((B & 0x0F)))
+                // Shift A left by 4 bits
+                // IN : [ 1 2 3 4 5 6 7 8 | A B C D E F G H]
+                // SHL: [ 5 6 7 8 A B C D | E F G H 0 0 0 0]
+                // MSK: [ 5 6 7 8 0 0 0 0 | E F G H 0 0 0 0]
+                mask = _mm256_set1_epi8(0xF0);
+                TMP = _mm256_slli_epi16(A, 4);
+                TMP = _mm256_and_si256(TMP, mask);
+
+                // Mask B
+                // IN : [ 1 2 3 4 5 6 7 8 | A B C D E F G H]
+                // MSK: [ 0 0 0 0 5 6 7 8 | 0 0 0 0 E F G H]
+                mask = _mm256_set1_epi8(0x0F);
+                Y = _mm256_and_si256(B, mask);
+
+                // Combine
+                Y = _mm256_or_si256(Y, TMP);
+                break;
+
+            case add:
+                Y = _mm256_add_epi8(A, B);
+                break;
+
+            case add_sat:
+                Y = _mm256_adds_epu8(A, B);
+                break;
+
+            case avg:
+                // shift right first, then add, to avoid overflow
+                mask = _mm256_set1_epi8(0x7F);
+                TMP = _mm256_srli_epi16(A, 1);
+                TMP = _mm256_and_si256(TMP, mask);
+
+                Y = _mm256_srli_epi16(B, 1);
+                Y = _mm256_and_si256(Y, mask);
+
+                Y = _mm256_add_epi8(Y, TMP);
+                break;
+
+            case max:
+                Y = _mm256_max_epu8(A, B);
+                break;
+
+            case min:
+                Y = _mm256_min_epu8(A, B);
+                break;
+        }
+
+
+#ifdef TEST_EVAL_AVX
+        __m256i _tmpval = Y;
+        unsigned char *_tmp = (unsigned char*) &_tmpval;
+
+        bool mismatch = false;
+        for (int j = 1; j < 32; j++) {
+            if (_tmp[j] != _tmp[0]) {
+                fprintf(stderr,
+                    "Value mismatch on index %2d (%u instead of %u)\n",
+                    j, _tmp[j], _tmp[0]);
+                mismatch = true;
+            }
+        }
+        if (mismatch) {
+            abort();
+        }
+#endif
+
+        values[first_slot + i] = Y;
+    }
+#endif
+}
+
+
 /**
  * Calculate output of given chromosome and inputs using AVX2 instructions
  * @param chr
  * @param inputs
  * @param outputs
  */
+CPU_TARGET_AVX2
 void cgp_get_output_avx(ga_chr_t chromosome,
     __m256i_aligned inputs[CGP_INPUTS], __m256i_aligned outputs[CGP_OUTPUTS])
 {
@@ -83,197 +216,174 @@ void cgp_get_output_avx(ga_chr_t chromosome,
     assert(false);
 #else
     assert(CGP_OUTPUTS == 1);
-    assert(CGP_ROWS == 4);
-    assert(CGP_LBACK == 1);
 
-    // previous and currently computed column
-    register __m256i prev0, prev1, prev2, prev3;
-    register __m256i current0, current1, current2, current3;
-
-    // 0xFF constant
-    static __m256i_aligned FF;
-    FF = _mm256_set1_epi8(0xFF);
+    // working array - primary inputs followed by outputs of active nodes
+    __m256i_aligned values[CGP_SLOTS];
 
     cgp_genome_t genome = (cgp_genome_t) chromosome->genome;
 
-#ifdef TEST_EVAL_AVX
+    for (int i = 0; i < CGP_INPUTS; i++) {
+        values[i] = inputs[i];
+    }
 
+#ifdef TEST_EVAL_AVX
     for (int i = 0; i < CGP_INPUTS; i++) {
         unsigned char *_tmp = (unsigned char*) &inputs[i];
         printf("I: %2d = " UCFMT32 "\n", i, UCVAL32(0));
     }
 #endif
 
-    int offset = -CGP_ROWS;
-
-    for (int x = 0; x < CGP_COLS; x++) {
-        for (int y = 0; y < CGP_ROWS; y++) {
-            int idx = cgp_node_index(x, y);
-            cgp_node_t *n = &(genome->nodes[idx]);
-
-            // skip inactive blocks
-            if (!n->is_active) continue;
-
-            register __m256i A;
-            register __m256i B;
-            register __m256i Y;
-            register __m256i TMP;
-            register __m256i mask;
-
-            LOAD_INPUT(A, n->inputs[0]);
-            LOAD_INPUT(B, n->inputs[1]);
-
-            switch (n->function) {
-                case c255:
-                    Y = FF;
-                    break;
-
-                case identity:
-                    Y = A;
-                    break;
-
-                case inversion:
-                    Y = _mm256_sub_epi8(FF, A);
-                    break;
-
-                case b_or:
-                    Y = _mm256_or_si256(A, B);
-                    break;
-
-                case b_not1or2:
-                    // we don't have NOT instruction, we need to XOR with FF
-                    Y = _mm256_xor_si256(FF, A);
-                    Y = _mm256_or_si256(Y, B);
-                    break;
-
-                case b_and:
-                    Y = _mm256_and_si256(A, B);
-                    break;
-
-                case b_nand:
-                    Y = _mm256_and_si256(A, B);
-                    Y = _mm256_xor_si256(FF, Y);
-                    break;
-
-                case b_xor:
-                    Y = _mm256_xor_si256(A, B);
-                    break;
-
-                case rshift1:
-                    // no SR instruction for 8bit data, we need to shift
-                    // 16 bits and apply mask
-                    // IN : [ 1 2 3 4 5 6 7 8 | A B C D E F G H]
-                    // SHR: [ 0 1 2 3 4 5 6 7 | 8 A B C D E F G]
-                    // MSK: [ 0 1 2 3 4 5 6 7 | 0 A B C D E F G]
-                    mask = _mm256_set1_epi8(0x7F);
-                    Y = _mm256_srli_epi16(A, 1);
-                    Y = _mm256_and_si256(Y, mask);
-                    break;
-
-                case rshift2:
-                    // similar to rshift1
-                    // IN : [ 1 2 3 4 5 6 7 8 | A B C D E F G H]
-                    // SHR: [ 0 0 1 2 3 4 5 6 | 7 8 A B C D E F]
-                    // MSK: [ 0 0 1 2 3 4 5 6 | 0 0 A B C D E F]
-                    mask = _mm256_set1_epi8(0x3F);
-                    Y = _mm256_srli_epi16(A, 2);
-                    Y = _mm256_and_si256(Y, mask);
-                    break;
-
-                case swap:
-                    // SWAP(A, B) (((A & 0x0F) << 4) | ((B & 0x0F)))
-                    // Shift A left by 4 bits
-                    // IN : [ 1 2 3 4 5 6 7 8 | A B C D E F G H]
-                    // SHL: [ 5 6 7 8 A B C D | E F G H 0 0 0 0]
-                    // MSK: [ 5 6 7 8 0 0 0 0 | E F G H 0 0 0 0]
-                    mask = _mm256_set1_epi8(0xF0);
-                    TMP = _mm256_slli_epi16(A, 4);
-                    TMP = _mm256_and_si256(TMP, mask);
-
-                    // Mask B
-                    // IN : [ 1 2 3 4 5 6 7 8 | A B C D E F G H]
-                    // MSK: [ 0 0 0 0 5 6 7 8 | 0 0 0 0 E F G H]
-                    mask = _mm256_set1_epi8(0x0F);
-                    Y = _mm256_and_si256(B, mask);
-
-                    // Combine
-                    Y = _mm256_or_si256(Y, TMP);
-                    break;
-
-                case add:
-                    Y = _mm256_add_epi8(A, B);
-                    break;
-
-                case add_sat:
-                    Y = _mm256_adds_epu8(A, B);
-                    break;
-
-                case avg:
-                    // shift right first, then add, to avoid overflow
-                    mask = _mm256_set1_epi8(0x7F);
-                    TMP = _mm256_srli_epi16(A, 1);
-                    TMP = _mm256_and_si256(TMP, mask);
-
-                    Y = _mm256_srli_epi16(B, 1);
-                    Y = _mm256_and_si256(Y, mask);
-
-                    Y = _mm256_add_epi8(Y, TMP);
-                    break;
-
-                case max:
-                    Y = _mm256_max_epu8(A, B);
-                    break;
-
-                case min:
-                    Y = _mm256_min_epu8(A, B);
-                    break;
-            }
+    cgp_eval_instrs_avx(genome->instrs, genome->instr_count, CGP_INPUTS, values);
 
+    _mm256_store_si256(&outputs[0], values[genome->output_slots[0]]);
 
 #ifdef TEST_EVAL_AVX
-            __m256i _tmpval = Y;
-            unsigned char *_tmp = (unsigned char*) &_tmpval;
-            printf("N: %2d = " UCFMT32 "\n", idx + CGP_INPUTS, UCVAL32(0));
-
-            bool mismatch = false;
-            for (int i = 1; i < 32; i++) {
-                if (_tmp[i] != _tmp[0]) {
-                    fprintf(stderr,
-                        "Value mismatch on index %2d (%u instead of %u)\n",
-                        i, _tmp[i], _tmp[0]);
-                    mismatch = true;
-                }
-            }
-            if (mismatch) {
-                abort();
-            }
+    // values of active nodes, indexed the same way as node inputs
+    for (int i = 0; i < CGP_NODES; i++) {
+        if (genome->node_slots[i] < 0) continue;
+        unsigned char *_tmp = (unsigned char*) &values[genome->node_slots[i]];
+        printf("N: %2d = " UCFMT32 "\n", i + CGP_INPUTS, UCVAL32(0));
+    }
+    for (int i = 0; i < CGP_OUTPUTS; i++) {
+        unsigned char *_tmp = (unsigned char*) &outputs[i];
+        printf("O: %2d = " UCFMT32 "\n", i, UCVAL32(0));
+    }
 #endif
 
-            if (idx + CGP_INPUTS == genome->outputs[0]) {
-                _mm256_store_si256(&outputs[0], Y);
-#ifndef TEST_EVAL_AVX
-                return;
+
 #endif
-            }
+}
+
 
-            ASSIGN_CURRENT(y, Y);
+#ifdef AVX2
 
-        } // end of column
+/**
+ * Applies `stmt` to all vectors of current instruction, A, B and Y
+ * are operands and result, `b` is index of vector
+ */
+#define FOR_BLOCKS(stmt) \
+    for (int b = 0; b < blocks; b++) { stmt; } \
+    break;
 
-        offset += CGP_ROWS;
-        prev0 = current0;
-        prev1 = current1;
-        prev2 = current2;
-        prev3 = current3;
-    } // end of row
 
-#ifdef TEST_EVAL_AVX
-    for (int i = 0; i < CGP_OUTPUTS; i++) {
-        unsigned char *_tmp = (unsigned char*) &outputs[i];
-        printf("O: %2d = " UCFMT32 "\n", i, UCVAL32(0));
+/**
+ * Body of `cgp_eval_instrs_avx_multi`, inlined with constant `blocks`
+ * so the inner loops are unrolled
+ */
+CPU_TARGET_AVX2
+static inline __attribute__((always_inline)) void _eval_instrs_avx_blocks(
+    const cgp_instr_t *instrs, int count, int first_slot,
+    cgp_avx_blocks_t *values, const int blocks)
+{
+    const __m256i FF = _mm256_set1_epi8(0xFF);
+    const __m256i M7F = _mm256_set1_epi8(0x7F);
+    const __m256i M3F = _mm256_set1_epi8(0x3F);
+    const __m256i MF0 = _mm256_set1_epi8(0xF0);
+    const __m256i M0F = _mm256_set1_epi8(0x0F);
+
+    for (int i = 0; i < count; i++) {
+        const cgp_instr_t *instr = &(instrs[i]);
+
+        const __m256i *restrict A = values[instr->inputs[0]];
+        const __m256i *restrict B = values[instr->inputs[1]];
+        __m256i *restrict Y = values[first_slot + i];
+
+        // see `cgp_eval_instrs_avx` for explanation of the operations
+        switch (instr->function) {
+            case c255:
+                FOR_BLOCKS(Y[b] = FF);
+
+            case identity:
+                FOR_BLOCKS(Y[b] = A[b]);
+
+            case inversion:
+                FOR_BLOCKS(Y[b] = _mm256_sub_epi8(FF, A[b]));
+
+            case b_or:
+                FOR_BLOCKS(Y[b] = _mm256_or_si256(A[b], B[b]));
+
+            case b_not1or2:
+                FOR_BLOCKS(Y[b] = _mm256_or_si256(_mm256_xor_si256(FF, A[b]), B[b]));
+
+            case b_and:
+                FOR_BLOCKS(Y[b] = _mm256_and_si256(A[b], B[b]));
+
+            case b_nand:
+                FOR_BLOCKS(Y[b] = _mm256_xor_si256(FF, _mm256_and_si256(A[b], B[b])));
+
+            case b_xor:
+                FOR_BLOCKS(Y[b] = _mm256_xor_si256(A[b], B[b]));
+
+            case rshift1:
+                FOR_BLOCKS(Y[b] = _mm256_and_si256(_mm256_srli_epi16(A[b], 1), M7F));
+
+            case rshift2:
+                FOR_BLOCKS(Y[b] = _mm256_and_si256(_mm256_srli_epi16(A[b], 2), M3F));
+
+            case swap:
+                FOR_BLOCKS(Y[b] = _mm256_or_si256(
+                    _mm256_and_si256(_mm256_slli_epi16(A[b], 4), MF0),
+                    _mm256_and_si256(B[b], M0F)));
+
+            case add:
+                FOR_BLOCKS(Y[b] = _mm256_add_epi8(A[b], B[b]));
+
+            case add_sat:
+                FOR_BLOCKS(Y[b] = _mm256_adds_epu8(A[b], B[b]));
+
+            case avg:
+                FOR_BLOCKS(Y[b] = _mm256_add_epi8(
+                    _mm256_and_si256(_mm256_srli_epi16(A[b], 1), M7F),
+                    _mm256_and_si256(_mm256_srli_epi16(B[b], 1), M7F)));
+
+            case max:
+                FOR_BLOCKS(Y[b] = _mm256_max_epu8(A[b], B[b]));
+
+            case min:
+                FOR_BLOCKS(Y[b] = _mm256_min_epu8(A[b], B[b]));
+        }
     }
+}
+
+#undef FOR_BLOCKS
+
 #endif
 
 
+/**
+ * Evaluates instructions on `blocks` independent vectors at once using
+ * AVX2 instructions.
+ * @param instrs
+ * @param count
+ * @param first_slot
+ * @param values
+ * @param blocks Number of vectors, at most CGP_AVX_MAX_BLOCKS
+ */
+CPU_TARGET_AVX2
+void cgp_eval_instrs_avx_multi(const cgp_instr_t *instrs, int count,
+    int first_slot, cgp_avx_blocks_t *values, int blocks)
+{
+#ifndef AVX2
+    assert(false);
+#else
+    assert(blocks >= 1 && blocks <= CGP_AVX_MAX_BLOCKS);
+
+    switch (blocks) {
+        case 4:
+            _eval_instrs_avx_blocks(instrs, count, first_slot, values, 4);
+            break;
+
+        case 2:
+            _eval_instrs_avx_blocks(instrs, count, first_slot, values, 2);
+            break;
+
+        case 1:
+            _eval_instrs_avx_blocks(instrs, count, first_slot, values, 1);
+            break;
+
+        default:
+            _eval_instrs_avx_blocks(instrs, count, first_slot, values, blocks);
+            break;
+    }
 #endif
 }
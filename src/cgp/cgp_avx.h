@@ -28,6 +28,31 @@
 typedef __m256i __m256i_aligned __attribute__ ((aligned (32)));
 
 
+/**
+ * Maximum number of independent vectors evaluated in one pass
+ * (see `cgp_eval_instrs_avx_multi`)
+ */
+#define CGP_AVX_MAX_BLOCKS 4
+
+
+/**
+ * Values of one slot for CGP_AVX_MAX_BLOCKS vectors
+ */
+typedef __m256i_aligned cgp_avx_blocks_t[CGP_AVX_MAX_BLOCKS];
+
+
+/**
+ * Evaluates instructions on value slots using AVX2 instructions.
+ * Result of k-th instruction is stored into slot `first_slot + k`.
+ * @param instrs
+ * @param count
+ * @param first_slot
+ * @param values
+ */
+void cgp_eval_instrs_avx(const cgp_instr_t *instrs, int count, int first_slot,
+    __m256i_aligned *values);
+
+
 /**
  * Calculate output of given chromosome and inputs using AVX instructions
  * @param chr
@@ -35,3 +60,21 @@ typedef __m256i __m256i_aligned __attribute__ ((aligned (32)));
  * @param outputs
  */
 void cgp_get_output_avx(ga_chr_t chromosome, __m256i_aligned inputs[CGP_INPUTS], __m256i_aligned outputs[CGP_OUTPUTS]);
+
+
+/**
+ * Evaluates instructions on `blocks` independent vectors at once using
+ * AVX2 instructions. Each instruction is decoded only once and its
+ * operations on different vectors do not depend on each other, so they
+ * can be executed in parallel.
+ *
+ * Result of k-th instruction is stored into slot `first_slot + k`.
+ *
+ * @param instrs
+ * @param count
+ * @param first_slot
+ * @param values
+ * @param blocks Number of vectors, at most CGP_AVX_MAX_BLOCKS
+ */
+void cgp_eval_instrs_avx_multi(const cgp_instr_t *instrs, int count,
+    int first_slot, cgp_avx_blocks_t *values, int blocks);
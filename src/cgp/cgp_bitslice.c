@@ -0,0 +1,253 @@
+/*
+ * Colearning in Coevolutionary Algorithms
+ * Bc. Michal Wiglasz <xwigla00@stud.fit.vutbr.cz>
+ *
+ * Master Thesis
+ * 2014/2015
+ *
+ * Supervisor: Ing. Michaela Šikulová <isikulova@fit.vutbr.cz>
+ *
+ * Faculty of Information Technologies
+ * Brno University of Technology
+ * http://www.fit.vutbr.cz/
+ *
+ * Started on 28/07/2014.
+ *      _       _
+ *   __(.)=   =(.)__
+ *   \___)     (___/
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "cgp_bitslice.h"
+
+
+typedef cgp_bitslice_word_t word_t;
+
+
+/* conversion *****************************************************************/
+
+
+/**
+ * Transposes 8x8 bit matrix stored in 64-bit integer (byte = row)
+ *
+ * See Hacker's Delight, 7-3 (Transposing a Bit Matrix)
+ */
+static inline uint64_t _transpose8(uint64_t x)
+{
+    uint64_t t;
+    t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAull;
+    x = x ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCull;
+    x = x ^ t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ull;
+    x = x ^ t ^ (t << 28);
+    return x;
+}
+
+
+/**
+ * Converts CGP_BITSLICE_BLOCK pixels into bit-planes
+ * @param pixels
+ * @param value
+ */
+void cgp_bitslice_from_pixels(const cgp_value_t *pixels, cgp_bitslice_value_t *value)
+{
+    memset(value, 0, sizeof(cgp_bitslice_value_t));
+
+    // every 8 pixels form 8x8 bit matrix (pixel = row, bit = column),
+    // after transposition row = bit-plane
+    for (int w = 0; w < 4; w++) {
+        for (int k = 0; k < 8; k++) {
+            uint64_t x;
+            memcpy(&x, &pixels[64 * w + 8 * k], sizeof(uint64_t));
+            x = _transpose8(x);
+
+            for (int plane = 0; plane < 8; plane++) {
+                value->planes[plane][w] |= ((x >> (8 * plane)) & 0xFF) << (8 * k);
+            }
+        }
+    }
+}
+
+
+/**
+ * Converts bit-planes back into CGP_BITSLICE_BLOCK pixels
+ * @param value
+ * @param pixels
+ */
+void cgp_bitslice_to_pixels(const cgp_bitslice_value_t *value, cgp_value_t *pixels)
+{
+    for (int w = 0; w < 4; w++) {
+        for (int k = 0; k < 8; k++) {
+            uint64_t x = 0;
+            for (int plane = 0; plane < 8; plane++) {
+                x |= ((value->planes[plane][w] >> (8 * k)) & 0xFF) << (8 * plane);
+            }
+
+            x = _transpose8(x);
+            memcpy(&pixels[64 * w + 8 * k], &x, sizeof(uint64_t));
+        }
+    }
+}
+
+
+/* evaluation *****************************************************************/
+
+
+/**
+ * Y = A + B (mod 2^bits), stores carry out of the highest bit
+ * (ripple-carry adder over `bits` lowest planes)
+ */
+static inline void _add(const word_t *A, const word_t *B, word_t *Y,
+    word_t *carry_out, int bits)
+{
+    word_t carry = {0, 0, 0, 0};
+
+    for (int i = 0; i < bits; i++) {
+        word_t axb = A[i] ^ B[i];
+        Y[i] = axb ^ carry;
+        carry = (A[i] & B[i]) | (carry & axb);
+    }
+    *carry_out = carry;
+}
+
+
+/**
+ * Stores mask of pixels where A > B (unsigned)
+ */
+static inline void _greater(const word_t *A, const word_t *B, word_t *mask)
+{
+    word_t gt = {0, 0, 0, 0};
+    word_t eq = ~gt;
+
+    for (int i = 7; i >= 0; i--) {
+        gt |= eq & A[i] & ~B[i];
+        eq &= ~(A[i] ^ B[i]);
+    }
+    *mask = gt;
+}
+
+
+/**
+ * Calculate output of given chromosome and bit-sliced inputs
+ * @param chr
+ * @param inputs
+ * @param outputs
+ */
+void cgp_get_output_bitslice(ga_chr_t chromosome,
+    cgp_bitslice_value_t inputs[CGP_INPUTS],
+    cgp_bitslice_value_t outputs[CGP_OUTPUTS])
+{
+    assert(CGP_OUTPUTS == 1);
+
+    // working array - primary inputs followed by outputs of active nodes
+    cgp_bitslice_value_t values[CGP_SLOTS];
+
+    const word_t ZERO = {0, 0, 0, 0};
+    const word_t ONES = ~ZERO;
+
+    cgp_genome_t genome = (cgp_genome_t) chromosome->genome;
+
+    memcpy(values, inputs, sizeof(cgp_bitslice_value_t) * CGP_INPUTS);
+
+    for (int i = 0; i < genome->instr_count; i++) {
+        cgp_instr_t *instr = &(genome->instrs[i]);
+
+        const word_t *A = values[instr->inputs[0]].planes;
+        const word_t *B = values[instr->inputs[1]].planes;
+        word_t *Y = values[CGP_INPUTS + i].planes;
+        word_t TA[8], TB[8], mask;
+
+        switch (instr->function) {
+            case c255:
+                for (int k = 0; k < 8; k++) Y[k] = ONES;
+                break;
+
+            case identity:
+                for (int k = 0; k < 8; k++) Y[k] = A[k];
+                break;
+
+            case inversion:
+                // 255 - a == ~a for 8-bit values
+                for (int k = 0; k < 8; k++) Y[k] = ~A[k];
+                break;
+
+            case b_or:
+                for (int k = 0; k < 8; k++) Y[k] = A[k] | B[k];
+                break;
+
+            case b_not1or2:
+                for (int k = 0; k < 8; k++) Y[k] = ~A[k] | B[k];
+                break;
+
+            case b_and:
+                for (int k = 0; k < 8; k++) Y[k] = A[k] & B[k];
+                break;
+
+            case b_nand:
+                for (int k = 0; k < 8; k++) Y[k] = ~(A[k] & B[k]);
+                break;
+
+            case b_xor:
+                for (int k = 0; k < 8; k++) Y[k] = A[k] ^ B[k];
+                break;
+
+            case rshift1:
+                // shift = move planes down
+                for (int k = 0; k < 7; k++) Y[k] = A[k + 1];
+                Y[7] = ZERO;
+                break;
+
+            case rshift2:
+                for (int k = 0; k < 6; k++) Y[k] = A[k + 2];
+                Y[6] = ZERO;
+                Y[7] = ZERO;
+                break;
+
+            case swap:
+                // ((a & 0x0F) << 4) | (b & 0x0F)
+                for (int k = 0; k < 4; k++) {
+                    Y[k] = B[k];
+                    Y[k + 4] = A[k];
+                }
+                break;
+
+            case add:
+                _add(A, B, Y, &mask, 8);
+                break;
+
+            case add_sat:
+                _add(A, B, Y, &mask, 8);
+                for (int k = 0; k < 8; k++) Y[k] |= mask;
+                break;
+
+            case avg:
+                // (a >> 1) + (b >> 1), same as SIMD engines
+                for (int k = 0; k < 7; k++) {
+                    TA[k] = A[k + 1];
+                    TB[k] = B[k + 1];
+                }
+                _add(TA, TB, Y, &Y[7], 7);
+                break;
+
+            case max:
+                _greater(A, B, &mask);
+                for (int k = 0; k < 8; k++) Y[k] = (A[k] & mask) | (B[k] & ~mask);
+                break;
+
+            case min:
+                _greater(A, B, &mask);
+                for (int k = 0; k < 8; k++) Y[k] = (B[k] & mask) | (A[k] & ~mask);
+                break;
+
+            default:
+                abort();
+        }
+    }
+
+    outputs[0] = values[genome->output_slots[0]];
+}
@@ -0,0 +1,83 @@
+/*
+ * Colearning in Coevolutionary Algorithms
+ * Bc. Michal Wiglasz <xwigla00@stud.fit.vutbr.cz>
+ *
+ * Master Thesis
+ * 2014/2015
+ *
+ * Supervisor: Ing. Michaela Šikulová <isikulova@fit.vutbr.cz>
+ *
+ * Faculty of Information Technologies
+ * Brno University of Technology
+ * http://www.fit.vutbr.cz/
+ *
+ * Started on 28/07/2014.
+ *      _       _
+ *   __(.)=   =(.)__
+ *   \___)     (___/
+ */
+
+
+/*
+    Bit-sliced CGP evaluation.
+
+    Values of CGP_BITSLICE_BLOCK pixels are stored as 8 bit-planes,
+    k-th plane contains k-th bit (0 = LSB) of all pixels. Every CGP
+    function is then evaluated as a boolean circuit over these planes.
+
+    Semantics match SSE2/AVX2 engines (including `avg`).
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+
+#include "cgp_core.h"
+
+
+/**
+ * Number of pixels in one bit-plane
+ */
+#define CGP_BITSLICE_BLOCK 256
+
+
+/**
+ * One bit-plane
+ */
+typedef uint64_t cgp_bitslice_word_t __attribute__ ((vector_size (32)));
+
+
+/**
+ * Bit-sliced values of CGP_BITSLICE_BLOCK pixels
+ */
+typedef struct {
+    cgp_bitslice_word_t planes[8];
+} cgp_bitslice_value_t;
+
+
+/**
+ * Converts CGP_BITSLICE_BLOCK pixels into bit-planes
+ * @param pixels
+ * @param value
+ */
+void cgp_bitslice_from_pixels(const cgp_value_t *pixels, cgp_bitslice_value_t *value);
+
+
+/**
+ * Converts bit-planes back into CGP_BITSLICE_BLOCK pixels
+ * @param value
+ * @param pixels
+ */
+void cgp_bitslice_to_pixels(const cgp_bitslice_value_t *value, cgp_value_t *pixels);
+
+
+/**
+ * Calculate output of given chromosome and bit-sliced inputs
+ * @param chr
+ * @param inputs
+ * @param outputs
+ */
+void cgp_get_output_bitslice(ga_chr_t chromosome,
+    cgp_bitslice_value_t inputs[CGP_INPUTS],
+    cgp_bitslice_value_t outputs[CGP_OUTPUTS]);
@@ -21,8 +21,11 @@
 #pragma once
 
 // hard configuration - affects compilation (array sizes etc.)
-#define CGP_COLS 8
-#define CGP_ROWS 4
 #define CGP_INPUTS 9
 #define CGP_OUTPUTS 1
-#define CGP_LBACK 1
+#define CGP_MAX_NODES 256
+
+// default grid geometry, can be changed at runtime (see cgp_set_geometry)
+#define CGP_DEFAULT_COLS 8
+#define CGP_DEFAULT_ROWS 4
+#define CGP_DEFAULT_LBACK 1
@@ -32,9 +32,10 @@ typedef struct {
 } int_array;
 
 
-static int_array _allowed_gene_vals[CGP_COLS];
+static int_array _allowed_gene_vals[CGP_MAX_NODES];
 static int _mutation_rate;
 static ga_fitness_func_t _fitness_func;
+static ga_batch_fitness_func_t _batch_fitness_func;
 
 #ifdef CGP_LIMIT_FUNCS
     static int _allowed_functions_list[] = {
@@ -62,13 +63,46 @@ static ga_fitness_func_t _fitness_func;
 
 
 
+cgp_geometry_t cgp_geometry = {
+    .cols = CGP_DEFAULT_COLS,
+    .rows = CGP_DEFAULT_ROWS,
+    .lback = CGP_DEFAULT_LBACK,
+};
+
+
+/**
+ * Sets CGP grid geometry, must be called before `cgp_init`
+ * @param  cols
+ * @param  rows
+ * @param  lback
+ * @return 0 on success, -1 if geometry is invalid
+ */
+int cgp_set_geometry(int cols, int rows, int lback)
+{
+    if (cols < 1 || rows < 1 || cols * rows > CGP_MAX_NODES) {
+        return -1;
+    }
+
+    if (lback < 1 || lback > cols) {
+        return -1;
+    }
+
+    cgp_geometry.cols = cols;
+    cgp_geometry.rows = rows;
+    cgp_geometry.lback = lback;
+    return 0;
+}
+
+
 /**
  * Initialize CGP internals
  */
-void cgp_init(int mutation_rate, ga_fitness_func_t fitness_func)
+void cgp_init(int mutation_rate, ga_fitness_func_t fitness_func,
+    ga_batch_fitness_func_t batch_fitness_func)
 {
     _mutation_rate = mutation_rate;
     _fitness_func = fitness_func;
+    _batch_fitness_func = batch_fitness_func;
 
     // calculate allowed values of node inputs in each column
     for (int x = 0; x < CGP_COLS; x++) {
@@ -135,6 +169,9 @@ ga_pop_t cgp_init_pop(int pop_size)
         .init_genome = cgp_randomize_genome,
 
         .fitness = _fitness_func,
+        .batch_fitness = _batch_fitness_func,
+        .phenotype_hash = cgp_phenotype_hash,
+        .phenotype_key = cgp_phenotype_key,
         .offspring = cgp_offspring,
     };
 
@@ -169,6 +206,7 @@ int cgp_randomize_genome(ga_chr_t chromosome)
         cgp_randomize_gene(genome, i);
     }
 
+    genome->has_parent = false;
     cgp_find_active_blocks(chromosome);
     chromosome->has_fitness = false;
 
@@ -216,12 +254,14 @@ bool cgp_randomize_gene(cgp_genome_t genome, int gene)
             #else
                 genome->nodes[node_index].function = (cgp_func_t) rand_range(0, CGP_FUNC_COUNT - 1);
             #endif
+            genome->changed_nodes[node_index] = true;
             TEST_RANDOMIZE_PRINTF("func 0 - %u\n", CGP_FUNC_COUNT - 1);
             return genome->nodes[node_index].is_active;
 
         } else {
             // mutating input
             genome->nodes[node_index].inputs[gene_index] = rand_schoice(_allowed_gene_vals[col].size, _allowed_gene_vals[col].values);
+            genome->changed_nodes[node_index] = true;
             TEST_RANDOMIZE_PRINTF("input choice from %u\n", _allowed_gene_vals[col].size);
             return genome->nodes[node_index].is_active;
         }
@@ -245,14 +285,25 @@ void cgp_mutate_chr(ga_chr_t chromosome)
     assert(_mutation_rate <= CGP_CHR_LENGTH);
     cgp_genome_t genome = (cgp_genome_t) chromosome->genome;
 
+    // remember current phenotype, so the offspring can be evaluated
+    // incrementally
+    cgp_save_parent(genome);
+
+    bool phenotype_changed = false;
     int genes_to_change = rand_range(0, _mutation_rate);
     for (int i = 0; i < genes_to_change; i++) {
         int gene = rand_range(0, CGP_CHR_LENGTH - 1);
-        cgp_randomize_gene(genome, gene);
+        if (cgp_randomize_gene(genome, gene)) {
+            phenotype_changed = true;
+        }
     }
 
     cgp_find_active_blocks(chromosome);
-    chromosome->has_fitness = false;
+
+    // neutral mutation keeps the fitness
+    if (phenotype_changed) {
+        chromosome->has_fitness = false;
+    }
 }
 
 
@@ -269,6 +320,24 @@ void cgp_copy_genome(void *_dst, void *_src)
 
     memcpy(dst->nodes, src->nodes, sizeof(cgp_node_t) * CGP_NODES);
     memcpy(dst->outputs, src->outputs, sizeof(int) * CGP_OUTPUTS);
+
+    // compiled phenotype
+    dst->instr_count = src->instr_count;
+    memcpy(dst->instrs, src->instrs, sizeof(cgp_instr_t) * src->instr_count);
+    memcpy(dst->output_slots, src->output_slots, sizeof(int) * CGP_OUTPUTS);
+    memcpy(dst->node_slots, src->node_slots, sizeof(int) * CGP_NODES);
+
+    // mutation record
+    dst->has_parent = src->has_parent;
+    if (src->has_parent) {
+        dst->parent_instr_count = src->parent_instr_count;
+        memcpy(dst->parent_instrs, src->parent_instrs, sizeof(cgp_instr_t) * src->parent_instr_count);
+        memcpy(dst->parent_slots, src->parent_slots, sizeof(int) * CGP_NODES);
+        memcpy(dst->changed_nodes, src->changed_nodes, sizeof(bool) * CGP_NODES);
+        dst->delta_count = src->delta_count;
+        memcpy(dst->delta_instrs, src->delta_instrs, sizeof(cgp_instr_t) * src->delta_count);
+        memcpy(dst->delta_output_slots, src->delta_output_slots, sizeof(int) * CGP_OUTPUTS);
+    }
 }
 
 
@@ -288,22 +357,19 @@ void cgp_copy_genome(void *_dst, void *_src)
 void cgp_get_output(ga_chr_t chromosome, cgp_value_t *inputs, cgp_value_t *outputs)
 {
     cgp_genome_t genome = (cgp_genome_t) chromosome->genome;
-    cgp_value_t inner_outputs[CGP_INPUTS + CGP_NODES];
+    cgp_value_t values[CGP_SLOTS];
 
     // copy primary inputs to working array
-    memcpy(inner_outputs, inputs, sizeof(cgp_value_t) * CGP_INPUTS);
-
-    for (int i = 0; i < CGP_NODES; i++) {
-        cgp_node_t *n = &(genome->nodes[i]);
+    memcpy(values, inputs, sizeof(cgp_value_t) * CGP_INPUTS);
 
-        // skip inactive blocks
-        if (!n->is_active) continue;
+    for (int i = 0; i < genome->instr_count; i++) {
+        cgp_instr_t *instr = &(genome->instrs[i]);
 
-        cgp_value_t A = inner_outputs[n->inputs[0]];
-        cgp_value_t B = inner_outputs[n->inputs[1]];
+        cgp_value_t A = values[instr->inputs[0]];
+        cgp_value_t B = values[instr->inputs[1]];
         cgp_value_t Y;
 
-        switch (n->function) {
+        switch (instr->function) {
             case c255:          Y = 255;            break;
             case identity:      Y = A;              break;
             case inversion:     Y = 255 - A;        break;
@@ -323,16 +389,21 @@ void cgp_get_output(ga_chr_t chromosome, cgp_value_t *inputs, cgp_value_t *outpu
             default:            abort();
         }
 
-        inner_outputs[CGP_INPUTS + i] = Y;
+        values[CGP_INPUTS + i] = Y;
     }
 
     for (int i = 0; i < CGP_OUTPUTS; i++) {
-        outputs[i] = inner_outputs[genome->outputs[i]];
+        outputs[i] = values[genome->output_slots[i]];
     }
 
 #ifdef TEST_EVAL
-    for (int i = 0; i < CGP_INPUTS + CGP_NODES; i++) {
-        printf("%c: %u = %u\n", (i < CGP_INPUTS? 'I' : 'N'), i, inner_outputs[i]);
+    // values of active nodes, indexed the same way as node inputs
+    for (int i = 0; i < CGP_INPUTS; i++) {
+        printf("I: %u = %u\n", i, values[i]);
+    }
+    for (int i = 0; i < CGP_NODES; i++) {
+        if (genome->node_slots[i] < 0) continue;
+        printf("N: %u = %u\n", i + CGP_INPUTS, values[genome->node_slots[i]]);
     }
     for (int i = 0; i < CGP_OUTPUTS; i++) {
         printf("O: %u = %u\n", i, outputs[i]);
@@ -378,9 +449,478 @@ void cgp_find_active_blocks(ga_chr_t chromosome)
             }
         }
     }
+
+    cgp_compile_phenotype(genome);
+
+    if (genome->has_parent) {
+        cgp_compile_delta(genome);
+    }
+}
+
+
+/* phenotype compilation ******************************************************/
+
+
+// size of CSE hash table, power of two with enough room for all instructions
+#define OPT_TABLE_SIZE (2 * CGP_MAX_NODES)
+
+
+/**
+ * Number of operands really used by each function
+ */
+static const int _func_arity[CGP_FUNC_COUNT] = {
+    [c255] = 0,
+    [identity] = 1,
+    [inversion] = 1,
+    [b_or] = 2,
+    [b_not1or2] = 2,
+    [b_and] = 2,
+    [b_nand] = 2,
+    [b_xor] = 2,
+    [rshift1] = 1,
+    [rshift2] = 1,
+    [swap] = 2,
+    [add] = 2,
+    [add_sat] = 2,
+    [avg] = 2,
+    [max] = 2,
+    [min] = 2,
+};
+
+
+/**
+ * Functions whose operands can be swapped
+ */
+static const bool _func_commutative[CGP_FUNC_COUNT] = {
+    [b_or] = true,
+    [b_and] = true,
+    [b_nand] = true,
+    [b_xor] = true,
+    [add] = true,
+    [add_sat] = true,
+    [avg] = true,
+    [max] = true,
+    [min] = true,
+};
+
+
+/**
+ * State of instruction list being compiled
+ */
+typedef struct {
+    cgp_instr_t *instrs;
+    int count;
+    int first_slot;
+
+    // known constant value of each slot, -1 if not known
+    short values[CGP_DELTA_SLOTS];
+
+    // slot holding given constant, -1 if there is none
+    short const_slots[256];
+
+    // emitted instructions by (function, inputs), index + 1, 0 = empty
+    short table[OPT_TABLE_SIZE];
+} _optimizer_t;
+
+
+/**
+ * Prepares optimizer for compiling new instruction list
+ * @param opt
+ * @param instrs Where to store instructions
+ * @param first_slot Value slot of first instruction, all slots below
+ *                   are treated as unknown values
+ */
+static void _opt_init(_optimizer_t *opt, cgp_instr_t *instrs, int first_slot)
+{
+    opt->instrs = instrs;
+    opt->count = 0;
+    opt->first_slot = first_slot;
+
+    for (int i = 0; i < first_slot; i++) {
+        opt->values[i] = -1;
+    }
+    memset(opt->const_slots, 0xFF, sizeof(opt->const_slots));
+    memset(opt->table, 0, sizeof(opt->table));
+}
+
+
+/**
+ * Calculates function of constant operands. All engines agree on
+ * results except for `avg` of two odd values (see `_opt_emit`).
+ * @param function
+ * @param A
+ * @param B
+ * @return
+ */
+static int _opt_eval(cgp_func_t function, cgp_value_t A, cgp_value_t B)
+{
+    cgp_value_t Y;
+
+    switch (function) {
+        case c255:          Y = 255;                break;
+        case identity:      Y = A;                  break;
+        case inversion:     Y = 255 - A;            break;
+        case b_or:          Y = A | B;              break;
+        case b_not1or2:     Y = ~A | B;             break;
+        case b_and:         Y = A & B;              break;
+        case b_nand:        Y = ~(A & B);           break;
+        case b_xor:         Y = A ^ B;              break;
+        case rshift1:       Y = A >> 1;             break;
+        case rshift2:       Y = A >> 2;             break;
+        case swap:          Y = SWAP(A, B);         break;
+        case add:           Y = A + B;              break;
+        case add_sat:       Y = ADD_SAT(A, B);      break;
+        case avg:           Y = (A + B) >> 1;       break;
+        case max:           Y = MAX(A, B);          break;
+        case min:           Y = MIN(A, B);          break;
+        default:            abort();
+    }
+
+    return Y;
+}
+
+
+/**
+ * Appends instruction, or returns slot of identical instruction
+ * appended earlier
+ * @param opt
+ * @param function
+ * @param a
+ * @param b
+ * @param value Known constant result, or -1
+ * @return value slot
+ */
+static int _opt_append(_optimizer_t *opt, cgp_func_t function, int a, int b,
+    int value)
+{
+    unsigned int hash = ((function * 31u + a) * 1021u + b) & (OPT_TABLE_SIZE - 1);
+
+    while (opt->table[hash]) {
+        cgp_instr_t *instr = &(opt->instrs[opt->table[hash] - 1]);
+        if (instr->function == function
+            && instr->inputs[0] == a
+            && instr->inputs[1] == b)
+        {
+            return opt->first_slot + opt->table[hash] - 1;
+        }
+        hash = (hash + 1) & (OPT_TABLE_SIZE - 1);
+    }
+
+    cgp_instr_t *instr = &(opt->instrs[opt->count]);
+    instr->function = function;
+    instr->inputs[0] = a;
+    instr->inputs[1] = b;
+
+    opt->count++;
+    opt->table[hash] = opt->count;
+
+    int slot = opt->first_slot + opt->count - 1;
+    opt->values[slot] = value;
+    if (value >= 0) {
+        opt->const_slots[value] = slot;
+    }
+    return slot;
 }
 
 
+/**
+ * Returns slot holding given constant, appending instruction which
+ * calculates it if there is no such slot yet
+ * @param opt
+ * @param value
+ * @param function Instruction with constant result
+ * @param a
+ * @param b
+ * @return value slot
+ */
+static int _opt_constant(_optimizer_t *opt, int value, cgp_func_t function,
+    int a, int b)
+{
+    if (opt->const_slots[value] >= 0) {
+        return opt->const_slots[value];
+    }
+    if (value == 255) {
+        function = c255;
+        a = b = 0;
+    }
+    return _opt_append(opt, function, a, b, value);
+}
+
+
+/**
+ * Compiles single node. Identities become aliases of their operand,
+ * constants are folded, operations with neutral or absorbing constant
+ * operands are simplified and repeated instructions are shared.
+ *
+ * All rewrites are exact in every evaluation engine (scalar, SIMD,
+ * JIT, bit-sliced), so the compiled phenotype gives bit-identical
+ * outputs.
+ *
+ * @param opt
+ * @param function
+ * @param a Slot of first operand
+ * @param b Slot of second operand
+ * @return value slot holding node output
+ */
+static int _opt_emit(_optimizer_t *opt, cgp_func_t function, int a, int b)
+{
+    // canonical form of unused and commutative operands,
+    // known constant goes second
+    if (_func_arity[function] < 2) b = a;
+    if (_func_arity[function] < 1) a = b = 0;
+    if (_func_commutative[function] && opt->values[a] >= 0) {
+        int tmp = a; a = b; b = tmp;
+    }
+
+    int va = opt->values[a];
+    int vb = opt->values[b];
+
+    // constant folding; engines differ in rounding of `avg`
+    // (SIMD ones calculate (A >> 1) + (B >> 1)), fold only if it
+    // does not matter
+    bool is_constant = _func_arity[function] == 0
+        || (va >= 0 && (_func_arity[function] == 1 || vb >= 0));
+    if (is_constant && !(function == avg && (va & vb & 1))) {
+        return _opt_constant(opt, _opt_eval(function, va, vb), function, a, b);
+    }
+
+    switch (function) {
+        case identity:
+            return a;
+
+        case inversion:
+            // double negation
+            if (a >= opt->first_slot
+                && opt->instrs[a - opt->first_slot].function == inversion)
+            {
+                return opt->instrs[a - opt->first_slot].inputs[0];
+            }
+            break;
+
+        case b_or:
+            if (a == b || vb == 0) return a;
+            if (vb == 255) return b;
+            break;
+
+        case b_not1or2:
+            if (a == b || va == 0) return _opt_constant(opt, 255, c255, 0, 0);
+            if (va == 255 || vb == 255) return b;
+            if (vb == 0) return _opt_emit(opt, inversion, a, a);
+            break;
+
+        case b_and:
+            if (a == b || vb == 255) return a;
+            if (vb == 0) return b;
+            break;
+
+        case b_nand:
+            if (a == b || vb == 255) return _opt_emit(opt, inversion, a, a);
+            if (vb == 0) return _opt_constant(opt, 255, c255, 0, 0);
+            break;
+
+        case b_xor:
+            if (a == b) return _opt_constant(opt, 0, function, a, b);
+            if (vb == 0) return a;
+            if (vb == 255) return _opt_emit(opt, inversion, a, a);
+            break;
+
+        case add:
+            if (vb == 0) return a;
+            break;
+
+        case add_sat:
+            if (vb == 0) return a;
+            if (vb == 255) return b;
+            break;
+
+        case max:
+            if (a == b || vb == 0) return a;
+            if (vb == 255) return b;
+            break;
+
+        case min:
+            if (a == b || vb == 255) return a;
+            if (vb == 0) return b;
+            break;
+
+        default:
+            break;
+    }
+
+    if (_func_commutative[function] && a > b) {
+        int tmp = a; a = b; b = tmp;
+    }
+    return _opt_append(opt, function, a, b, -1);
+}
+
+
+/**
+ * Compiles active nodes into linear instruction list
+ * (`instrs`, `output_slots` and `node_slots` fields of the genome).
+ * Requires `is_active` flags to be up to date.
+ *
+ * The list is optimized, see `_opt_emit`, so it may be shorter than
+ * number of active nodes.
+ *
+ * @param genome
+ */
+void cgp_compile_phenotype(cgp_genome_t genome)
+{
+    // maps node output index (as used in genes) to value slot
+    int slot_of[CGP_SLOTS];
+    _optimizer_t opt;
+
+    _opt_init(&opt, genome->instrs, CGP_INPUTS);
+
+    for (int i = 0; i < CGP_INPUTS; i++) {
+        slot_of[i] = i;
+    }
+
+    for (int i = 0; i < CGP_NODES; i++) {
+        cgp_node_t *n = &(genome->nodes[i]);
+        if (!n->is_active) {
+            genome->node_slots[i] = -1;
+            continue;
+        }
+
+        int slot = _opt_emit(&opt, n->function,
+            slot_of[n->inputs[0]], slot_of[n->inputs[1]]);
+
+        slot_of[CGP_INPUTS + i] = slot;
+        genome->node_slots[i] = slot;
+    }
+
+    for (int i = 0; i < CGP_OUTPUTS; i++) {
+        genome->output_slots[i] = slot_of[genome->outputs[i]];
+    }
+
+    genome->instr_count = opt.count;
+}
+
+
+/**
+ * Stores current phenotype as parent's one and clears changed nodes
+ * flags. Called before mutation.
+ * @param genome
+ */
+void cgp_save_parent(cgp_genome_t genome)
+{
+    for (int i = 0; i < CGP_NODES; i++) {
+        genome->changed_nodes[i] = false;
+    }
+    memcpy(genome->parent_slots, genome->node_slots, sizeof(int) * CGP_NODES);
+
+    genome->parent_instr_count = genome->instr_count;
+    memcpy(genome->parent_instrs, genome->instrs, sizeof(cgp_instr_t) * genome->instr_count);
+    genome->has_parent = true;
+}
+
+
+/**
+ * Compiles instructions recalculating only nodes affected by mutation
+ * (`delta_instrs` and `delta_output_slots` fields of the genome).
+ *
+ * Node is affected, if it was changed by mutation, was not active in
+ * parent, or any of its inputs is affected. Unaffected nodes are read
+ * from parent's slots. Affected nodes are optimized the same way as
+ * in `cgp_compile_phenotype`.
+ *
+ * @param genome
+ */
+void cgp_compile_delta(cgp_genome_t genome)
+{
+    // maps node output index (as used in genes) to value slot
+    int slot_of[CGP_SLOTS];
+    bool affected[CGP_SLOTS];
+    _optimizer_t opt;
+
+    _opt_init(&opt, genome->delta_instrs, CGP_INPUTS + genome->parent_instr_count);
+
+    for (int i = 0; i < CGP_INPUTS; i++) {
+        slot_of[i] = i;
+        affected[i] = false;
+    }
+
+    for (int i = 0; i < CGP_NODES; i++) {
+        cgp_node_t *n = &(genome->nodes[i]);
+        if (!n->is_active) continue;
+
+        bool is_affected = genome->changed_nodes[i] || genome->parent_slots[i] < 0;
+        for (int k = 0; k < CGP_FUNC_INPUTS; k++) {
+            is_affected = is_affected || affected[n->inputs[k]];
+        }
+        affected[CGP_INPUTS + i] = is_affected;
+
+        if (!is_affected) {
+            slot_of[CGP_INPUTS + i] = genome->parent_slots[i];
+            continue;
+        }
+
+        slot_of[CGP_INPUTS + i] = _opt_emit(&opt, n->function,
+            slot_of[n->inputs[0]], slot_of[n->inputs[1]]);
+    }
+
+    for (int i = 0; i < CGP_OUTPUTS; i++) {
+        genome->delta_output_slots[i] = slot_of[genome->outputs[i]];
+    }
+
+    genome->delta_count = opt.count;
+}
+
+
+
+/**
+ * Calculates hash of active part of the chromosome (its compiled
+ * phenotype), inactive genes do not affect it
+ * @param  chromosome
+ * @return
+ */
+ga_hash_t cgp_phenotype_hash(ga_chr_t chromosome)
+{
+    cgp_genome_t genome = (cgp_genome_t) chromosome->genome;
+
+    // 64-bit FNV-1a
+    ga_hash_t hash = 14695981039346656037ull;
+
+    const unsigned char *data = (const unsigned char*) genome->instrs;
+    size_t length = sizeof(cgp_instr_t) * genome->instr_count;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 1099511628211ull;
+    }
+
+    data = (const unsigned char*) genome->output_slots;
+    length = sizeof(int) * CGP_OUTPUTS;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 1099511628211ull;
+    }
+
+    return hash;
+}
+
+
+/**
+ * Writes compiled phenotype (active instructions and output slots) as
+ * a cache key, see `ga_phenotype_key_func_t`
+ * @param  chromosome
+ * @param  key
+ * @param  size
+ * @return key length
+ */
+size_t cgp_phenotype_key(ga_chr_t chromosome, void *key, size_t size)
+{
+    cgp_genome_t genome = (cgp_genome_t) chromosome->genome;
+
+    size_t instrs_length = sizeof(cgp_instr_t) * genome->instr_count;
+    size_t length = instrs_length + sizeof(int) * CGP_OUTPUTS;
+
+    if (key != NULL && size >= length) {
+        memcpy(key, genome->instrs, instrs_length);
+        memcpy((unsigned char*) key + instrs_length, genome->output_slots,
+            sizeof(int) * CGP_OUTPUTS);
+    }
+
+    return length;
+}
 
 /* population *****************************************************************/
 
@@ -24,11 +24,30 @@
 #include "cgp_config.h"
 
 
+/**
+ * CGP grid geometry, see `cgp_set_geometry`
+ */
+typedef struct {
+    int cols;
+    int rows;
+    int lback;
+} cgp_geometry_t;
+
+extern cgp_geometry_t cgp_geometry;
+
+
 #define CGP_FUNC_INPUTS 2
+#define CGP_COLS (cgp_geometry.cols)
+#define CGP_ROWS (cgp_geometry.rows)
+#define CGP_LBACK (cgp_geometry.lback)
 #define CGP_NODES (CGP_COLS * CGP_ROWS)
 #define CGP_CHR_OUTPUTS_INDEX ((CGP_FUNC_INPUTS + 1) * CGP_NODES)
 #define CGP_CHR_LENGTH (CGP_CHR_OUTPUTS_INDEX + CGP_OUTPUTS)
 
+// sizes of value slots arrays (see cgp_instr_t), enough for any geometry
+#define CGP_SLOTS (CGP_INPUTS + CGP_MAX_NODES)
+#define CGP_DELTA_SLOTS (CGP_SLOTS + CGP_MAX_NODES)
+
 static const ga_problem_type_t CGP_PROBLEM_TYPE = maximize;
 
 typedef unsigned char cgp_value_t;
@@ -65,20 +84,67 @@ typedef struct {
 } cgp_node_t;
 
 
+/**
+ * One instruction of compiled phenotype (= one active node)
+ *
+ * Inputs point to value slots - primary inputs occupy slots
+ * 0 .. CGP_INPUTS - 1, output of k-th instruction is stored
+ * to slot CGP_INPUTS + k.
+ */
+typedef struct {
+    int inputs[CGP_FUNC_INPUTS];
+    cgp_func_t function;
+} cgp_instr_t;
+
+
 /**
  * Chromosome
  */
 struct cgp_genome {
-    cgp_node_t nodes[CGP_COLS * CGP_ROWS];
+    cgp_node_t nodes[CGP_MAX_NODES];
     int outputs[CGP_OUTPUTS];
+
+    /* compiled phenotype - optimized active nodes, in evaluation order,
+       and value slot of each node (-1 if inactive) */
+    int instr_count;
+    cgp_instr_t instrs[CGP_MAX_NODES];
+    int output_slots[CGP_OUTPUTS];
+    int node_slots[CGP_MAX_NODES];
+
+    /* phenotype before last mutation and nodes changed by it */
+    bool has_parent;
+    int parent_instr_count;
+    cgp_instr_t parent_instrs[CGP_MAX_NODES];
+    int parent_slots[CGP_MAX_NODES];
+    bool changed_nodes[CGP_MAX_NODES];
+
+    /* instructions recalculating only nodes affected by last mutation,
+       evaluated on top of parent's value slots (see cgp_compile_delta) */
+    int delta_count;
+    cgp_instr_t delta_instrs[CGP_MAX_NODES];
+    int delta_output_slots[CGP_OUTPUTS];
 };
 typedef struct cgp_genome* cgp_genome_t;
 
 
+/**
+ * Sets CGP grid geometry, must be called before `cgp_init`.
+ * Default geometry is CGP_DEFAULT_COLS x CGP_DEFAULT_ROWS with
+ * l-back CGP_DEFAULT_LBACK.
+ *
+ * @param  cols
+ * @param  rows
+ * @param  lback
+ * @return 0 on success, -1 if geometry is invalid (too many nodes etc.)
+ */
+int cgp_set_geometry(int cols, int rows, int lback);
+
+
 /**
  * Initialize CGP internals
  */
-void cgp_init(int mutation_rate, ga_fitness_func_t fitness_func);
+void cgp_init(int mutation_rate, ga_fitness_func_t fitness_func,
+    ga_batch_fitness_func_t batch_fitness_func);
 
 
 /**
@@ -159,6 +225,25 @@ void cgp_replace_chr(ga_chr_t chromosome, ga_chr_t replacement);
 void cgp_get_output(ga_chr_t chromosome, cgp_value_t *inputs, cgp_value_t *outputs);
 
 
+/**
+ * Calculates hash of active part of the chromosome (its compiled
+ * phenotype), inactive genes do not affect it
+ * @param  chromosome
+ * @return
+ */
+ga_hash_t cgp_phenotype_hash(ga_chr_t chromosome);
+
+
+/**
+ * Writes compiled phenotype as a fitness cache key
+ * @param  chromosome
+ * @param  key buffer, may be NULL
+ * @param  size of the buffer
+ * @return key length
+ */
+size_t cgp_phenotype_key(ga_chr_t chromosome, void *key, size_t size);
+
+
 /**
  * Create new generation
  * @param pop
@@ -202,8 +287,43 @@ static inline int cgp_node_row(int index)
 
 
 /**
- * Finds which blocks are active.
+ * Finds which blocks are active and compiles the phenotype.
  * @param chromosome
  * @param active
  */
 void cgp_find_active_blocks(ga_chr_t chromosome);
+
+
+/**
+ * Compiles active nodes into linear instruction list
+ * (`instrs`, `output_slots` and `node_slots` fields of the genome).
+ * Requires `is_active` flags to be up to date.
+ *
+ * Identity nodes become aliases of their inputs, constants are folded
+ * and repeated nodes are evaluated only once, so the list may be
+ * shorter than number of active nodes. Outputs stay bit-identical.
+ *
+ * @param genome
+ */
+void cgp_compile_phenotype(cgp_genome_t genome);
+
+
+/**
+ * Stores current phenotype as parent's one and clears changed nodes
+ * flags. Called before mutation.
+ * @param genome
+ */
+void cgp_save_parent(cgp_genome_t genome);
+
+
+/**
+ * Compiles instructions recalculating only nodes affected by mutation
+ * (`delta_instrs` and `delta_output_slots` fields of the genome).
+ *
+ * Delta instructions expect parent's phenotype to be already evaluated
+ * in the value slots and store their results after parent's ones,
+ * from slot `CGP_INPUTS + parent_instr_count`.
+ *
+ * @param genome
+ */
+void cgp_compile_delta(cgp_genome_t genome);
@@ -0,0 +1,562 @@
+/*
+ * Colearning in Coevolutionary Algorithms
+ * Bc. Michal Wiglasz <xwigla00@stud.fit.vutbr.cz>
+ *
+ * Master Thesis
+ * 2014/2015
+ *
+ * Supervisor: Ing. Michaela Šikulová <isikulova@fit.vutbr.cz>
+ *
+ * Faculty of Information Technologies
+ * Brno University of Technology
+ * http://www.fit.vutbr.cz/
+ *
+ * Started on 28/07/2014.
+ *      _       _
+ *   __(.)=   =(.)__
+ *   \___)     (___/
+ */
+
+
+// MAP_ANONYMOUS is not part of _XOPEN_SOURCE
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#if defined(JIT) && defined(__x86_64__)
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
+#include "cgp_jit.h"
+
+
+/*
+    Register usage of generated code:
+
+        rdi     pointer to value slots
+        rsi     pointer to constants
+        x0      result (A operand)
+        x1      B operand
+        x7      0xFF constant
+
+    Every instruction loads its operands from slots and stores result back,
+    there is no register allocation.
+ */
+
+#define REG_Y 0
+#define REG_B 1
+#define REG_FF 7
+
+#define BASE_VALUES 7   // rdi
+#define BASE_CONSTANTS 6   // rsi
+
+// offsets in `cgp_jit_constants` (each constant is 32 bytes wide)
+#define CONST_7F 0
+#define CONST_3F 1
+#define CONST_F0 2
+#define CONST_0F 3
+
+// opcodes (second byte after 0F escape, same for SSE2 and AVX2 forms)
+#define OP_LOAD 0x6F
+#define OP_STORE 0x7F
+#define OP_PCMPEQB 0x74
+#define OP_SHIFT 0x71
+#define OP_PXOR 0xEF
+#define OP_POR 0xEB
+#define OP_PAND 0xDB
+#define OP_PSUBB 0xF8
+#define OP_PADDB 0xFC
+#define OP_PADDUSB 0xDC
+#define OP_PMAXUB 0xDE
+#define OP_PMINUB 0xDA
+
+// ModRM reg field extensions of OP_SHIFT
+#define SHIFT_RIGHT 2
+#define SHIFT_LEFT 6
+
+// longest code emitted for one instruction is `avg`: 7 ops, 8 bytes each
+#define MAX_INSTR_CODE 64
+#define MAX_PROLOG_CODE 16
+#define CODE_SIZE (MAX_PROLOG_CODE + MAX_INSTR_CODE * (CGP_MAX_NODES + 1))
+
+
+#define C32(b) b, b, b, b, b, b, b, b, b, b, b, b, b, b, b, b, \
+               b, b, b, b, b, b, b, b, b, b, b, b, b, b, b, b
+
+const unsigned char cgp_jit_constants[] __attribute__ ((aligned (32))) = {
+    C32(0x7F),
+    C32(0x3F),
+    C32(0xF0),
+    C32(0x0F),
+};
+
+
+#if defined(JIT) && defined(__x86_64__)
+
+
+typedef struct {
+    unsigned char *code;
+    int length;
+    cgp_jit_isa_t isa;
+    int width;
+} jit_buffer_t;
+
+
+typedef struct {
+    bool valid;
+    unsigned int hash;
+    unsigned long last_used;
+    cgp_jit_isa_t isa;
+    int first_slot;
+    int instr_count;
+    cgp_instr_t instrs[CGP_MAX_NODES];
+    unsigned char *code;
+} jit_cache_entry_t;
+
+
+typedef struct jit_cache {
+    unsigned char *pages;
+    size_t entry_size;
+    unsigned long clock;
+    jit_cache_entry_t entries[CGP_JIT_CACHE_SIZE];
+
+    // caches of all threads are listed, see `cgp_jit_deinit`
+    struct jit_cache *next;
+} jit_cache_t;
+
+
+static _Thread_local jit_cache_t *_cache = NULL;
+
+// thread's cache is valid only if it was created in current generation,
+// caches of previous ones were freed
+static _Thread_local unsigned int _cache_generation;
+static unsigned int _generation;
+static jit_cache_t *_caches = NULL;
+
+
+/* encoding *******************************************************************/
+
+
+static inline void _emit_byte(jit_buffer_t *buf, unsigned char byte)
+{
+    buf->code[buf->length++] = byte;
+}
+
+
+static inline void _emit_disp32(jit_buffer_t *buf, int32_t disp)
+{
+    memcpy(&buf->code[buf->length], &disp, sizeof(int32_t));
+    buf->length += sizeof(int32_t);
+}
+
+
+/**
+ * Emits prefix and opcode
+ *
+ * SSE2: 66 0F <opcode>
+ * AVX2: C5 <R vvvv L pp> <opcode> (2-byte VEX, 256-bit, 66 implied prefix)
+ */
+static inline void _emit_opcode(jit_buffer_t *buf, unsigned char opcode, int vvvv)
+{
+    if (buf->isa == cgp_jit_sse2) {
+        _emit_byte(buf, 0x66);
+        _emit_byte(buf, 0x0F);
+    } else {
+        _emit_byte(buf, 0xC5);
+        _emit_byte(buf, 0x80 | ((~vvvv & 0x0F) << 3) | 0x04 | 0x01);
+    }
+    _emit_byte(buf, opcode);
+}
+
+
+/**
+ * dst = dst OP [base + disp]
+ * (or plain load/store for OP_LOAD/OP_STORE)
+ */
+static inline void _emit_op_mem(jit_buffer_t *buf, unsigned char opcode,
+    int reg, int base, int32_t disp)
+{
+    // VEX moves have no source operand in vvvv (must be 1111b)
+    int vvvv = (opcode == OP_LOAD || opcode == OP_STORE)? 0 : reg;
+    _emit_opcode(buf, opcode, vvvv);
+    _emit_byte(buf, 0x80 | (reg << 3) | base);  // mod = 10 (disp32)
+    _emit_disp32(buf, disp);
+}
+
+
+/**
+ * dst = dst OP src
+ */
+static inline void _emit_op_reg(jit_buffer_t *buf, unsigned char opcode,
+    int dst, int src)
+{
+    int vvvv = (opcode == OP_LOAD)? 0 : dst;
+    _emit_opcode(buf, opcode, vvvv);
+    _emit_byte(buf, 0xC0 | (dst << 3) | src);  // mod = 11 (register)
+}
+
+
+/**
+ * reg = reg shifted by imm (16-bit lanes)
+ */
+static inline void _emit_shift(jit_buffer_t *buf, int direction, int reg,
+    unsigned char imm)
+{
+    // non-destructive VEX form stores destination in vvvv
+    _emit_opcode(buf, OP_SHIFT, reg);
+    _emit_byte(buf, 0xC0 | (direction << 3) | reg);
+    _emit_byte(buf, imm);
+}
+
+
+static inline void _emit_load_slot(jit_buffer_t *buf, int reg, int slot)
+{
+    _emit_op_mem(buf, OP_LOAD, reg, BASE_VALUES, slot * buf->width);
+}
+
+
+static inline void _emit_op_slot(jit_buffer_t *buf, unsigned char opcode,
+    int reg, int slot)
+{
+    _emit_op_mem(buf, opcode, reg, BASE_VALUES, slot * buf->width);
+}
+
+
+static inline void _emit_op_const(jit_buffer_t *buf, unsigned char opcode,
+    int reg, int constant)
+{
+    // constants are 32 bytes wide regardless of ISA
+    _emit_op_mem(buf, opcode, reg, BASE_CONSTANTS, constant * 32);
+}
+
+
+/* compilation ****************************************************************/
+
+
+/**
+ * Emits code of one instruction, result is left in REG_Y
+ */
+static void _compile_instr(jit_buffer_t *buf, const cgp_instr_t *instr)
+{
+    int a = instr->inputs[0];
+    int b = instr->inputs[1];
+
+    switch (instr->function) {
+        case c255:
+            _emit_op_reg(buf, OP_LOAD, REG_Y, REG_FF);
+            break;
+
+        case identity:
+            _emit_load_slot(buf, REG_Y, a);
+            break;
+
+        case inversion:
+            _emit_op_reg(buf, OP_LOAD, REG_Y, REG_FF);
+            _emit_op_slot(buf, OP_PSUBB, REG_Y, a);
+            break;
+
+        case b_or:
+            _emit_load_slot(buf, REG_Y, a);
+            _emit_op_slot(buf, OP_POR, REG_Y, b);
+            break;
+
+        case b_not1or2:
+            _emit_load_slot(buf, REG_Y, a);
+            _emit_op_reg(buf, OP_PXOR, REG_Y, REG_FF);
+            _emit_op_slot(buf, OP_POR, REG_Y, b);
+            break;
+
+        case b_and:
+            _emit_load_slot(buf, REG_Y, a);
+            _emit_op_slot(buf, OP_PAND, REG_Y, b);
+            break;
+
+        case b_nand:
+            _emit_load_slot(buf, REG_Y, a);
+            _emit_op_slot(buf, OP_PAND, REG_Y, b);
+            _emit_op_reg(buf, OP_PXOR, REG_Y, REG_FF);
+            break;
+
+        case b_xor:
+            _emit_load_slot(buf, REG_Y, a);
+            _emit_op_slot(buf, OP_PXOR, REG_Y, b);
+            break;
+
+        case rshift1:
+            _emit_load_slot(buf, REG_Y, a);
+            _emit_shift(buf, SHIFT_RIGHT, REG_Y, 1);
+            _emit_op_const(buf, OP_PAND, REG_Y, CONST_7F);
+            break;
+
+        case rshift2:
+            _emit_load_slot(buf, REG_Y, a);
+            _emit_shift(buf, SHIFT_RIGHT, REG_Y, 2);
+            _emit_op_const(buf, OP_PAND, REG_Y, CONST_3F);
+            break;
+
+        case swap:
+            _emit_load_slot(buf, REG_Y, a);
+            _emit_shift(buf, SHIFT_LEFT, REG_Y, 4);
+            _emit_op_const(buf, OP_PAND, REG_Y, CONST_F0);
+            _emit_load_slot(buf, REG_B, b);
+            _emit_op_const(buf, OP_PAND, REG_B, CONST_0F);
+            _emit_op_reg(buf, OP_POR, REG_Y, REG_B);
+            break;
+
+        case add:
+            _emit_load_slot(buf, REG_Y, a);
+            _emit_op_slot(buf, OP_PADDB, REG_Y, b);
+            break;
+
+        case add_sat:
+            _emit_load_slot(buf, REG_Y, a);
+            _emit_op_slot(buf, OP_PADDUSB, REG_Y, b);
+            break;
+
+        case avg:
+            // same as SIMD interpreters: (a >> 1) + (b >> 1)
+            _emit_load_slot(buf, REG_Y, a);
+            _emit_shift(buf, SHIFT_RIGHT, REG_Y, 1);
+            _emit_op_const(buf, OP_PAND, REG_Y, CONST_7F);
+            _emit_load_slot(buf, REG_B, b);
+            _emit_shift(buf, SHIFT_RIGHT, REG_B, 1);
+            _emit_op_const(buf, OP_PAND, REG_B, CONST_7F);
+            _emit_op_reg(buf, OP_PADDB, REG_Y, REG_B);
+            break;
+
+        case max:
+            _emit_load_slot(buf, REG_Y, a);
+            _emit_op_slot(buf, OP_PMAXUB, REG_Y, b);
+            break;
+
+        case min:
+            _emit_load_slot(buf, REG_Y, a);
+            _emit_op_slot(buf, OP_PMINUB, REG_Y, b);
+            break;
+
+        default:
+            abort();
+    }
+}
+
+
+/**
+ * Compiles given instructions into `buf`
+ */
+static void _compile(jit_buffer_t *buf, const cgp_instr_t *instrs, int count,
+    int first_slot)
+{
+    // prolog: prepare 0xFF constant
+    _emit_op_reg(buf, OP_PCMPEQB, REG_FF, REG_FF);
+
+    for (int i = 0; i < count; i++) {
+        _compile_instr(buf, &instrs[i]);
+        _emit_op_slot(buf, OP_STORE, REG_Y, first_slot + i);
+        assert(buf->length <= MAX_PROLOG_CODE + MAX_INSTR_CODE * (i + 1));
+    }
+
+    // epilog
+    if (buf->isa == cgp_jit_avx2) {
+        // vzeroupper, avoid AVX-SSE transition penalty in caller
+        _emit_byte(buf, 0xC5);
+        _emit_byte(buf, 0xF8);
+        _emit_byte(buf, 0x77);
+    }
+    _emit_byte(buf, 0xC3);  // ret
+}
+
+
+/* cache **********************************************************************/
+
+
+static jit_cache_t *_cache_init()
+{
+    jit_cache_t *cache = (jit_cache_t*) calloc(1, sizeof(jit_cache_t));
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    // every entry occupies whole pages, so it can be made executable
+    // independently on others
+    size_t page = sysconf(_SC_PAGESIZE);
+    cache->entry_size = ((CODE_SIZE + page - 1) / page) * page;
+    cache->pages = mmap(NULL, cache->entry_size * CGP_JIT_CACHE_SIZE,
+        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (cache->pages == MAP_FAILED) {
+        free(cache);
+        return NULL;
+    }
+
+    #pragma omp critical (CGP_JIT_CACHES)
+    {
+        cache->next = _caches;
+        _caches = cache;
+    }
+    return cache;
+}
+
+
+/**
+ * FNV-1a hash of instruction list
+ */
+static inline unsigned int _instrs_hash(const cgp_instr_t *instrs, int count,
+    int first_slot, cgp_jit_isa_t isa)
+{
+    const unsigned char *data = (const unsigned char*) instrs;
+    size_t length = sizeof(cgp_instr_t) * count;
+
+    uint32_t hash = (2166136261u ^ isa ^ (first_slot << 8));
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+
+/**
+ * Returns compiled code for given chromosome. Code is looked up in
+ * calling thread's cache first and compiled only on cache miss.
+ *
+ * Cache is fully associative with LRU replacement, so pointers returned
+ * by last CGP_JIT_CACHE_SIZE calls from the same thread stay valid.
+ *
+ * @param  chromosome
+ * @param  isa
+ * @return compiled function or NULL, if JIT is not available
+ */
+cgp_jit_func_t cgp_jit_get(ga_chr_t chromosome, cgp_jit_isa_t isa)
+{
+    cgp_genome_t genome = (cgp_genome_t) chromosome->genome;
+    return cgp_jit_get_instrs(genome->instrs, genome->instr_count,
+        CGP_INPUTS, isa);
+}
+
+
+/**
+ * Returns compiled code for given instruction list, result of k-th
+ * instruction is stored into slot `first_slot + k`. Uses the same
+ * cache as `cgp_jit_get`.
+ *
+ * @param  instrs
+ * @param  count
+ * @param  first_slot
+ * @param  isa
+ * @return compiled function or NULL, if JIT is not available
+ */
+cgp_jit_func_t cgp_jit_get_instrs(const cgp_instr_t *instrs, int count,
+    int first_slot, cgp_jit_isa_t isa)
+{
+    if (_cache == NULL || _cache_generation != _generation) {
+        _cache = _cache_init();
+        if (_cache == NULL) {
+            return NULL;
+        }
+        _cache_generation = _generation;
+    }
+
+    unsigned int hash = _instrs_hash(instrs, count, first_slot, isa);
+    int index = 0;
+    _cache->clock++;
+
+    for (int i = 0; i < CGP_JIT_CACHE_SIZE; i++) {
+        jit_cache_entry_t *entry = &_cache->entries[i];
+
+        if (entry->valid
+            && entry->hash == hash
+            && entry->isa == isa
+            && entry->first_slot == first_slot
+            && entry->instr_count == count
+            && memcmp(entry->instrs, instrs, sizeof(cgp_instr_t) * count) == 0)
+        {
+            entry->last_used = _cache->clock;
+            return (cgp_jit_func_t) entry->code;
+        }
+
+        // remember least recently used (or unused) entry for replacement
+        if (!entry->valid) {
+            if (_cache->entries[index].valid) index = i;
+        } else if (_cache->entries[index].valid
+            && entry->last_used < _cache->entries[index].last_used) {
+            index = i;
+        }
+    }
+
+    // cache miss, (re)compile into entry's pages
+    jit_cache_entry_t *entry = &_cache->entries[index];
+    entry->valid = false;
+    entry->code = _cache->pages + index * _cache->entry_size;
+    if (mprotect(entry->code, _cache->entry_size, PROT_READ | PROT_WRITE) != 0) {
+        return NULL;
+    }
+
+    jit_buffer_t buf = {
+        .code = entry->code,
+        .length = 0,
+        .isa = isa,
+        .width = (isa == cgp_jit_avx2)? 32 : 16,
+    };
+    _compile(&buf, instrs, count, first_slot);
+
+    if (mprotect(entry->code, _cache->entry_size, PROT_READ | PROT_EXEC) != 0) {
+        return NULL;
+    }
+
+    entry->hash = hash;
+    entry->last_used = _cache->clock;
+    entry->isa = isa;
+    entry->first_slot = first_slot;
+    entry->instr_count = count;
+    memcpy(entry->instrs, instrs, sizeof(cgp_instr_t) * count);
+    entry->valid = true;
+
+    return (cgp_jit_func_t) entry->code;
+}
+
+
+/**
+ * Releases code caches of all threads, no thread may be compiling or
+ * running cached code meanwhile
+ */
+void cgp_jit_deinit()
+{
+    #pragma omp critical (CGP_JIT_CACHES)
+    {
+        while (_caches != NULL) {
+            jit_cache_t *cache = _caches;
+            _caches = cache->next;
+            munmap(cache->pages, cache->entry_size * CGP_JIT_CACHE_SIZE);
+            free(cache);
+        }
+        _generation++;
+    }
+    _cache = NULL;
+}
+
+
+#else /* JIT not compiled or not supported on this platform */
+
+
+cgp_jit_func_t cgp_jit_get(ga_chr_t chromosome, cgp_jit_isa_t isa)
+{
+    return NULL;
+}
+
+
+cgp_jit_func_t cgp_jit_get_instrs(const cgp_instr_t *instrs, int count,
+    int first_slot, cgp_jit_isa_t isa)
+{
+    return NULL;
+}
+
+
+void cgp_jit_deinit()
+{
+}
+
+
+#endif
@@ -0,0 +1,106 @@
+/*
+ * Colearning in Coevolutionary Algorithms
+ * Bc. Michal Wiglasz <xwigla00@stud.fit.vutbr.cz>
+ *
+ * Master Thesis
+ * 2014/2015
+ *
+ * Supervisor: Ing. Michaela Šikulová <isikulova@fit.vutbr.cz>
+ *
+ * Faculty of Information Technologies
+ * Brno University of Technology
+ * http://www.fit.vutbr.cz/
+ *
+ * Started on 28/07/2014.
+ *      _       _
+ *   __(.)=   =(.)__
+ *   \___)     (___/
+ */
+
+
+/*
+    Runtime compilation of CGP phenotype into x86-64 machine code.
+
+    Generated function works on the same value slots array as the SIMD
+    interpreters (primary inputs first, then outputs of active nodes),
+    one slot is one SSE2 (16 B) or AVX2 (32 B) register wide.
+ */
+
+
+#pragma once
+
+#include "cgp_core.h"
+
+
+/**
+ * Minimal number of SIMD blocks evaluated at once for which it pays off
+ * to compile the chromosome. Shorter runs are interpreted.
+ */
+#define CGP_JIT_MIN_BLOCKS 64
+
+
+/**
+ * Number of compiled chromosomes kept in each thread's code cache
+ */
+#define CGP_JIT_CACHE_SIZE 16
+
+
+/**
+ * Target instruction set
+ */
+typedef enum {
+    cgp_jit_sse2,
+    cgp_jit_avx2,
+} cgp_jit_isa_t;
+
+
+/**
+ * Compiled chromosome.
+ *
+ * Expects primary inputs in slots 0 .. CGP_INPUTS - 1 of `values`,
+ * fills remaining slots - primary output is then stored in
+ * `genome->output_slots[0]`.
+ */
+typedef void (*cgp_jit_func_t)(void *values, const void *constants);
+
+
+/**
+ * Constants used by compiled code, pass them as second argument
+ */
+extern const unsigned char cgp_jit_constants[];
+
+
+/**
+ * Returns compiled code for given chromosome. Code is looked up in
+ * calling thread's cache first and compiled only on cache miss.
+ *
+ * Pointers returned by last CGP_JIT_CACHE_SIZE calls from the same
+ * thread are valid.
+ *
+ * @param  chromosome
+ * @param  isa
+ * @return compiled function or NULL, if JIT is not available
+ */
+cgp_jit_func_t cgp_jit_get(ga_chr_t chromosome, cgp_jit_isa_t isa);
+
+
+/**
+ * Returns compiled code for given instruction list, result of k-th
+ * instruction is stored into slot `first_slot + k`. Uses the same
+ * cache as `cgp_jit_get`.
+ *
+ * @param  instrs
+ * @param  count
+ * @param  first_slot
+ * @param  isa
+ * @return compiled function or NULL, if JIT is not available
+ */
+cgp_jit_func_t cgp_jit_get_instrs(const cgp_instr_t *instrs, int count,
+    int first_slot, cgp_jit_isa_t isa);
+
+
+/**
+ * Releases code caches of all threads, no thread may be compiling or
+ * running cached code meanwhile
+ */
+void cgp_jit_deinit();
@@ -25,7 +25,9 @@
 
 
 /**
- * Loads chromosome from given file stored in CGP-viewer compatible format
+ * Loads chromosome from given file stored in CGP-viewer compatible format.
+ * CGP grid geometry is changed to the one stored in the file.
+ *
  * @param chr
  * @param fp
  * @return 0 on success, -1 on file format error, -2 on incompatible CGP config
@@ -43,36 +45,59 @@ int cgp_load_chr_compat(ga_chr_t chr, FILE *fp)
     if (count != 7) return -1;
     if (inputs != CGP_INPUTS) return -2;
     if (outputs != CGP_OUTPUTS) return -2;
-    if (cols != CGP_COLS) return -2;
-    if (rows != CGP_ROWS) return -2;
     if (func_inputs != CGP_FUNC_INPUTS) return -2;
     if (func_outputs != 1) return -2;
     if (func_count != CGP_FUNC_COUNT) return -2;
 
+    // geometry is taken from the file (l-back does not affect evaluation),
+    // it is switched only after the whole chromosome is parsed
+    if (cols < 1 || rows < 1 || cols * rows > CGP_MAX_NODES) return -2;
+
     // nodes
 
 
-    for (int i = 0; i < CGP_NODES; i++) {
-        cgp_node_t *n = &genome->nodes[i];
+    cgp_node_t nodes[CGP_MAX_NODES];
+    for (int i = 0; i < cols * rows; i++) {
+        cgp_node_t *n = &nodes[i];
 
         int nodeid;
         count = fscanf(fp, "([%u] %u, %u, %u)",
             &nodeid, &n->inputs[0], &n->inputs[1], &n->function);
         if (count != 4) return -1;
         if (nodeid != CGP_INPUTS + i) return -1;
+        if ((unsigned int) n->function >= CGP_FUNC_COUNT) return -1;
+        for (int k = 0; k < CGP_FUNC_INPUTS; k++) {
+            if (n->inputs[k] < 0 || n->inputs[k] >= nodeid) return -1;
+        }
     }
 
     // primary outputs
 
 
+    int primary_outputs[CGP_OUTPUTS];
     fscanf(fp, "(");
     for (int i = 0; i < CGP_OUTPUTS; i++) {
         if (i > 0) fscanf(fp, ",");
-        count = fscanf(fp, "%u", &genome->outputs[i]);
+        count = fscanf(fp, "%u", &primary_outputs[i]);
         if (count != 1) return -1;
+        if (primary_outputs[i] < 0
+            || primary_outputs[i] >= CGP_INPUTS + cols * rows) return -1;
     }
     fscanf(fp, ")\n");
 
+    if (cols != CGP_COLS || rows != CGP_ROWS) {
+        int lback = (CGP_LBACK < cols)? CGP_LBACK : cols;
+        cgp_set_geometry(cols, rows, lback);
+    }
+
+    for (int i = 0; i < CGP_NODES; i++) {
+        genome->nodes[i] = nodes[i];
+    }
+    for (int i = 0; i < CGP_OUTPUTS; i++) {
+        genome->outputs[i] = primary_outputs[i];
+    }
+
+    genome->has_parent = false;
     cgp_find_active_blocks(chr);
 
     return 0;
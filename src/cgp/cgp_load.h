@@ -28,7 +28,9 @@
 
 
 /**
- * Loads chromosome from given file stored in CGP-viewer compatible format
+ * Loads chromosome from given file stored in CGP-viewer compatible format.
+ * CGP grid geometry is changed to the one stored in the file.
+ *
  * @param chr
  * @param fp
  * @return 0 on success, -1 on file format error, -2 on incompatible CGP config
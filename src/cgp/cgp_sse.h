@@ -28,6 +28,18 @@
 typedef __m128i __m128i_aligned __attribute__ ((aligned (16)));
 
 
+/**
+ * Evaluates instructions on value slots using SSE instructions.
+ * Result of k-th instruction is stored into slot `first_slot + k`.
+ * @param instrs
+ * @param count
+ * @param first_slot
+ * @param values
+ */
+void cgp_eval_instrs_sse(const cgp_instr_t *instrs, int count, int first_slot,
+    __m128i_aligned *values);
+
+
 /**
  * Calculate output of given chromosome and inputs using SSE instructions
  * @param chr
@@ -0,0 +1,102 @@
+/*
+ * Colearning in Coevolutionary Algorithms
+ * Bc. Michal Wiglasz <xwigla00@stud.fit.vutbr.cz>
+ *
+ * Master Thesis
+ * 2014/2015
+ *
+ * Supervisor: Ing. Michaela Šikulová <isikulova@fit.vutbr.cz>
+ *
+ * Faculty of Information Technologies
+ * Brno University of Technology
+ * http://www.fit.vutbr.cz/
+ *
+ * Started on 28/07/2014.
+ *      _       _
+ *   __(.)=   =(.)__
+ *   \___)     (___/
+ */
+
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cgp_vector.h"
+
+
+typedef cgp_vector_t vec_t;
+
+
+/**
+ * Calculate output of given chromosome for CGP_VECTOR_BLOCK pixels
+ * @param chr
+ * @param inputs
+ * @param outputs
+ */
+void cgp_get_output_vector(ga_chr_t chromosome,
+    cgp_vector_t inputs[CGP_INPUTS], cgp_vector_t outputs[CGP_OUTPUTS])
+{
+    cgp_genome_t genome = (cgp_genome_t) chromosome->genome;
+
+    // working array - primary inputs followed by outputs of active nodes
+    vec_t values[CGP_SLOTS];
+
+    const vec_t FF = (vec_t) {0} + 0xFF;
+
+    memcpy(values, inputs, sizeof(vec_t) * CGP_INPUTS);
+
+    for (int i = 0; i < genome->instr_count; i++) {
+        cgp_instr_t *instr = &(genome->instrs[i]);
+
+        vec_t A = values[instr->inputs[0]];
+        vec_t B = values[instr->inputs[1]];
+        vec_t Y;
+        vec_t mask;
+
+        switch (instr->function) {
+            case c255:          Y = FF;             break;
+            case identity:      Y = A;              break;
+            case inversion:     Y = FF - A;         break;
+            case b_or:          Y = A | B;          break;
+            case b_not1or2:     Y = ~A | B;         break;
+            case b_and:         Y = A & B;          break;
+            case b_nand:        Y = ~(A & B);       break;
+            case b_xor:         Y = A ^ B;          break;
+            case rshift1:       Y = A >> 1;         break;
+            case rshift2:       Y = A >> 2;         break;
+            case swap:          Y = ((A & 0x0F) << 4) | (B & 0x0F); break;
+            case add:           Y = A + B;          break;
+
+            case add_sat:
+                // sum wrapped around iff it is less than an operand
+                Y = A + B;
+                Y |= (vec_t) (Y < A);
+                break;
+
+            case avg:
+                // (A + B) >> 1 without 9-bit intermediate result
+                Y = (A >> 1) + (B >> 1) + (A & B & 1);
+                break;
+
+            case max:
+                mask = (vec_t) (A > B);
+                Y = (A & mask) | (B & ~mask);
+                break;
+
+            case min:
+                mask = (vec_t) (A < B);
+                Y = (A & mask) | (B & ~mask);
+                break;
+
+            default:
+                abort();
+        }
+
+        values[CGP_INPUTS + i] = Y;
+    }
+
+    for (int i = 0; i < CGP_OUTPUTS; i++) {
+        outputs[i] = values[genome->output_slots[i]];
+    }
+}
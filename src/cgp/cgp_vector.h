@@ -0,0 +1,59 @@
+/*
+ * Colearning in Coevolutionary Algorithms
+ * Bc. Michal Wiglasz <xwigla00@stud.fit.vutbr.cz>
+ *
+ * Master Thesis
+ * 2014/2015
+ *
+ * Supervisor: Ing. Michaela Šikulová <isikulova@fit.vutbr.cz>
+ *
+ * Faculty of Information Technologies
+ * Brno University of Technology
+ * http://www.fit.vutbr.cz/
+ *
+ * Started on 28/07/2014.
+ *      _       _
+ *   __(.)=   =(.)__
+ *   \___)     (___/
+ */
+
+
+/*
+    Portable block CGP evaluation.
+
+    Values of CGP_VECTOR_BLOCK pixels are stored in GCC generic vectors
+    and every active node is evaluated on the whole block at once. The
+    compiler translates the operations to whatever vector instructions
+    the target has (or to scalar code if there are none).
+
+    Semantics match `cgp_get_output` exactly (including `avg`).
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+
+#include "cgp_core.h"
+
+
+/**
+ * Number of pixels evaluated at once
+ */
+#define CGP_VECTOR_BLOCK 64
+
+
+/**
+ * Values of CGP_VECTOR_BLOCK pixels
+ */
+typedef uint8_t cgp_vector_t __attribute__ ((vector_size (CGP_VECTOR_BLOCK)));
+
+
+/**
+ * Calculate output of given chromosome for CGP_VECTOR_BLOCK pixels
+ * @param chr
+ * @param inputs
+ * @param outputs
+ */
+void cgp_get_output_vector(ga_chr_t chromosome,
+    cgp_vector_t inputs[CGP_INPUTS], cgp_vector_t outputs[CGP_OUTPUTS]);
@@ -52,11 +52,15 @@
 #define OPT_CGP_MUTATE 'm'
 #define OPT_CGP_POPSIZE 'p'
 #define OPT_CGP_ARCSIZE 's'
+#define OPT_CGP_COLS                1015
+#define OPT_CGP_ROWS                1016
+#define OPT_CGP_LBACK               1017
 
 #define OPT_PRED_SIZE 'S'
 #define OPT_PRED_MUTATE 'M'
 #define OPT_PRED_POPSIZE 'P'
 #define OPT_PRED_TYPE 'T'
+#define OPT_PRED_SORTED             1018
 
 #define OPT_HELP 'h'
 
@@ -110,12 +114,16 @@ static struct option long_options[] =
     {"cgp-mutate", required_argument, 0, OPT_CGP_MUTATE},
     {"cgp-population-size", required_argument, 0, OPT_CGP_POPSIZE},
     {"cgp-archive-size", required_argument, 0, OPT_CGP_ARCSIZE},
+    {"cgp-cols", required_argument, 0, OPT_CGP_COLS},
+    {"cgp-rows", required_argument, 0, OPT_CGP_ROWS},
+    {"cgp-lback", required_argument, 0, OPT_CGP_LBACK},
 
     /* Predictors */
     {"pred-size", required_argument, 0, OPT_PRED_SIZE},
     {"pred-mutate", required_argument, 0, OPT_PRED_MUTATE},
     {"pred-population-size", required_argument, 0, OPT_PRED_POPSIZE},
     {"pred-type", required_argument, 0, OPT_PRED_TYPE},
+    {"pred-sorted", no_argument, 0, OPT_PRED_SORTED},
 
     /* Baldwin */
     {"bw-algorithm", required_argument, 0, OPT_BW_ALGORITHM},
@@ -243,7 +251,8 @@ config_retval_t config_load_args(int argc, char **argv, config_t *cfg)
                     cfg->algorithm = predictors;
                 } else if (strcmp(optarg, "baldwin") == 0) {
                     cfg->algorithm = baldwin;
-                    if (pred_type_specified && cfg->pred_genome_type != repeated) {
+                    if (pred_type_specified && cfg->pred_genome_type != repeated
+                        && cfg->pred_genome_type != tiled) {
                         fprintf(stderr, "Cannot combine baldwin and permuted genotype.\n");
                         return cfg_err;
                     }
@@ -292,6 +301,18 @@ config_retval_t config_load_args(int argc, char **argv, config_t *cfg)
                 PARSE_INT(cfg->cgp_archive_size);
                 break;
 
+            case OPT_CGP_COLS:
+                PARSE_INT(cfg->cgp_cols);
+                break;
+
+            case OPT_CGP_ROWS:
+                PARSE_INT(cfg->cgp_rows);
+                break;
+
+            case OPT_CGP_LBACK:
+                PARSE_INT(cfg->cgp_lback);
+                break;
+
             case OPT_PRED_SIZE:
                 PARSE_PERCENT(cfg->pred_size);
                 break;
@@ -343,13 +364,20 @@ config_retval_t config_load_args(int argc, char **argv, config_t *cfg)
                 } else if (strcmp(optarg, "repeated-circular") == 0) {
                     cfg->pred_genome_type = circular;
 
+                } else if (strcmp(optarg, "tiled") == 0) {
+                    cfg->pred_genome_type = tiled;
+
                 } else {
-                    fprintf(stderr, "Invalid predictor type (options: permuted, repeated, repeated-circular)\n");
+                    fprintf(stderr, "Invalid predictor type (options: permuted, repeated, repeated-circular, tiled)\n");
                     return cfg_err;
                 }
                 pred_type_specified = true;
                 break;
 
+            case OPT_PRED_SORTED:
+                cfg->pred_sorted = true;
+                break;
+
             case OPT_BW_INTERVAL:
                 PARSE_INT(cfg->bw_interval);
                 break;
@@ -416,6 +444,24 @@ config_retval_t config_load_args(int argc, char **argv, config_t *cfg)
 
     bool advanced_checks_status = true;
 
+    if (cfg->cgp_cols < 1 || cfg->cgp_rows < 1
+        || cfg->cgp_cols * cfg->cgp_rows > CGP_MAX_NODES)
+    {
+        fprintf(stderr, "CGP grid must have between 1 and %d nodes\n", CGP_MAX_NODES);
+        advanced_checks_status = false;
+    } else if (cfg->cgp_mutate_genes < 0 || cfg->cgp_mutate_genes >
+        cfg->cgp_cols * cfg->cgp_rows * (CGP_FUNC_INPUTS + 1) + CGP_OUTPUTS)
+    {
+        fprintf(stderr, "CGP mutation rate cannot be larger than number of genes in chromosome (%d)\n",
+            cfg->cgp_cols * cfg->cgp_rows * (CGP_FUNC_INPUTS + 1) + CGP_OUTPUTS);
+        advanced_checks_status = false;
+    }
+
+    if (cfg->cgp_lback < 1 || cfg->cgp_lback > cfg->cgp_cols) {
+        fprintf(stderr, "CGP l-back must be between 1 and number of columns\n");
+        advanced_checks_status = false;
+    }
+
     if (cfg->pred_initial_size > cfg->pred_size) {
         fprintf(stderr, "Predictors' initial size cannot be larger than their full size\n");
         advanced_checks_status = false;
@@ -465,11 +511,15 @@ void config_save_file(FILE *file, config_t *cfg)
     fprintf(file, "cgp-mutate: %d\n", cfg->cgp_mutate_genes);
     fprintf(file, "cgp-population-size: %d\n", cfg->cgp_population_size);
     fprintf(file, "cgp-archive-size: %d\n", cfg->cgp_archive_size);
+    fprintf(file, "cgp-cols: %d\n", cfg->cgp_cols);
+    fprintf(file, "cgp-rows: %d\n", cfg->cgp_rows);
+    fprintf(file, "cgp-lback: %d\n", cfg->cgp_lback);
     fprintf(file, "\n");
     fprintf(file, "pred-size: %.5g\n", cfg->pred_size);
     fprintf(file, "pred-mutate: %.5g\n", cfg->pred_mutation_rate);
     fprintf(file, "pred-population-size: %d\n", cfg->pred_population_size);
-    fprintf(file, "pred-type: %s\n", cfg->pred_genome_type == permuted? "permuted" : "repeated");
+    fprintf(file, "pred-type: %s\n", pred_genome_type_names[cfg->pred_genome_type]);
+    fprintf(file, "pred-sorted: %s\n", cfg->pred_sorted? "yes" : "no");
     fprintf(file, "\n");
     fprintf(file, "bw-algorithm: %s\n", bw_algorithm_names[cfg->bw_config.algorithm]);
     fprintf(file, "bw-by-max-length: %s\n", cfg->bw_config.use_absolute_increments? "yes" : "no");
@@ -493,11 +543,9 @@ void config_save_file(FILE *file, config_t *cfg)
     fprintf(file, "bw-pred-min-size: %.5g\n", cfg->pred_min_size);
     fprintf(file, "\n");
     fprintf(file, "# Compiler flags\n");
-    fprintf(file, "# CGP_COLS: %d\n", CGP_COLS);
-    fprintf(file, "# CGP_ROWS: %d\n", CGP_ROWS);
     fprintf(file, "# CGP_INPUTS: %d\n", CGP_INPUTS);
     fprintf(file, "# CGP_OUTPUTS: %d\n", CGP_OUTPUTS);
-    fprintf(file, "# CGP_LBACK: %d\n", CGP_LBACK);
+    fprintf(file, "# CGP_MAX_NODES: %d\n", CGP_MAX_NODES);
     #ifdef CGP_LIMIT_FUNCS
         fprintf(file, "# CGP_LIMIT_FUNCS: yes\n");
     #else
@@ -524,4 +572,9 @@ void config_save_file(FILE *file, config_t *cfg)
         fprintf(file, "# SSE2 compiled: no\n");
     #endif
     fprintf(file, "# SSE2 supported by CPU/OS: %s\n", can_use_sse2()? "yes" : "no");
+    #ifdef BITSLICE
+        fprintf(file, "# Bit-sliced evaluation compiled: yes\n");
+    #else
+        fprintf(file, "# Bit-sliced evaluation compiled: no\n");
+    #endif
 }
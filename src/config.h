@@ -66,6 +66,9 @@ typedef struct
     int cgp_mutate_genes;
     int cgp_population_size;
     int cgp_archive_size;
+    int cgp_cols;
+    int cgp_rows;
+    int cgp_lback;
 
     float pred_size;
     float pred_initial_size;
@@ -75,6 +78,7 @@ typedef struct
     float pred_offspring_combine;
     int pred_population_size;
     pred_genome_type_t pred_genome_type;
+    bool pred_sorted;
 
     int bw_interval;
     bw_config_t bw_config;
@@ -162,6 +166,16 @@ static inline void print_help() {
         "    --cgp-archive-size NUM, -s NUM\n"
         "          CGP archive size, default is 10.\n"
         "\n"
+        "    --cgp-cols NUM\n"
+        "          Number of CGP grid columns, default is 8.\n"
+        "\n"
+        "    --cgp-rows NUM\n"
+        "          Number of CGP grid rows, default is 4.\n"
+        "          Grid can have at most 256 nodes (CGP_MAX_NODES).\n"
+        "\n"
+        "    --cgp-lback NUM\n"
+        "          CGP l-back parameter (1 to number of columns), default is 1.\n"
+        "\n"
         "    --pred-size NUM, -S NUM\n"
         "          Predictor size (in percent), default is 0.25.\n"
         "\n"
@@ -172,7 +186,7 @@ static inline void print_help() {
         "          Predictors population size, default is 10.\n"
         "\n"
         "    --pred-type TYPE, -T TYPE\n"
-        "          Predictor genome type, one of {permuted|repeated}\n"
+        "          Predictor genome type, one of {permuted|repeated|repeated-circular|tiled}\n"
         "          Default is \"permuted\" for coevolution and \"repeated\" for baldwin.\n"
         "          - permuted: No value can be repeated in genotype, phenotype equals\n"
         "                      genotype. Cannot be used with \"baldwin\".\n"
@@ -181,7 +195,14 @@ static inline void print_help() {
         "                      shorter than genotype.\n"
         "          - repeated-circular: Same as repeated, but phenotype construction\n"
         "                      starts from any locus (offset). It is determined as the\n"
-        "                      locus with best fitness from 5 tries.\n"
+        "                      locus with best fitness, all loci are scored.\n"
+        "          - tiled: Same as repeated, but genes select tiles of 32x4 pixels\n"
+        "                      instead of single pixels, so that they are evaluated\n"
+        "                      straight from the image. Sizes are in tiles.\n"
+        "\n"
+        "    --pred-sorted\n"
+        "          Keep predictors' phenotype sorted by pixel position, so that\n"
+        "          image data are read sequentially. Fitness is not affected.\n"
         "\n"
         "    --baldwin-interval NUM, -b NUM\n"
         "          Minimal interval of evolution parameters update in \"baldwin\" mode\n"
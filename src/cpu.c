@@ -24,6 +24,9 @@
  */
 
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "cpu.h"
 
 
@@ -184,3 +187,51 @@ bool can_use_sse2()
 {
     return check_sse2();
 }
+
+
+/**
+ * Returns widest SIMD instruction set which is compiled in and supported
+ * by current CPU. Detection is performed only once, on first call.
+ */
+cpu_simd_t cpu_simd_level()
+{
+    static int level = -1;
+
+    if (level < 0) {
+        cpu_simd_t detected = cpu_simd_none;
+
+        #ifdef SSE2
+            if (can_use_sse2()) {
+                detected = cpu_simd_sse2;
+            }
+        #endif
+
+        #ifdef AVX2
+            if (can_use_intel_core_4th_gen_features()) {
+                detected = cpu_simd_avx2;
+            }
+        #endif
+
+        level = detected;
+    }
+
+    return (cpu_simd_t) level;
+}
+
+
+/**
+ * Allocates zero-initialized memory aligned to SIMD_PADDING_BYTES,
+ * release it using `free`
+ *
+ * @param  size
+ * @return pointer or NULL on failure
+ */
+void *cpu_alloc_simd(size_t size)
+{
+    void *ptr;
+    if (posix_memalign(&ptr, SIMD_PADDING_BYTES, size) != 0) {
+        return NULL;
+    }
+    memset(ptr, 0, size);
+    return ptr;
+}
@@ -27,12 +27,32 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <cpuid.h>
 
 
 #define SIMD_PADDING_BYTES 32
 
 
+/**
+ * Function attributes for code using given instruction set, so that
+ * kernels for all instruction sets are compiled into single binary
+ * and selected at runtime (see `cpu_simd_level`)
+ */
+#define CPU_TARGET_SSE2 __attribute__ ((target ("sse2")))
+#define CPU_TARGET_AVX2 __attribute__ ((target ("avx2")))
+
+
+/**
+ * SIMD instruction sets, ordered by width
+ */
+typedef enum {
+    cpu_simd_none = 0,
+    cpu_simd_sse2,
+    cpu_simd_avx2,
+} cpu_simd_t;
+
+
 /**
  * Checks whether current CPU supports AVX2 and other New Haswell features
  */
@@ -51,19 +71,24 @@ bool can_use_sse4_1();
 bool can_use_sse2();
 
 
+/**
+ * Returns widest SIMD instruction set which is compiled in and supported
+ * by current CPU. Detection is performed only once, on first call.
+ */
+cpu_simd_t cpu_simd_level();
+
+
+/**
+ * Allocates zero-initialized memory aligned to SIMD_PADDING_BYTES,
+ * release it using `free`
+ *
+ * @param  size
+ * @return pointer or NULL on failure
+ */
+void *cpu_alloc_simd(size_t size);
+
+
 
 static inline bool can_use_simd() {
-    #ifdef AVX2
-        if (can_use_intel_core_4th_gen_features()) {
-            return true;
-        }
-    #endif
-
-    #ifdef SSE2
-        if (can_use_sse2()) {
-            return true;
-        }
-    #endif
-
-    return false;
+    return cpu_simd_level() != cpu_simd_none;
 }
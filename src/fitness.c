@@ -26,16 +26,77 @@
 #include "cpu.h"
 #include "random.h"
 #include "fitness.h"
+#include "cgp/cgp_bitslice.h"
+#include "cgp/cgp_vector.h"
 
 static img_image_t _original_image;
-static img_window_array_t _noisy_image_windows;
-static img_pixel_t *_noisy_image_simd[WINDOW_SIZE];
+static img_padded_t _noisy_image_padded;
+static img_planes_t _noisy_planes;
+static int _data_length;
 static archive_t _cgp_archive;
 static archive_t _pred_archive;
+
+// squared errors of CGP archive items, row for each pixel, column for
+// each real archive index (see `fitness_cgp_archived`)
+static fitness_error_t *_archive_errors;
+static int _archive_errors_stride;
+
+// incremented whenever `_archive_errors` changes, predictors' error sums
+// are valid only for version they were calculated for
+static unsigned int _archive_errors_version;
 static double _psnr_coeficient;
 
+// working buffers of a thread, buffers of all threads are listed
+// to be freed by `fitness_deinit`
+typedef struct _fitness_buffers {
+    // hash table of gene values of circular genotype with number of
+    // their occurrences in used part of it, and table slot of each
+    // locus, see `_fitness_slide_circular_offset`
+    pred_gene_t *circular_values;
+    unsigned int *circular_counts;
+    unsigned int *circular_slots;
+    int circular_bits;
+
+    // phenotype of other predictor than archived one prepared for
+    // predicting CGP fitness, it is reused while owner and stamp match,
+    // see `_fitness_prepare_scratch`
+    fitness_prepared_t scratch_prepared;
+    pred_prepared_t scratch_kind;
+    pred_genome_t scratch_owner;
+    unsigned long scratch_stamp;
+
+    struct _fitness_buffers *next;
+} _fitness_buffers_t;
+
+static _Thread_local _fitness_buffers_t *_buffers = NULL;
+
+// thread's buffers are valid only if they were allocated in current
+// generation, their sizes depend on image and older ones were freed
+static _Thread_local unsigned int _buffers_generation;
+static unsigned int _generation;
+static _fitness_buffers_t *_all_buffers = NULL;
+
+// how many loci ahead circular window values are prefetched
+#define FITNESS_CIRCULAR_PREFETCH 8
+
+// phenotype of archived predictor prepared for predicting CGP fitness,
+// see `fitness_prepare_predictor`
+static fitness_prepared_t _archived_prepared;
+
+// stamp of the latest batch of predictors, see `_fitness_prepare_scratch`
+static unsigned long _prepare_stamp;
+
+// order in which image chunks are evaluated, see `_fitness_init_chunk_order`
+static int *_chunk_order;
+
 static long _cgp_evals;
 
+#ifdef BITSLICE
+// bit-sliced input planes, CGP_INPUTS values per CGP_BITSLICE_BLOCK pixels
+static cgp_bitslice_value_t *_bitslice_inputs;
+static int _bitslice_blocks;
+#endif
+
 
 static inline double fitness_psnr_coeficient(int pixels_count)
 {
@@ -43,18 +104,182 @@ static inline double fitness_psnr_coeficient(int pixels_count)
 }
 
 
+typedef struct {
+    double error;
+    int chunk;
+} _fitness_chunk_error_t;
+
+
+// orders chunks by decreasing error, ties keep the image order
+static int _fitness_compare_chunks(const void *a, const void *b)
+{
+    const _fitness_chunk_error_t *x = (const _fitness_chunk_error_t*) a;
+    const _fitness_chunk_error_t *y = (const _fitness_chunk_error_t*) b;
+
+    if (x->error != y->error) {
+        return (x->error < y->error) - (x->error > y->error);
+    }
+    return (x->chunk > y->chunk) - (x->chunk < y->chunk);
+}
+
+
 /**
- * For testing purposes only
+ * Sorts image chunks (of FITNESS_BATCH_BLOCK pixels) so that chunks
+ * where noisy image differs most from the original go first. Filters
+ * usually make most errors there, so bounded evaluation can reject
+ * bad chromosomes early.
  */
-void fitness_test_init(img_image_t original_image,
-    img_window_array_t noisy_image_windows,
-    img_pixel_t *noisy_image_simd[WINDOW_SIZE])
+static void _fitness_init_chunk_order(img_image_t noisy)
 {
-    _original_image = original_image;
-    _noisy_image_windows = noisy_image_windows;
+    int length = _data_length;
+    int chunks = (length + FITNESS_BATCH_BLOCK - 1) / FITNESS_BATCH_BLOCK;
+
+    _fitness_chunk_error_t *errors = (_fitness_chunk_error_t*) malloc(
+        sizeof(_fitness_chunk_error_t) * chunks);
+    _chunk_order = (int*) malloc(sizeof(int) * chunks);
+    if (errors == NULL || _chunk_order == NULL) {
+        free(errors);
+        free(_chunk_order);
+        _chunk_order = NULL;
+        return;
+    }
+
+    for (int chunk = 0; chunk < chunks; chunk++) {
+        int start = chunk * FITNESS_BATCH_BLOCK;
+        int end = start + FITNESS_BATCH_BLOCK;
+        if (end > length) end = length;
+
+        errors[chunk].error = 0;
+        errors[chunk].chunk = chunk;
+        for (int i = start; i < end; i++) {
+            int diff = noisy->data[i] - _original_image->data[i];
+            errors[chunk].error += diff * diff;
+        }
+    }
+
+    qsort(errors, chunks, sizeof(_fitness_chunk_error_t),
+        _fitness_compare_chunks);
+
+    for (int i = 0; i < chunks; i++) {
+        _chunk_order[i] = errors[i].chunk;
+    }
+    free(errors);
+}
+
+
+#ifdef BITSLICE
+/**
+ * Transposes noisy image windows into bit-planes, last block is padded
+ * with zeros.
+ */
+static void _fitness_init_bitslice()
+{
+    int length = _data_length;
+    _bitslice_blocks = (length + CGP_BITSLICE_BLOCK - 1) / CGP_BITSLICE_BLOCK;
+
+    _bitslice_inputs = (cgp_bitslice_value_t*) cpu_alloc_simd(
+        sizeof(cgp_bitslice_value_t) * CGP_INPUTS * _bitslice_blocks);
+    if (_bitslice_inputs == NULL) {
+        return;
+    }
+
+    for (int block = 0; block < _bitslice_blocks; block++) {
+        cgp_value_t pixels[CGP_INPUTS][CGP_BITSLICE_BLOCK] = {{0}};
+
+        for (int i = 0; i < CGP_BITSLICE_BLOCK; i++) {
+            int index = block * CGP_BITSLICE_BLOCK + i;
+            if (index >= length) break;
+
+            img_pixel_t window[WINDOW_SIZE];
+            img_planes_get_window(&_noisy_planes, index, window);
+            for (int input = 0; input < CGP_INPUTS; input++) {
+                pixels[input][i] = window[input];
+            }
+        }
+
+        for (int input = 0; input < CGP_INPUTS; input++) {
+            cgp_bitslice_from_pixels(pixels[input],
+                &_bitslice_inputs[block * CGP_INPUTS + input]);
+        }
+    }
+}
+#endif
+
+
+/**
+ * Frees buffers of prepared predictor data
+ */
+static void _fitness_free_prepared(fitness_prepared_t *prepared)
+{
+    free(prepared->original_simd);
+    prepared->original_simd = NULL;
     for (int i = 0; i < WINDOW_SIZE; i++) {
-        _noisy_image_simd[i] = noisy_image_simd[i];
+        free(prepared->pixels_simd[i]);
+        prepared->pixels_simd[i] = NULL;
+    }
+    prepared->capacity = 0;
+
+    free(prepared->mask);
+    prepared->mask = NULL;
+}
+
+
+/**
+ * Frees working buffers of all threads
+ */
+static void _fitness_free_buffers()
+{
+    #pragma omp critical (FITNESS_BUFFERS)
+    {
+        while (_all_buffers != NULL) {
+            _fitness_buffers_t *buffers = _all_buffers;
+            _all_buffers = buffers->next;
+            free(buffers->circular_values);
+            free(buffers->circular_counts);
+            free(buffers->circular_slots);
+            _fitness_free_prepared(&buffers->scratch_prepared);
+            free(buffers);
+        }
+        _generation++;
     }
+    _buffers = NULL;
+}
+
+
+/**
+ * Returns calling thread's working buffers, their contents are
+ * allocated on first use
+ * @return buffers, NULL on allocation failure
+ */
+static _fitness_buffers_t *_fitness_thread_buffers()
+{
+    if (_buffers == NULL || _buffers_generation != _generation) {
+        _buffers = (_fitness_buffers_t*) calloc(1, sizeof(_fitness_buffers_t));
+        if (_buffers == NULL) {
+            return NULL;
+        }
+        _buffers_generation = _generation;
+
+        #pragma omp critical (FITNESS_BUFFERS)
+        {
+            _buffers->next = _all_buffers;
+            _all_buffers = _buffers;
+        }
+    }
+    return _buffers;
+}
+
+
+/**
+ * For testing purposes only
+ */
+void fitness_test_init(img_image_t original_image, img_image_t noisy_image)
+{
+    _original_image = original_image;
+    _noisy_image_padded = img_pad(noisy_image);
+    _data_length = original_image->width * original_image->height;
+    img_padded_planes(_noisy_image_padded, &_noisy_planes);
+    _fitness_free_buffers();
 }
 
 
@@ -73,271 +298,1286 @@ void fitness_init(img_image_t original, img_image_t noisy,
     assert(original->comp == noisy->comp);
 
     _original_image = original;
-    _noisy_image_windows = img_split_windows(noisy);
+    _noisy_image_padded = img_pad(noisy);
+    _data_length = original->width * original->height;
     _cgp_archive = cgp_archive;
     _pred_archive = pred_archive;
-    _psnr_coeficient = fitness_psnr_coeficient(_noisy_image_windows->size);
+    _psnr_coeficient = fitness_psnr_coeficient(_data_length);
     _cgp_evals = 0;
 
+    // buffers of previous image may be too small
+    _fitness_free_buffers();
+
+    // windows are read directly from padded image
+    img_padded_planes(_noisy_image_padded, &_noisy_planes);
+
+    // allocated with first archived circuit, see `fitness_cgp_archived`
+    _archive_errors = NULL;
+
+    if (can_use_simd()) {
+        _fitness_init_chunk_order(noisy);
+    }
+
+#ifdef BITSLICE
+    _fitness_init_bitslice();
+#endif
+}
+
+
+/**
+ * Deinitialize fitness module internals
+ */
+void fitness_deinit()
+{
+    img_padded_destroy(_noisy_image_padded);
+    _noisy_image_padded = NULL;
+
+    free(_chunk_order);
+    _chunk_order = NULL;
+
+    free(_archive_errors);
+    _archive_errors = NULL;
+
+    _fitness_free_buffers();
+
+    _fitness_free_prepared(&_archived_prepared);
+
+#ifdef BITSLICE
+    free(_bitslice_inputs);
+    _bitslice_inputs = NULL;
+#endif
+
+    cgp_jit_deinit();
+}
+
+
+/**
+ * Returns number of performed CGP evaluations
+ */
+long fitness_get_cgp_evals()
+{
+    return _cgp_evals;
+}
+
+
+/**
+ * Filters `count` (at most CGP_VECTOR_BLOCK) pixels of noisy image
+ * starting at `pos` using portable block evaluator
+ *
+ * @param chr
+ * @param pos
+ * @param count
+ * @param filtered Output array
+ */
+static void _fitness_filter_block(ga_chr_t chr, int pos, int count,
+    cgp_value_t *filtered)
+{
+    cgp_vector_t inputs[CGP_INPUTS] = {{0}};
+    cgp_vector_t output;
+    img_pixel_t *input_ptrs[WINDOW_SIZE];
+
+    for (int i = 0; i < WINDOW_SIZE; i++) {
+        input_ptrs[i] = (img_pixel_t*) &inputs[i];
+    }
+
+    img_planes_read(&_noisy_planes, pos, count, input_ptrs);
+    cgp_get_output_vector(chr, inputs, &output);
+    memcpy(filtered, &output, sizeof(cgp_value_t) * count);
+}
+
+
+/**
+ * Filters image using given filter. Caller is responsible for freeing
+ * the filtered image
+ *
+ * @param  chr
+ * @return fitness value
+ */
+img_image_t fitness_filter_image(ga_chr_t chr)
+{
+    img_image_t filtered = img_create(_original_image->width, _original_image->height,
+        _original_image->comp);
+
+    for (int pos = 0; pos < _data_length; pos += CGP_VECTOR_BLOCK) {
+        int count = _data_length - pos;
+        if (count > CGP_VECTOR_BLOCK) count = CGP_VECTOR_BLOCK;
+        _fitness_filter_block(chr, pos, count, &filtered->data[pos]);
+    }
+
+    return filtered;
+}
+
+
+double _fitness_get_sqdiffsum_scalar(ga_chr_t chr)
+{
+    double sum = 0;
+    for (int pos = 0; pos < _data_length; pos += CGP_VECTOR_BLOCK) {
+        int count = _data_length - pos;
+        if (count > CGP_VECTOR_BLOCK) count = CGP_VECTOR_BLOCK;
+
+        cgp_value_t filtered[CGP_VECTOR_BLOCK];
+        _fitness_filter_block(chr, pos, count, filtered);
+
+        // at most CGP_VECTOR_BLOCK * 255^2, fits into int
+        int block_sum = 0;
+        for (int i = 0; i < count; i++) {
+            int diff = filtered[i] - _original_image->data[pos + i];
+            block_sum += diff * diff;
+        }
+        sum += block_sum;
+    }
+    #pragma omp atomic
+        _cgp_evals += _data_length;
+    return sum;
+}
+
+
+#ifdef BITSLICE
+double _fitness_get_sqdiffsum_bitslice(ga_chr_t chr)
+{
+    int length = _data_length;
+    double sum = 0;
+
+    for (int block = 0; block < _bitslice_blocks; block++) {
+        cgp_bitslice_value_t output;
+        cgp_value_t pixels[CGP_BITSLICE_BLOCK];
+
+        cgp_get_output_bitslice(chr,
+            &_bitslice_inputs[block * CGP_INPUTS], &output);
+        cgp_bitslice_to_pixels(&output, pixels);
+
+        int start = block * CGP_BITSLICE_BLOCK;
+        int count = length - start;
+        if (count > CGP_BITSLICE_BLOCK) count = CGP_BITSLICE_BLOCK;
+
+        for (int i = 0; i < count; i++) {
+            int diff = pixels[i] - _original_image->data[start + i];
+            sum += diff * diff;
+        }
+    }
+
+    #pragma omp atomic
+        _cgp_evals += length;
+    return sum;
+}
+#endif
+
+
+/**
+ * Fills window planes with simd-friendly predictor arrays (they form
+ * single row of `used_pixels` windows)
+ */
+static inline void _fitness_predictor_planes(pred_genome_t predictor,
+    const fitness_prepared_t *prepared, img_planes_t *planes)
+{
+    for (int i = 0; i < WINDOW_SIZE; i++) {
+        planes->planes[i] = prepared->pixels_simd[i];
+    }
+    planes->width = predictor->used_pixels;
+    planes->stride = predictor->used_pixels;
+}
+
+
+/**
+ * SIMD evaluators for one instruction set
+ */
+typedef struct {
+    fitness_simd_func_t func;
+    fitness_multi_func_t multi_func;
+    fitness_jit_func_t jit_func;
+    fitness_delta_func_t delta_func;
+    fitness_filter_func_t filter_func;
+    fitness_masked_func_t masked_func;
+    fitness_runs_func_t runs_func;
+    cgp_jit_isa_t jit_isa;
+    int block_size;
+
+    // vectors evaluated in one pass by `multi_func`
+    int blocks;
+} fitness_simd_impl_t;
+
+
+/**
+ * Evaluators dispatch table, indexed by `cpu_simd_level()`
+ */
+static const fitness_simd_impl_t _simd_impls[] = {
+    [cpu_simd_none] = {
+        .func = NULL,
+    },
+    [cpu_simd_sse2] = {
+        .func = _fitness_get_sqdiffsum_sse,
+        .jit_func = _fitness_get_sqdiffsum_sse_jit,
+        .delta_func = _fitness_get_sqdiffsum_sse_delta,
+        .filter_func = _fitness_filter_sse,
+        .masked_func = _fitness_get_sqdiffsum_sse_masked,
+        .runs_func = _fitness_get_sqdiffsum_sse_runs,
+        .jit_isa = cgp_jit_sse2,
+        .block_size = FITNESS_SSE2_STEP,
+    },
+    [cpu_simd_avx2] = {
+        .func = _fitness_get_sqdiffsum_avx,
+        .multi_func = _fitness_get_sqdiffsum_avx_multi,
+        .jit_func = _fitness_get_sqdiffsum_avx_jit,
+        .delta_func = _fitness_get_sqdiffsum_avx_delta,
+        .filter_func = _fitness_filter_avx,
+        .masked_func = _fitness_get_sqdiffsum_avx_masked,
+        .runs_func = _fitness_get_sqdiffsum_avx_runs,
+        .jit_isa = cgp_jit_avx2,
+        .block_size = FITNESS_AVX2_STEP,
+        .blocks = FITNESS_AVX2_BLOCKS,
+    },
+};
+
+
+/**
+ * Selects widest SIMD evaluators supported by current CPU
+ */
+static inline const fitness_simd_impl_t *_fitness_select_simd()
+{
+    const fitness_simd_impl_t *impl = &_simd_impls[cpu_simd_level()];
+    assert(impl->func != NULL);
+    return impl;
+}
+
+
+/**
+ * Evaluates chromosome (without compiling it) on given part of data,
+ * using multi-block evaluator if CPU has one
+ */
+static inline double _fitness_eval_simd_func(const fitness_simd_impl_t *impl,
+    img_pixel_t *original, const img_planes_t *noisy, ga_chr_t chr,
+    int offset, int length)
+{
+    if (impl->multi_func && impl->blocks > 1) {
+        return impl->multi_func(original, noisy, chr, impl->blocks,
+            offset, length);
+    }
+    return impl->func(original, noisy, chr, offset, length);
+}
+
+
+double _fitness_get_sqdiffsum_simd(ga_chr_t chr, img_pixel_t *original, const img_planes_t *noisy, int data_length)
+{
+    const fitness_simd_impl_t *impl = _fitness_select_simd();
+    cgp_jit_func_t code = NULL;
+    double sum = 0;
+
+    // compile the chromosome only if there is enough work to amortize it
+    if (data_length / impl->block_size >= CGP_JIT_MIN_BLOCKS) {
+        code = cgp_jit_get(chr, impl->jit_isa);
+    }
+
+    if (code) {
+        sum = impl->jit_func(original, noisy, chr, code, 0, data_length);
+    } else {
+        sum = _fitness_eval_simd_func(impl, original, noisy, chr, 0, data_length);
+    }
+
+    #pragma omp atomic
+        _cgp_evals += data_length;
+
+    return sum;
+}
+
+
+/**
+ * Checks whether chromosomes can be evaluated incrementally, i.e. all
+ * of them were mutated from the same parent and it is cheaper to
+ * evaluate the parent and mutated parts than all chromosomes
+ */
+static bool _fitness_can_eval_delta(ga_chr_t *chrs, int count)
+{
+    cgp_genome_t first = (cgp_genome_t) chrs[0]->genome;
+    if (!first->has_parent) {
+        return false;
+    }
+
+    int full_cost = 0;
+    int delta_cost = first->parent_instr_count;
+
+    for (int c = 0; c < count; c++) {
+        cgp_genome_t genome = (cgp_genome_t) chrs[c]->genome;
+
+        if (!genome->has_parent
+            || genome->parent_instr_count != first->parent_instr_count
+            || memcmp(genome->parent_instrs, first->parent_instrs,
+                sizeof(cgp_instr_t) * first->parent_instr_count) != 0)
+        {
+            return false;
+        }
+
+        full_cost += genome->instr_count;
+        delta_cost += genome->delta_count;
+    }
+
+    return delta_cost < full_cost;
+}
+
+
+/**
+ * Calculates squared differences sums of multiple chromosomes at once.
+ *
+ * Data are walked in FITNESS_BATCH_BLOCK long chunks (split among
+ * threads) and all chromosomes are evaluated on each chunk while its
+ * data are still in L1 cache. At most FITNESS_BATCH_MAX chromosomes
+ * can be evaluated at once (so their compiled code fits into JIT cache).
+ *
+ * Offspring of common parent are evaluated incrementally, if it pays off.
+ *
+ * Evaluation of a chromosome is stopped as soon as its sum exceeds
+ * `max_sum`, returned sum is partial then (but still > `max_sum`).
+ *
+ * @param chrs
+ * @param count
+ * @param original
+ * @param noisy
+ * @param data_length
+ * @param order Order of chunks to evaluate, NULL for natural order
+ * @param max_sum
+ * @param sums Output array of `count` sums
+ */
+void _fitness_get_sqdiffsum_simd_batch(ga_chr_t *chrs, int count,
+    img_pixel_t *original, const img_planes_t *noisy, int data_length,
+    int *order, double max_sum, double *sums)
+{
+    const fitness_simd_impl_t *impl = _fitness_select_simd();
+    cgp_jit_isa_t jit_isa = impl->jit_isa;
+    long evals = 0;
+
+    assert(count <= FITNESS_BATCH_MAX);
+
+    bool use_jit = (data_length / impl->block_size >= CGP_JIT_MIN_BLOCKS);
+    bool use_delta = _fitness_can_eval_delta(chrs, count);
+    int chunks = (data_length + FITNESS_BATCH_BLOCK - 1) / FITNESS_BATCH_BLOCK;
+
+    for (int c = 0; c < count; c++) {
+        sums[c] = 0;
+    }
+
+    // sums of integers are exact, so the order of additions does not matter
+    #pragma omp parallel reduction(+:evals)
+    {
+        // compiled code is cached per-thread
+        cgp_jit_func_t parent_code = NULL;
+        cgp_jit_func_t codes[count];
+
+        // chromosomes still being evaluated by this thread
+        int active_count = count;
+        int active[count];
+        ga_chr_t active_chrs[count];
+        cgp_jit_func_t active_codes[count];
+
+        if (use_jit && use_delta) {
+            cgp_genome_t first = (cgp_genome_t) chrs[0]->genome;
+            int first_slot = CGP_INPUTS + first->parent_instr_count;
+
+            parent_code = cgp_jit_get_instrs(first->parent_instrs,
+                first->parent_instr_count, CGP_INPUTS, jit_isa);
+
+            for (int c = 0; c < count; c++) {
+                cgp_genome_t genome = (cgp_genome_t) chrs[c]->genome;
+                codes[c] = cgp_jit_get_instrs(genome->delta_instrs,
+                    genome->delta_count, first_slot, jit_isa);
+            }
+
+        } else {
+            for (int c = 0; c < count; c++) {
+                codes[c] = use_jit? cgp_jit_get(chrs[c], jit_isa) : NULL;
+            }
+        }
+
+        for (int c = 0; c < count; c++) {
+            active[c] = c;
+            active_chrs[c] = chrs[c];
+            active_codes[c] = codes[c];
+        }
+
+        // chunks are handed out one by one in `order`, so that all threads
+        // start with the chunks where chromosomes make most errors
+        #pragma omp for schedule(dynamic)
+        for (int i = 0; i < chunks; i++) {
+            if (active_count == 0) continue;
+
+            int chunk = order? order[i] : i;
+            int start = chunk * FITNESS_BATCH_BLOCK;
+            int end = start + FITNESS_BATCH_BLOCK;
+            if (end > data_length) end = data_length;
+
+            evals += (long) (end - start) * active_count;
+
+            double chunk_sums[active_count];
+            if (use_delta) {
+                // parent's values are reused by all chromosomes
+                for (int k = 0; k < active_count; k++) {
+                    chunk_sums[k] = 0;
+                }
+
+                impl->delta_func(original, noisy, active_chrs, active_count,
+                    parent_code, active_codes, start, end - start, chunk_sums);
+
+            } else {
+                for (int k = 0; k < active_count; k++) {
+                    int c = active[k];
+
+                    if (codes[c]) {
+                        chunk_sums[k] = impl->jit_func(original, noisy, chrs[c],
+                            codes[c], start, end - start);
+                    } else {
+                        chunk_sums[k] = _fitness_eval_simd_func(impl,
+                            original, noisy, chrs[c], start, end - start);
+                    }
+                }
+            }
+
+            // sums are shared by all threads, so chromosomes are stopped
+            // as soon as the total of evaluated chunks is too bad
+            int kept = 0;
+            for (int k = 0; k < active_count; k++) {
+                int c = active[k];
+                double total;
+
+                #pragma omp atomic capture
+                total = sums[c] += chunk_sums[k];
+
+                if (total > max_sum) continue;
+                active[kept] = c;
+                active_chrs[kept] = chrs[c];
+                active_codes[kept] = codes[c];
+                kept++;
+            }
+            active_count = kept;
+        }
+    }
+
+    #pragma omp atomic
+        _cgp_evals += evals;
+}
+
+
+/**
+ * Evaluates CGP chromosomes in batches of at most FITNESS_BATCH_MAX.
+ *
+ * If `bound` is set, chromosomes which are certainly worse get
+ * `is_rejected` flag and only approximate fitness.
+ *
+ * @param chrs
+ * @param count
+ * @param bound
+ * @param original
+ * @param noisy
+ * @param data_length
+ * @param order Order of data chunks, NULL for natural order
+ */
+static void _fitness_eval_simd_batch(ga_chr_t *chrs, int count,
+    ga_fitness_t *bound, img_pixel_t *original, const img_planes_t *noisy,
+    int data_length, int *order)
+{
+    double coef = fitness_psnr_coeficient(data_length);
+    double max_sum = INFINITY;
+
+    // fitness = coef / sum, chromosome is worse than the bound (and not
+    // considered same by `ga_is_same`), if its sum exceeds max_sum
+    if (bound && *bound > FITNESS_EPSILON) {
+        max_sum = coef / (*bound - FITNESS_EPSILON);
+    }
+
+    for (int i = 0; i < count; i += FITNESS_BATCH_MAX) {
+        int n = (count - i < FITNESS_BATCH_MAX)? count - i : FITNESS_BATCH_MAX;
+        double sums[n];
+
+        _fitness_get_sqdiffsum_simd_batch(&chrs[i], n, original, noisy,
+            data_length, order, max_sum, sums);
+
+        for (int c = 0; c < n; c++) {
+            chrs[i + c]->fitness = coef / sums[c];
+            chrs[i + c]->is_rejected = (sums[c] > max_sum);
+        }
+    }
+}
+
+
+/**
+ * Evaluates CGP circuit fitness
+ *
+ * @param  chr
+ * @return fitness value
+ */
+ga_fitness_t fitness_eval_cgp(ga_chr_t chr)
+{
+    double sum = 0;
+
+#ifdef BITSLICE
+    if (_bitslice_inputs) {
+        return _psnr_coeficient / _fitness_get_sqdiffsum_bitslice(chr);
+    }
+#endif
+
+    if(can_use_simd()) {
+        sum = _fitness_get_sqdiffsum_simd(chr, _original_image->data,
+            &_noisy_planes, _data_length);
+
+    } else {
+        sum = _fitness_get_sqdiffsum_scalar(chr);
+    }
+
+    return _psnr_coeficient / sum;
+}
+
+
+/**
+ * Evaluates CGP circuit fitness
+ *
+ * @param  chr
+ * @return fitness value
+ */
+ga_fitness_t fitness_eval_or_predict_cgp(ga_chr_t chr)
+{
+    if (_pred_archive && _pred_archive->stored > 0) {
+        return fitness_predict_cgp(chr, arc_get(_pred_archive, 0));
+    } else {
+        return fitness_eval_cgp(chr);
+    }
+}
+
+
+/**
+ * Evaluates fitness of multiple CGP circuits at once, results are
+ * stored in chromosomes `fitness` attribute
+ *
+ * @param  chrs
+ * @param  count
+ * @param  bound Fitness of current parent or NULL
+ */
+void fitness_eval_cgp_batch(ga_chr_t *chrs, int count, ga_fitness_t *bound)
+{
+    bool use_simd = can_use_simd();
+
+#ifdef BITSLICE
+    // bit-sliced engine evaluates whole image per chromosome
+    use_simd = use_simd && !_bitslice_inputs;
+#endif
+
+    if (!use_simd) {
+        #pragma omp parallel for
+        for (int i = 0; i < count; i++) {
+            chrs[i]->fitness = fitness_eval_cgp(chrs[i]);
+        }
+        return;
+    }
+
+    _fitness_eval_simd_batch(chrs, count, bound, _original_image->data,
+        &_noisy_planes, _data_length, _chunk_order);
+}
+
+
+/**
+ * Batch version of `fitness_eval_or_predict_cgp`, results are
+ * stored in chromosomes `fitness` attribute
+ *
+ * @param  chrs
+ * @param  count
+ * @param  bound Fitness of current parent or NULL
+ */
+void fitness_eval_or_predict_cgp_batch(ga_chr_t *chrs, int count,
+    ga_fitness_t *bound)
+{
+    if (!_pred_archive || _pred_archive->stored == 0) {
+        fitness_eval_cgp_batch(chrs, count, bound);
+        return;
+    }
+
+    ga_chr_t pred_chr = arc_get(_pred_archive, 0);
+    pred_genome_t predictor = (pred_genome_t) pred_chr->genome;
+    img_planes_t planes;
+
+    if (!can_use_simd() || predictor->prepared != pred_gathered) {
+        #pragma omp parallel for
+        for (int i = 0; i < count; i++) {
+            chrs[i]->fitness = fitness_predict_cgp(chrs[i], pred_chr);
+        }
+        return;
+    }
+
+    _fitness_predictor_planes(predictor, &_archived_prepared, &planes);
+    _fitness_eval_simd_batch(chrs, count, bound, _archived_prepared.original_simd,
+        &planes, predictor->used_pixels, NULL);
+}
+
+
+double _fitness_predict_cgp_scalar(ga_chr_t cgp_chr, pred_genome_t predictor)
+{
+    double sum = 0;
+    cgp_vector_t inputs[CGP_INPUTS] = {{0}};
+    cgp_vector_t output;
+
+    for (int pos = 0; pos < predictor->used_pixels; pos += CGP_VECTOR_BLOCK) {
+        int count = predictor->used_pixels - pos;
+        if (count > CGP_VECTOR_BLOCK) count = CGP_VECTOR_BLOCK;
+
+        // fetch windows specified by predictor
+        for (int k = 0; k < count; k++) {
+            pred_gene_t index = predictor->pixels[pos + k];
+            assert(index < _data_length);
+
+            img_pixel_t window[WINDOW_SIZE];
+            img_planes_get_window(&_noisy_planes, index, window);
+            for (int i = 0; i < CGP_INPUTS; i++) {
+                inputs[i][k] = window[i];
+            }
+        }
+
+        cgp_get_output_vector(cgp_chr, inputs, &output);
+
+        int block_sum = 0;
+        for (int k = 0; k < count; k++) {
+            int diff = output[k] - _original_image->data[predictor->pixels[pos + k]];
+            block_sum += diff * diff;
+        }
+        sum += block_sum;
+    }
+
+    #pragma omp atomic
+        _cgp_evals += predictor->used_pixels;
+
+    return sum;
+}
+
+
+/**
+ * Sums squared differences of pixels marked in predictor's mask, whole
+ * image is streamed through the circuit
+ */
+static double _fitness_predict_cgp_masked(ga_chr_t cgp_chr,
+    const pred_bitset_word_t *mask)
+{
+    double sum = 0;
+
     if (can_use_simd()) {
-        img_split_windows_simd(noisy, _noisy_image_simd);
+        const fitness_simd_impl_t *impl = _fitness_select_simd();
+        cgp_jit_func_t code = NULL;
+
+        if (_data_length / impl->block_size >= CGP_JIT_MIN_BLOCKS) {
+            code = cgp_jit_get(cgp_chr, impl->jit_isa);
+        }
+
+        sum = impl->masked_func(_original_image->data, &_noisy_planes,
+            cgp_chr, code, mask, 0, _data_length);
+
+    } else {
+        cgp_value_t filtered[CGP_VECTOR_BLOCK];
+
+        for (int pos = 0; pos < _data_length; pos += CGP_VECTOR_BLOCK) {
+            int count = _data_length - pos;
+            if (count > CGP_VECTOR_BLOCK) count = CGP_VECTOR_BLOCK;
+
+            _fitness_filter_block(cgp_chr, pos, count, filtered);
+
+            int block_sum = 0;
+            for (int k = 0; k < count; k++) {
+                int diff = filtered[k] - _original_image->data[pos + k];
+                block_sum += pred_bitset_get(mask, pos + k) * diff * diff;
+            }
+            sum += block_sum;
+        }
+    }
+
+    #pragma omp atomic
+        _cgp_evals += _data_length;
+
+    return sum;
+}
+
+
+/**
+ * Sums squared differences of pixels in predictor's runs, they are read
+ * straight from the image (SIMD only)
+ */
+static double _fitness_predict_cgp_runs(ga_chr_t cgp_chr, pred_genome_t predictor)
+{
+    const fitness_simd_impl_t *impl = _fitness_select_simd();
+    cgp_jit_func_t code = NULL;
+
+    if (predictor->used_pixels / impl->block_size >= CGP_JIT_MIN_BLOCKS) {
+        code = cgp_jit_get(cgp_chr, impl->jit_isa);
+    }
+
+    double sum = impl->runs_func(_original_image->data, &_noisy_planes,
+        cgp_chr, code, predictor->runs, predictor->runs_count);
+
+    #pragma omp atomic
+        _cgp_evals += predictor->used_pixels;
+
+    return sum;
+}
+
+
+/**
+ * Allocates buffers for pixels prepared in given way, unless they are
+ * allocated already. Gathered arrays grow to hold `count` pixels.
+ * @return 0 on success
+ */
+static int _fitness_alloc_prepared(fitness_prepared_t *prepared,
+    pred_prepared_t kind, int count)
+{
+    if (kind == pred_gathered && prepared->capacity < count) {
+        _fitness_free_prepared(prepared);
+
+        // aligned and zeroed, since we want initialized padding bits
+        int padding = SIMD_PADDING_BYTES - (count % SIMD_PADDING_BYTES);
+        prepared->original_simd = (img_pixel_t *) cpu_alloc_simd(sizeof(img_pixel_t) * (count + padding));
+        if (prepared->original_simd == NULL) {
+            return -1;
+        }
+
+        for (int i = 0; i < WINDOW_SIZE; i++) {
+            prepared->pixels_simd[i] = (img_pixel_t *) cpu_alloc_simd(sizeof(img_pixel_t) * (count + padding));
+            if (prepared->pixels_simd[i] == NULL) {
+                _fitness_free_prepared(prepared);
+                return -1;
+            }
+        }
+        prepared->capacity = count;
+    }
+
+    if (kind == pred_masked && prepared->mask == NULL) {
+        // padded by one word, so that any 32 bits can be read at once
+        int words = (_data_length + PRED_BITSET_WORD_BITS - 1) / PRED_BITSET_WORD_BITS + 1;
+        prepared->mask = (pred_bitset_word_t*) malloc(sizeof(pred_bitset_word_t) * words);
+        if (prepared->mask == NULL) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * Prepares predictor's pixels into given buffers, see
+ * `fitness_prepare_predictor`
+ *
+ * @param predictor
+ * @param prepared
+ * @return how the pixels were prepared, `pred_unprepared` if buffers
+ *         cannot be allocated (scalar evaluator is used then)
+ */
+static pred_prepared_t _fitness_prepare(pred_genome_t predictor,
+    fitness_prepared_t *prepared)
+{
+    if (predictor->runs) {
+        return pred_tiled;
+    }
+
+    // evaluating all pixels costs little more than evaluating gathered
+    // ones, but there is nothing to gather
+    if (predictor->used_pixels >= FITNESS_MASK_MIN_DENSITY * _data_length
+        && _fitness_alloc_prepared(prepared, pred_masked, 0) == 0) {
+
+        // mask is padded by one word, see `fitness_mask_bits`
+        int words = (_data_length + PRED_BITSET_WORD_BITS - 1) / PRED_BITSET_WORD_BITS + 1;
+        memset(prepared->mask, 0, sizeof(pred_bitset_word_t) * words);
+
+        // repeated pixels cannot be marked in mask
+        bool unique = true;
+        for (int i = 0; i < predictor->used_pixels && unique; i++) {
+            unique = !pred_bitset_get(prepared->mask, predictor->pixels[i]);
+            pred_bitset_set(prepared->mask, predictor->pixels[i]);
+        }
+
+        if (unique) {
+            return pred_masked;
+        }
+    }
+
+    if (!can_use_simd()) {
+        // scalar evaluator reads pixels directly
+        return pred_gathered;
+
+    } else if (_fitness_alloc_prepared(prepared, pred_gathered,
+            predictor->used_pixels) == 0) {
+        fitness_prepare_predictor_for_simd(predictor, prepared);
+        return pred_gathered;
     }
+
+    return pred_unprepared;
 }
 
 
 /**
- * Deinitialize fitness module internals
+ * Returns pixels of predictor prepared for predicting CGP fitness.
+ * Archived predictor has them prepared already, others are prepared
+ * into buffers of calling thread.
+ *
+ * @param predictor
+ * @param stamp If non-zero, pixels prepared for the same predictor
+ *              and stamp are reused (predictor must not change meanwhile)
+ * @param prepared Prepared data
+ * @return how the pixels were prepared
  */
-void fitness_deinit()
+static pred_prepared_t _fitness_prepare_scratch(pred_genome_t predictor,
+    unsigned long stamp, const fitness_prepared_t **prepared)
 {
-    img_windows_destroy(_noisy_image_windows);
+    if (predictor->prepared != pred_unprepared) {
+        *prepared = &_archived_prepared;
+        return predictor->prepared;
+    }
 
-    for (int i = 0; i < WINDOW_SIZE; i++) {
-        free(_noisy_image_simd[i]);
+    _fitness_buffers_t *buffers = _fitness_thread_buffers();
+    if (buffers == NULL) {
+        // scalar evaluator reads pixels directly
+        *prepared = NULL;
+        return pred_unprepared;
     }
-}
 
+    if (stamp == 0 || stamp != buffers->scratch_stamp
+        || predictor != buffers->scratch_owner) {
+        buffers->scratch_kind = _fitness_prepare(predictor, &buffers->scratch_prepared);
+        buffers->scratch_owner = predictor;
+        buffers->scratch_stamp = stamp;
+    }
 
-/**
- * Returns number of performed CGP evaluations
- */
-long fitness_get_cgp_evals()
-{
-    return _cgp_evals;
+    *prepared = &buffers->scratch_prepared;
+    return buffers->scratch_kind;
 }
 
 
 /**
- * Filters image using given filter. Caller is responsible for freeing
- * the filtered image
+ * Predicts CGP circuit fitness on prepared pixels of predictor
  *
- * @param  chr
+ * @param  cgp_chr
+ * @param  predictor
+ * @param  kind How the pixels were prepared
+ * @param  prepared
  * @return fitness value
  */
-img_image_t fitness_filter_image(ga_chr_t chr)
+static ga_fitness_t _fitness_predict_cgp_prepared(ga_chr_t cgp_chr,
+    pred_genome_t predictor, pred_prepared_t kind,
+    const fitness_prepared_t *prepared)
 {
-    img_image_t filtered = img_create(_original_image->width, _original_image->height,
-        _original_image->comp);
+    // PSNR coefficcient is different here (less pixels are used)
+    double coef = fitness_psnr_coeficient(predictor->used_pixels);
+    double sum = 0;
+
+    if (kind == pred_masked) {
+        sum = _fitness_predict_cgp_masked(cgp_chr, prepared->mask);
 
-    for (int i = 0; i < _noisy_image_windows->size; i++) {
-        img_window_t *w = &_noisy_image_windows->windows[i];
+    } else if (can_use_simd() && kind == pred_tiled) {
+        sum = _fitness_predict_cgp_runs(cgp_chr, predictor);
 
-        cgp_value_t *inputs = w->pixels;
-        cgp_value_t output_pixel;
-        cgp_get_output(chr, inputs, &output_pixel);
+    } else if (can_use_simd() && kind == pred_gathered) {
+        img_planes_t planes;
+        _fitness_predictor_planes(predictor, prepared, &planes);
+        sum = _fitness_get_sqdiffsum_simd(cgp_chr, prepared->original_simd,
+            &planes, predictor->used_pixels);
 
-        img_set_pixel(filtered, w->pos_x, w->pos_y, output_pixel);
+    } else {
+        sum = _fitness_predict_cgp_scalar(cgp_chr, predictor);
     }
 
-    return filtered;
+    return coef / sum;
 }
 
 
 /**
- * Calculates difference between original and filtered pixel
+ * Predictes CGP circuit fitness
  *
  * @param  chr
- * @param  w
- * @return
+ * @return fitness value
  */
-int _fitness_get_diff(ga_chr_t chr, img_window_t *w)
+ga_fitness_t fitness_predict_cgp_by_genome(ga_chr_t cgp_chr, pred_genome_t predictor)
 {
-    cgp_value_t *inputs = w->pixels;
-    cgp_value_t output_pixel;
-    cgp_get_output(chr, inputs, &output_pixel);
-    return output_pixel - img_get_pixel(_original_image, w->pos_x, w->pos_y);
+    const fitness_prepared_t *prepared;
+    pred_prepared_t kind = _fitness_prepare_scratch(predictor, 0, &prepared);
+    return _fitness_predict_cgp_prepared(cgp_chr, predictor, kind, prepared);
 }
 
 
-double _fitness_get_sqdiffsum_scalar(ga_chr_t chr)
+/**
+ * Predictes CGP circuit fitness
+ *
+ * @param  chr
+ * @return fitness value
+ */
+ga_fitness_t fitness_predict_cgp(ga_chr_t cgp_chr, ga_chr_t pred_chr)
 {
-    double sum = 0;
-    for (int i = 0; i < _noisy_image_windows->size; i++) {
-        img_window_t *w = &_noisy_image_windows->windows[i];
-        double diff = _fitness_get_diff(chr, w);
-        sum += diff * diff;
-    }
-    #pragma omp atomic
-        _cgp_evals += _noisy_image_windows->size;
-    return sum;
+    pred_genome_t predictor = (pred_genome_t) pred_chr->genome;
+    return fitness_predict_cgp_by_genome(cgp_chr, predictor);
 }
 
 
-double _fitness_get_sqdiffsum_simd(ga_chr_t chr, img_pixel_t *original, img_pixel_t *noisy[WINDOW_SIZE], int data_length)
+/**
+ * Calculates squared differences of all pixels filtered by chromosome
+ * stored in CGP archive and stores them into `_archive_errors` column.
+ * SIMD engines are used if available, so the errors match
+ * `fitness_predict_cgp_by_genome` exactly.
+ *
+ * @param chr
+ * @param index Real index of the chromosome in archive
+ */
+void fitness_cgp_archived(ga_chr_t chr, int index)
 {
-    fitness_simd_func_t func = NULL;
-    int block_size = 0;
-    double sum = 0;
-
-    #ifdef AVX2
-        if(can_use_intel_core_4th_gen_features()) {
-            func = _fitness_get_sqdiffsum_avx;
-            block_size = FITNESS_AVX2_STEP;
-        }
-    #endif
-
-    #ifdef SSE2
-        if(can_use_sse2()) {
-            func = _fitness_get_sqdiffsum_sse;
-            block_size = FITNESS_SSE2_STEP;
-        }
-    #endif
+    // errors are known for all archived circuits or none of them
+    if (_archive_errors == NULL) {
+        if (_cgp_archive->stored > 0) return;
+
+        _archive_errors_stride = fitness_errors_stride(_cgp_archive->capacity);
+        _archive_errors = (fitness_error_t*) cpu_alloc_simd(
+            sizeof(fitness_error_t) * _archive_errors_stride * _data_length);
+        if (_archive_errors == NULL) return;
+    }
 
-    assert(func != NULL);
+    const fitness_simd_impl_t *impl = can_use_simd()? _fitness_select_simd() : NULL;
 
-    int offset = 0;
-    int unaligned_bytes = data_length % block_size;
-    data_length -= unaligned_bytes;
+    // chunks write distinct rows of the table
+    #pragma omp parallel for schedule(static)
+    for (int pos = 0; pos < _data_length; pos += FITNESS_BATCH_BLOCK) {
+        img_pixel_t filtered[FITNESS_BATCH_BLOCK];
+        int count = _data_length - pos;
+        if (count > FITNESS_BATCH_BLOCK) count = FITNESS_BATCH_BLOCK;
 
-    for (; offset < data_length; offset += block_size) {
-        sum += func(original, noisy, chr, offset, block_size);
-        #pragma omp atomic
-            _cgp_evals += block_size;
-    }
+        if (impl) {
+            impl->filter_func(&_noisy_planes, chr, pos, count, filtered);
+        } else {
+            for (int k = 0; k < count; k += CGP_VECTOR_BLOCK) {
+                int block = count - k;
+                if (block > CGP_VECTOR_BLOCK) block = CGP_VECTOR_BLOCK;
+                _fitness_filter_block(chr, pos + k, block, &filtered[k]);
+            }
+        }
 
-    // fix image data not fitting into register
-    // offset is set correctly here - it points to first pixel after
-    // aligned data (we subtracted no. unaligned bytes before)
-    if (unaligned_bytes > 0) {
-        sum += func(original, noisy, chr, offset, unaligned_bytes);
-        #pragma omp atomic
-            _cgp_evals += unaligned_bytes;
+        for (int k = 0; k < count; k++) {
+            int diff = filtered[k] - _original_image->data[pos + k];
+            _archive_errors[(size_t) (pos + k) * _archive_errors_stride + index] = diff * diff;
+        }
     }
+    _archive_errors_version++;
 
-    return sum;
+    #pragma omp atomic
+        _cgp_evals += _data_length;
 }
 
 
 /**
- * Evaluates CGP circuit fitness
+ * Calculates sum of squared differences on given pixels for each
+ * column of `_archive_errors`
  *
- * @param  chr
- * @return fitness value
+ * @param pixels
+ * @param count
+ * @param sums Sums indexed by real archive index, `_archive_errors_stride`
+ *             items
  */
-ga_fitness_t fitness_eval_cgp(ga_chr_t chr)
+void _fitness_sum_archive_errors(const pred_gene_t *pixels, int count,
+    double *sums)
 {
-    double sum = 0;
-
-    if(can_use_simd()) {
-        sum = _fitness_get_sqdiffsum_simd(chr, _original_image->data,
-            _noisy_image_simd, _noisy_image_windows->size);
-
-    } else {
-        sum = _fitness_get_sqdiffsum_scalar(chr);
+    if (cpu_simd_level() == cpu_simd_avx2) {
+        _fitness_sum_errors_avx(_archive_errors, _archive_errors_stride,
+            pixels, count, sums);
+        return;
     }
 
-    return _psnr_coeficient / sum;
+    for (int k = 0; k < _cgp_archive->capacity; k++) {
+        sums[k] = 0;
+    }
+    for (int i = 0; i < count; i++) {
+        const fitness_error_t *row = &_archive_errors[
+            (size_t) pixels[i] * _archive_errors_stride];
+        for (int k = 0; k < _cgp_archive->capacity; k++) {
+            sums[k] += row[k];
+        }
+    }
 }
 
 
 /**
- * Evaluates CGP circuit fitness
+ * Brings predictor's error sums up to date. If they are valid for
+ * current errors table, only pixels added to and removed from phenotype
+ * since (see `pred_offspring`) are summed, otherwise all of them are.
  *
- * @param  chr
- * @return fitness value
+ * Sums of integers are exact, so both ways give the same result.
+ *
+ * @param predictor
  */
-ga_fitness_t fitness_eval_or_predict_cgp(ga_chr_t chr)
+static void _fitness_update_error_sums(pred_genome_t predictor)
 {
-    if (_pred_archive && _pred_archive->stored > 0) {
-        return fitness_predict_cgp(chr, arc_get(_pred_archive, 0));
+    if (predictor->_error_sums_version == _archive_errors_version) {
+        double added[_archive_errors_stride];
+        double removed[_archive_errors_stride];
+
+        _fitness_sum_archive_errors(predictor->_added_pixels,
+            predictor->_added_count, added);
+        _fitness_sum_archive_errors(predictor->_removed_pixels,
+            predictor->_removed_count, removed);
+
+        for (int k = 0; k < _cgp_archive->capacity; k++) {
+            predictor->_error_sums[k] += added[k] - removed[k];
+        }
+
     } else {
-        return fitness_eval_cgp(chr);
+        _fitness_sum_archive_errors(predictor->pixels, predictor->used_pixels,
+            predictor->_error_sums);
+        predictor->_error_sums_version = _archive_errors_version;
     }
+
+    predictor->_added_count = 0;
+    predictor->_removed_count = 0;
 }
 
 
-double _fitness_predict_cgp_scalar(ga_chr_t cgp_chr, pred_genome_t predictor)
+/**
+ * Calculates predictor fitness from its error sums of archived circuits
+ * @param errors Sums indexed by real archive index
+ * @param used_pixels Number of predictor's pixels
+ */
+static double _fitness_predictor_from_sums(const double *errors, int used_pixels)
 {
+    double coef = fitness_psnr_coeficient(used_pixels);
     double sum = 0;
 
-    for (int i = 0; i < predictor->used_pixels; i++) {
-        // fetch window specified by predictor
-        pred_gene_t index = predictor->pixels[i];
-        assert(index < _noisy_image_windows->size);
-        img_window_t *w = &_noisy_image_windows->windows[index];
-
-        int diff = _fitness_get_diff(cgp_chr, w);
-        sum += diff * diff;
+    for (int i = 0; i < _cgp_archive->stored; i++) {
+        ga_chr_t cgp_chr = arc_get(_cgp_archive, i);
+        double predicted = coef / errors[arc_real_index(_cgp_archive, i)];
+        sum += fabs(cgp_chr->fitness - predicted);
     }
-
-    #pragma omp atomic
-        _cgp_evals += predictor->used_pixels;
-
-    return sum;
+    return sum / _cgp_archive->stored;
 }
 
 
 /**
- * Predictes CGP circuit fitness
+ * Evaluates predictor fitness
+ *
+ * Predicted fitness of archived circuits is calculated from their
+ * errors (see `fitness_cgp_archived`) if they are known, otherwise
+ * the circuits are evaluated on predictor's pixels. Error sums are
+ * kept in predictor genome if it has space for them.
  *
  * @param  chr
  * @return fitness value
  */
-ga_fitness_t fitness_predict_cgp_by_genome(ga_chr_t cgp_chr, pred_genome_t predictor)
+ga_fitness_t fitness_eval_predictor_genome(pred_genome_t predictor)
 {
-    // PSNR coefficcient is different here (less pixels are used)
-    double coef = fitness_psnr_coeficient(predictor->used_pixels);
     double sum = 0;
 
-    if (can_use_simd()) {
-        sum = _fitness_get_sqdiffsum_simd(cgp_chr, predictor->original_simd,
-            predictor->pixels_simd, predictor->used_pixels);
+    if (_archive_errors) {
+        double buffer[_archive_errors_stride];
+        double *errors = buffer;
+
+        if (predictor->_error_sums) {
+            _fitness_update_error_sums(predictor);
+            errors = predictor->_error_sums;
+
+        } else {
+            _fitness_sum_archive_errors(predictor->pixels,
+                predictor->used_pixels, buffer);
+        }
+
+        return _fitness_predictor_from_sums(errors, predictor->used_pixels);
 
     } else {
-        sum = _fitness_predict_cgp_scalar(cgp_chr, predictor);
+        // pixels are prepared once for all archived circuits
+        const fitness_prepared_t *prepared;
+        pred_prepared_t kind = _fitness_prepare_scratch(predictor, 0, &prepared);
+
+        for (int i = 0; i < _cgp_archive->stored; i++) {
+            ga_chr_t cgp_chr = arc_get(_cgp_archive, i);
+            double predicted = _fitness_predict_cgp_prepared(cgp_chr,
+                predictor, kind, prepared);
+            sum += fabs(cgp_chr->fitness - predicted);
+        }
     }
-
-    return coef / sum;
+    return sum / _cgp_archive->stored;
 }
 
 
 /**
- * Predictes CGP circuit fitness
+ * Evaluates predictor fitness
  *
  * @param  chr
  * @return fitness value
  */
-ga_fitness_t fitness_predict_cgp(ga_chr_t cgp_chr, ga_chr_t pred_chr)
+ga_fitness_t fitness_eval_predictor(ga_chr_t pred_chr)
 {
     pred_genome_t predictor = (pred_genome_t) pred_chr->genome;
-    return fitness_predict_cgp_by_genome(cgp_chr, predictor);
+    return fitness_eval_predictor_genome(predictor);
 }
 
 
 /**
- * Evaluates predictor fitness
+ * Maps loci of circular genotype to slots of a hash table of their gene
+ * values, so that the same values share a slot. Table has at least twice
+ * as many slots as there are loci, its counts are cleared.
  *
- * @param  chr
- * @return fitness value
+ * @param buffers
+ * @param genes
+ * @param length
+ * @return 0 on success, -1 if table cannot be allocated
  */
-ga_fitness_t fitness_eval_predictor_genome(pred_genome_t predictor)
+static int _fitness_map_circular_slots(_fitness_buffers_t *buffers,
+    const pred_gene_t *genes, int length)
 {
-    double sum = 0;
-    for (int i = 0; i < _cgp_archive->stored; i++) {
-        ga_chr_t cgp_chr = arc_get(_cgp_archive, i);
-        double predicted = fitness_predict_cgp_by_genome(cgp_chr, predictor);
-        sum += fabs(cgp_chr->fitness - predicted);
+    if (buffers->circular_slots == NULL) {
+        int bits = 1;
+        while ((1 << bits) < 2 * length) bits++;
+
+        buffers->circular_bits = bits;
+        buffers->circular_values = (pred_gene_t*) malloc(sizeof(pred_gene_t) << bits);
+        buffers->circular_counts = (unsigned int*) malloc(sizeof(unsigned int) << bits);
+        buffers->circular_slots = (unsigned int*) malloc(sizeof(unsigned int) * length);
+        if (buffers->circular_values == NULL || buffers->circular_counts == NULL
+            || buffers->circular_slots == NULL) {
+            free(buffers->circular_values);
+            free(buffers->circular_counts);
+            free(buffers->circular_slots);
+            buffers->circular_values = NULL;
+            buffers->circular_counts = NULL;
+            buffers->circular_slots = NULL;
+            return -1;
+        }
     }
-    return sum / _cgp_archive->stored;
+
+    int bits = buffers->circular_bits;
+    unsigned int mask = (1u << bits) - 1;
+    pred_gene_t *values = buffers->circular_values;
+    unsigned int *counts = buffers->circular_counts;
+
+    // counts mark occupied slots while the table is built
+    memset(counts, 0, sizeof(unsigned int) << bits);
+    for (int i = 0; i < length; i++) {
+        pred_gene_t value = genes[i];
+        unsigned int slot = (uint32_t) (value * 2654435769u) >> (32 - bits);
+        while (counts[slot] && values[slot] != value) {
+            slot = (slot + 1) & mask;
+        }
+        values[slot] = value;
+        counts[slot] = 1;
+        buffers->circular_slots[i] = slot;
+    }
+    memset(counts, 0, sizeof(unsigned int) << bits);
+    return 0;
 }
 
 
 /**
- * Evaluates predictor fitness
+ * Scores all phenotype starting loci of circular predictor and returns
+ * the best one. Window of used genes slides over the genotype one locus
+ * at a time, so that just one gene leaves and one enters it. Occurrences
+ * of values in the window are counted and error sums change only when
+ * a value leaves or enters the phenotype. Values are counted in a hash
+ * table sized by the genotype, see `_fitness_map_circular_slots`.
  *
- * @param  chr
- * @return fitness value
+ * Sums of integer errors are exact, scores are the same as if each
+ * phenotype was evaluated from scratch.
+ *
+ * @param predictor Predictor with error sums valid for current offset
+ * @param fitness Fitness of current offset, replaced by the best one
+ * @param best_sums Error sums of the best offset
+ * @return best offset or -1 if counts cannot be allocated
  */
-ga_fitness_t fitness_eval_predictor(ga_chr_t pred_chr)
+static int _fitness_slide_circular_offset(pred_genome_t predictor,
+    ga_fitness_t *fitness, double *best_sums)
 {
-    pred_genome_t predictor = (pred_genome_t) pred_chr->genome;
-    return fitness_eval_predictor_genome(predictor);
+    int length = pred_get_max_length();
+    int used = pred_get_length();
+    int offset = predictor->_circular_offset;
+    int best_offset = offset;
+    const pred_gene_t *genes = predictor->_genes;
+
+    _fitness_buffers_t *buffers = _fitness_thread_buffers();
+    if (buffers == NULL) return -1;
+    if (_fitness_map_circular_slots(buffers, genes, length) != 0) return -1;
+    unsigned int *counts = buffers->circular_counts;
+    const unsigned int *slots = buffers->circular_slots;
+
+    // archived circuits scored against, sums are kept as integers
+    int stored = _cgp_archive->stored;
+    int columns[stored];
+    double real_fitness[stored];
+    int capacity = _cgp_archive->capacity;
+    int64_t sums[_archive_errors_stride];
+    int used_pixels = predictor->used_pixels;
+
+    for (int i = 0; i < stored; i++) {
+        columns[i] = arc_real_index(_cgp_archive, i);
+        real_fitness[i] = arc_get(_cgp_archive, i)->fitness;
+    }
+    for (int k = 0; k < _archive_errors_stride; k++) {
+        sums[k] = (k < capacity)? predictor->_error_sums[k] : 0;
+    }
+    memcpy(best_sums, predictor->_error_sums, sizeof(double) * _archive_errors_stride);
+
+    for (int i = 0; i < used; i++) {
+        counts[slots[(offset + i) % length]]++;
+    }
+
+    int leaving_locus = offset;
+    int entering_locus = (offset + used) % length;
+    int leaving_ahead = (offset + FITNESS_CIRCULAR_PREFETCH) % length;
+    int entering_ahead = (offset + used + FITNESS_CIRCULAR_PREFETCH) % length;
+
+    for (int step = 1; step < length; step++) {
+        pred_gene_t leaving = genes[leaving_locus];
+        pred_gene_t entering = genes[entering_locus];
+        unsigned int leaving_slot = slots[leaving_locus];
+        unsigned int entering_slot = slots[entering_locus];
+        if (++leaving_locus == length) leaving_locus = 0;
+        if (++entering_locus == length) entering_locus = 0;
+
+        // values are random, so that their rows have to be fetched ahead
+        pred_gene_t next_leaving = genes[leaving_ahead];
+        pred_gene_t next_entering = genes[entering_ahead];
+        if (++leaving_ahead == length) leaving_ahead = 0;
+        if (++entering_ahead == length) entering_ahead = 0;
+        __builtin_prefetch(&_archive_errors[(size_t) next_leaving * _archive_errors_stride]);
+        __builtin_prefetch(&_archive_errors[(size_t) next_entering * _archive_errors_stride]);
+
+        bool changed = false;
+        if (--counts[leaving_slot] == 0) {
+            const fitness_error_t *row = &_archive_errors[(size_t) leaving * _archive_errors_stride];
+            for (int k = 0; k < capacity; k++) {
+                sums[k] -= row[k];
+            }
+            used_pixels--;
+            changed = true;
+        }
+        if (counts[entering_slot]++ == 0) {
+            const fitness_error_t *row = &_archive_errors[(size_t) entering * _archive_errors_stride];
+            for (int k = 0; k < capacity; k++) {
+                sums[k] += row[k];
+            }
+            used_pixels++;
+            changed = true;
+        }
+
+        // phenotype is the same set of pixels as in previous step
+        if (!changed) continue;
+
+        // same as `_fitness_predictor_from_sums`
+        double coef = fitness_psnr_coeficient(used_pixels);
+        double sum = 0;
+        for (int i = 0; i < stored; i++) {
+            sum += fabs(real_fitness[i] - coef / sums[columns[i]]);
+        }
+        ga_fitness_t fit = sum / stored;
+
+        if (ga_is_better(PRED_PROBLEM_TYPE, fit, *fitness)) {
+            *fitness = fit;
+            best_offset = leaving_locus;
+            for (int k = 0; k < capacity; k++) {
+                best_sums[k] = sums[k];
+            }
+        }
+    }
+
+    return best_offset;
 }
 
 
 /**
- * Evaluates circular predictor fitness, using PRED_CIRCULAR_TRIES to
- * determine best offset
+ * Evaluates circular predictor fitness and sets its phenotype starting
+ * locus to the best one.
+ *
+ * If errors of archived circuits are known, all loci are scored (see
+ * `_fitness_slide_circular_offset`), otherwise PRED_CIRCULAR_TRIES
+ * random ones are.
  *
  * @param  chr
  * @return fitness value
@@ -348,6 +1588,31 @@ ga_fitness_t fitness_eval_circular_predictor(ga_chr_t pred_chr)
     int best_offset = predictor->_circular_offset;
     ga_fitness_t best_fitness = fitness_eval_predictor_genome(predictor);
 
+    // all loci give the same phenotype if whole genotype is used
+    if (pred_get_length() >= pred_get_max_length()) {
+        return best_fitness;
+    }
+
+    if (_archive_errors && predictor->_error_sums) {
+        double best_sums[_archive_errors_stride];
+        best_offset = _fitness_slide_circular_offset(predictor, &best_fitness,
+            best_sums);
+
+        if (best_offset >= 0) {
+            // phenotype is rebuilt just once, its sums are already known
+            if (predictor->_circular_offset != best_offset) {
+                predictor->_circular_offset = best_offset;
+                pred_calculate_phenotype(predictor);
+                memcpy(predictor->_error_sums, best_sums,
+                    sizeof(double) * _archive_errors_stride);
+                predictor->_error_sums_version = _archive_errors_version;
+            }
+            return best_fitness;
+        }
+
+        best_offset = predictor->_circular_offset;
+    }
+
     for (int i = 0; i < PRED_CIRCULAR_TRIES; i++) {
         // generate new phenotype
         int offset = rand_urange(0, pred_get_max_length() - 1);
@@ -373,6 +1638,192 @@ ga_fitness_t fitness_eval_circular_predictor(ga_chr_t pred_chr)
 }
 
 
+/**
+ * Brings error sums of predictors which are not valid for current errors
+ * table up to date. Pixels of all such predictors are split into chunks
+ * of FITNESS_PRED_CHUNK, which are summed in parallel, and partial sums
+ * of each predictor are added in chunk order.
+ *
+ * @param predictors
+ * @param count
+ * @return 0 on success, -1 if partial sums cannot be allocated
+ */
+static int _fitness_resum_error_sums(pred_genome_t *predictors, int count)
+{
+    bool stale[count];
+    int first_task[count + 1];
+    int tasks = 0;
+
+    for (int i = 0; i < count; i++) {
+        stale[i] = predictors[i]->_error_sums != NULL
+            && predictors[i]->_error_sums_version != _archive_errors_version;
+        first_task[i] = tasks;
+        if (stale[i]) {
+            tasks += (predictors[i]->used_pixels + FITNESS_PRED_CHUNK - 1)
+                / FITNESS_PRED_CHUNK;
+        }
+    }
+    first_task[count] = tasks;
+    if (tasks == 0) return 0;
+
+    double *partial = (double*) malloc(
+        sizeof(double) * _archive_errors_stride * tasks);
+    if (partial == NULL) return -1;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int t = 0; t < tasks; t++) {
+        int i = 0;
+        while (first_task[i + 1] <= t) i++;
+
+        int start = (t - first_task[i]) * FITNESS_PRED_CHUNK;
+        int length = predictors[i]->used_pixels - start;
+        if (length > FITNESS_PRED_CHUNK) length = FITNESS_PRED_CHUNK;
+
+        _fitness_sum_archive_errors(&predictors[i]->pixels[start], length,
+            &partial[(size_t) t * _archive_errors_stride]);
+    }
+
+    // sums of integers are exact, chunk order keeps them deterministic
+    // even if they were not
+    for (int i = 0; i < count; i++) {
+        if (!stale[i]) continue;
+        pred_genome_t predictor = predictors[i];
+
+        for (int k = 0; k < _cgp_archive->capacity; k++) {
+            predictor->_error_sums[k] = 0;
+        }
+        for (int t = first_task[i]; t < first_task[i + 1]; t++) {
+            for (int k = 0; k < _cgp_archive->capacity; k++) {
+                predictor->_error_sums[k] += partial[(size_t) t * _archive_errors_stride + k];
+            }
+        }
+
+        predictor->_error_sums_version = _archive_errors_version;
+        predictor->_added_count = 0;
+        predictor->_removed_count = 0;
+    }
+
+    free(partial);
+    return 0;
+}
+
+
+/**
+ * Evaluates predictors without errors table, each archived circuit is
+ * evaluated on each predictor in separate task. Differences are summed
+ * in archive order, same as in `fitness_eval_predictor_genome`.
+ *
+ * @param chrs
+ * @param predictors
+ * @param count
+ */
+static void _fitness_eval_predictor_pairs(ga_chr_t *chrs,
+    pred_genome_t *predictors, int count)
+{
+    int stored = _cgp_archive->stored;
+    double *predicted = (double*) malloc(sizeof(double) * count * stored);
+
+    if (predicted == NULL) {
+        #pragma omp parallel for
+        for (int i = 0; i < count; i++) {
+            chrs[i]->fitness = fitness_eval_predictor(chrs[i]);
+        }
+        return;
+    }
+
+    // threads get consecutive pairs, so that they mostly prepare each
+    // predictor only once
+    unsigned long stamp;
+    #pragma omp atomic capture
+        stamp = ++_prepare_stamp;
+
+    #pragma omp parallel for collapse(2) schedule(static)
+    for (int i = 0; i < count; i++) {
+        for (int a = 0; a < stored; a++) {
+            const fitness_prepared_t *prepared;
+            pred_prepared_t kind = _fitness_prepare_scratch(predictors[i],
+                stamp, &prepared);
+            predicted[i * stored + a] = _fitness_predict_cgp_prepared(
+                arc_get(_cgp_archive, a), predictors[i], kind, prepared);
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        double sum = 0;
+        for (int a = 0; a < stored; a++) {
+            sum += fabs(arc_get(_cgp_archive, a)->fitness - predicted[i * stored + a]);
+        }
+        chrs[i]->fitness = sum / stored;
+    }
+
+    free(predicted);
+}
+
+
+/**
+ * Evaluates predictors using `fitness` function, but splits the work
+ * which is common for all of them (summing errors from scratch or
+ * evaluating archived circuits) into tasks smaller than one predictor
+ *
+ * @param chrs
+ * @param count
+ * @param fitness `fitness_eval_predictor` or
+ *                `fitness_eval_circular_predictor`
+ */
+static void _fitness_eval_predictor_batch(ga_chr_t *chrs, int count,
+    ga_fitness_func_t fitness)
+{
+    pred_genome_t predictors[count];
+    for (int i = 0; i < count; i++) {
+        predictors[i] = (pred_genome_t) chrs[i]->genome;
+    }
+
+    if (_archive_errors) {
+        // if it fails, sums are calculated by the fitness function
+        _fitness_resum_error_sums(predictors, count);
+
+    } else if (fitness == fitness_eval_predictor && _cgp_archive->stored > 0) {
+        _fitness_eval_predictor_pairs(chrs, predictors, count);
+        return;
+    }
+
+    // what is left is cheap or specific to each predictor
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < count; i++) {
+        chrs[i]->fitness = fitness(chrs[i]);
+    }
+}
+
+
+/**
+ * Evaluates fitness of multiple predictors at once
+ *
+ * @param chrs
+ * @param count
+ * @param bound Unused
+ */
+void fitness_eval_predictor_batch(ga_chr_t *chrs, int count,
+    ga_fitness_t *bound)
+{
+    _fitness_eval_predictor_batch(chrs, count, fitness_eval_predictor);
+}
+
+
+/**
+ * Evaluates fitness of multiple circular predictors at once
+ *
+ * @param chrs
+ * @param count
+ * @param bound Unused
+ */
+void fitness_eval_circular_predictor_batch(ga_chr_t *chrs, int count,
+    ga_fitness_t *bound)
+{
+    _fitness_eval_predictor_batch(chrs, count,
+        fitness_eval_circular_predictor);
+}
+
+
         /*
         if (_genome_repeated_subtype == circular) {
             int best_offset = 0;
@@ -397,18 +1848,59 @@ ga_fitness_t fitness_eval_circular_predictor(ga_chr_t pred_chr)
 
 
 /**
- * Fills simd-friendly predictor arrays with correct image data
+ * Prepares predictor stored in predictors archive for predicting CGP
+ * fitness (see `arc_func_vect_t.stored`)
+ *
+ * @param chr
+ * @param index Real index of the chromosome in archive
+ */
+void fitness_predictor_archived(ga_chr_t chr, int index)
+{
+    fitness_prepare_predictor((pred_genome_t) chr->genome);
+}
+
+
+/**
+ * Prepares archived predictor's pixels for predicting CGP fitness.
+ * Either they are gathered into simd-friendly arrays, or marked in
+ * bitmap over whole image if predictor covers most of it and has no
+ * repeated pixels (see FITNESS_MASK_MIN_DENSITY). Runs of tiled
+ * predictors are read straight from the image, there is nothing to
+ * prepare.
+ *
+ * Prepared data are kept just for one predictor (predictors archive has
+ * capacity of one), pixels of other predictors are prepared into
+ * per-thread buffers on each evaluation.
+ *
+ * Predictor is left unprepared if buffers cannot be allocated, it is
+ * prepared on each evaluation then.
+ *
+ * @param predictor
+ */
+void fitness_prepare_predictor(pred_genome_t predictor)
+{
+    predictor->prepared = _fitness_prepare(predictor, &_archived_prepared);
+}
+
+
+/**
+ * Fills simd-friendly arrays with image data of predictor's pixels
  * @param  genome
+ * @param  prepared Arrays of at least `used_pixels` items
  */
-void fitness_prepare_predictor_for_simd(pred_genome_t predictor)
+void fitness_prepare_predictor_for_simd(pred_genome_t predictor,
+    fitness_prepared_t *prepared)
 {
     for (int i = 0; i < predictor->used_pixels; i++) {
         pred_gene_t index = predictor->pixels[i];
-        assert(index < _noisy_image_windows->size);
+        assert(index < _data_length);
+
+        img_pixel_t window[WINDOW_SIZE];
+        img_planes_get_window(&_noisy_planes, index, window);
 
-        predictor->original_simd[i] = _original_image->data[index];
+        prepared->original_simd[i] = _original_image->data[index];
         for (int w = 0; w < WINDOW_SIZE; w++) {
-            predictor->pixels_simd[w][i] = _noisy_image_simd[w][index];
+            prepared->pixels_simd[w][i] = window[w];
         }
     }
 }
@@ -21,24 +21,121 @@
 #pragma once
 
 
+#include <stdint.h>
+#include <string.h>
+
 #include "image.h"
 #include "cgp/cgp.h"
+#include "cgp/cgp_jit.h"
 #include "archive.h"
 #include "predictors.h"
 
 
-static const int FITNESS_SSE2_STEP = 16;
-static const int FITNESS_AVX2_STEP = 32;
+#define FITNESS_SSE2_STEP 16
+#define FITNESS_AVX2_STEP 32
+
+/**
+ * Number of AVX2 vectors evaluated in one pass through chromosome by
+ * the interpreter (see `_fitness_get_sqdiffsum_avx_multi`)
+ */
+#define FITNESS_AVX2_BLOCKS 4
 
 static const int PRED_CIRCULAR_TRIES = 3;
 
 
+/**
+ * Predictors covering at least this fraction of image are evaluated
+ * on all pixels with errors masked by their bitmap, instead of on
+ * gathered pixels (see `fitness_prepare_predictor`)
+ */
+#define FITNESS_MASK_MIN_DENSITY 0.9
+
+
+/**
+ * Predictor's phenotype prepared for predicting CGP fitness (see
+ * `fitness_prepare_predictor`). Predictors do not own these buffers,
+ * they are kept for archived predictor and per thread for the others.
+ */
+typedef struct {
+    /* simd-friendly gathered image data, `capacity` pixels long */
+    img_pixel_t *original_simd;
+    img_pixel_t *pixels_simd[WINDOW_SIZE];
+    int capacity;
+
+    /* bitmap of phenotype pixels over whole image */
+    pred_bitset_word_t *mask;
+} fitness_prepared_t;
+
+
+/**
+ * Returns 32 bits of predictor's mask starting at pixel `pos` (lowest
+ * bit belongs to `pos`). Mask has to be padded by one word.
+ */
+static inline uint32_t fitness_mask_bits(const pred_bitset_word_t *mask, int pos)
+{
+    uint64_t word;
+    memcpy(&word, (const unsigned char*) mask + pos / 8, sizeof(word));
+    return (uint32_t) (word >> (pos % 8));
+}
+
+
+/**
+ * Squared difference of single filtered and original pixel
+ */
+typedef uint16_t fitness_error_t;
+
+
+/**
+ * Errors of archived circuits are stored by pixels, rows are padded
+ * to multiple of this number of errors (one AVX2 vector)
+ */
+#define FITNESS_ERRORS_ROW_ALIGN 16
+
+
+/**
+ * Number of errors in one row of the table, i.e. archive capacity
+ * rounded up to FITNESS_ERRORS_ROW_ALIGN
+ */
+static inline int fitness_errors_stride(int archive_capacity)
+{
+    int align = FITNESS_ERRORS_ROW_ALIGN;
+    return (archive_capacity + align - 1) / align * align;
+}
+
+
+/**
+ * Number of pixels evaluated by all chromosomes of a batch at once.
+ * Input planes of the block (WINDOW_SIZE + 1 bytes per pixel) should
+ * fit into L1 cache.
+ */
+#define FITNESS_BATCH_BLOCK 2048
+
+
+/**
+ * Maximum number of chromosomes evaluated in single batch pass
+ * (compiled code of all of them and their parent must fit into JIT cache)
+ */
+#define FITNESS_BATCH_MAX (CGP_JIT_CACHE_SIZE - 1)
+
+
+/**
+ * Number of predictor's pixels whose errors are summed in one task, so
+ * that all threads get work even if there are only few predictors
+ */
+#define FITNESS_PRED_CHUNK 4096
+
+
+/**
+ * Number of SIMD blocks whose squared differences can be accumulated
+ * in 32-bit vector lanes (at most 4 * 255^2 per block) without overflow
+ */
+#define FITNESS_SQDIFF_FLUSH 4096
+
+
 /**
  * For testing purposes only
  */
-void fitness_test_init(img_image_t original_image,
-    img_window_array_t noisy_image_windows,
-    img_pixel_t *noisy_image_simd[WINDOW_SIZE]);
+void fitness_test_init(img_image_t original_image, img_image_t noisy_image);
 
 
 /**
@@ -96,6 +193,34 @@ ga_fitness_t fitness_eval_cgp(ga_chr_t chr);
 ga_fitness_t fitness_eval_or_predict_cgp(ga_chr_t chr);
 
 
+/**
+ * Evaluates fitness of multiple CGP circuits at once, results are
+ * stored in chromosomes `fitness` attribute.
+ *
+ * Image is streamed from memory only once for the whole batch.
+ *
+ * If `bound` (fitness of current parent) is given, evaluation of
+ * chromosomes which are certainly worse is stopped early and they
+ * are marked as rejected (see ga_batch_fitness_func_t).
+ *
+ * @param  chrs
+ * @param  count
+ * @param  bound Fitness of current parent or NULL
+ */
+void fitness_eval_cgp_batch(ga_chr_t *chrs, int count, ga_fitness_t *bound);
+
+
+/**
+ * Batch version of `fitness_eval_or_predict_cgp`
+ *
+ * @param  chrs
+ * @param  count
+ * @param  bound Fitness of current parent or NULL
+ */
+void fitness_eval_or_predict_cgp_batch(ga_chr_t *chrs, int count,
+    ga_fitness_t *bound);
+
+
 /**
  * Predictes CGP circuit fitness
  *
@@ -115,8 +240,9 @@ ga_fitness_t fitness_eval_predictor(ga_chr_t chr);
 
 
 /**
- * Evaluates circular predictor fitness, using PRED_CIRCULAR_TRIES to
- * determine best offset
+ * Evaluates circular predictor fitness and sets its offset to the best
+ * one. All offsets are scored if errors of archived circuits are known,
+ * PRED_CIRCULAR_TRIES random ones otherwise.
  *
  * @param  chr
  * @return fitness value
@@ -133,6 +259,66 @@ ga_fitness_t fitness_eval_circular_predictor(ga_chr_t pred_chr);
 ga_fitness_t fitness_eval_predictor_genome(pred_genome_t predictor);
 
 
+/**
+ * Evaluates fitness of multiple predictors at once, results are stored
+ * in chromosomes `fitness` attribute. Work is split into tasks smaller
+ * than one predictor (chunks of its pixels or archived circuits), so
+ * that all threads are used, results are the same as from
+ * `fitness_eval_predictor`.
+ *
+ * @param  chrs
+ * @param  count
+ * @param  bound Unused, predictors are always evaluated exactly
+ */
+void fitness_eval_predictor_batch(ga_chr_t *chrs, int count,
+    ga_fitness_t *bound);
+
+
+/**
+ * Batch version of `fitness_eval_circular_predictor`
+ *
+ * @param  chrs
+ * @param  count
+ * @param  bound Unused, predictors are always evaluated exactly
+ */
+void fitness_eval_circular_predictor_batch(ga_chr_t *chrs, int count,
+    ga_fitness_t *bound);
+
+
+/**
+ * Calculates squared differences of all pixels filtered by chromosome
+ * stored in CGP archive (see `arc_func_vect_t.stored`), so predictor
+ * fitness is only a sum of errors on predictor's pixels and archived
+ * circuits are not evaluated over and over again.
+ *
+ * @param chr
+ * @param index Real index of the chromosome in archive
+ */
+void fitness_cgp_archived(ga_chr_t chr, int index);
+
+
+/**
+ * Prepares predictor stored in predictors archive for predicting CGP
+ * fitness (see `arc_func_vect_t.stored`)
+ *
+ * @param chr
+ * @param index Real index of the chromosome in archive
+ */
+void fitness_predictor_archived(ga_chr_t chr, int index);
+
+
+/**
+ * Prepares archived predictor's pixels for predicting CGP fitness. Either
+ * they are gathered into simd-friendly arrays, or marked in bitmap over
+ * whole image if predictor covers most of it (see
+ * FITNESS_MASK_MIN_DENSITY). Prepared data are kept for one predictor
+ * only, other predictors are prepared on each evaluation.
+ *
+ * @param predictor
+ */
+void fitness_prepare_predictor(pred_genome_t predictor);
+
+
 /**
  * Calculates fitness using the PSNR (peak signal-to-noise ratio) function.
  * The higher the value, the better the filter.
@@ -157,52 +343,293 @@ static inline double fitness_to_psnr(ga_fitness_t f) {
  */
 typedef double (*fitness_simd_func_t)(
     img_pixel_t *original,
-    img_pixel_t *noisy[WINDOW_SIZE],
+    const img_planes_t *noisy,
+    ga_chr_t chr,
+    int offset,
+    int length);
+
+
+/**
+ * SIMD fitness evaluator prototype, evaluating `blocks` vectors in one
+ * pass through the chromosome
+ */
+typedef double (*fitness_multi_func_t)(
+    img_pixel_t *original,
+    const img_planes_t *noisy,
     ga_chr_t chr,
+    int blocks,
     int offset,
-    int block_size);
+    int length);
 
 
 /**
- * Calculates difference between original and filtered pixel using SSE2
- * instructions.
+ * SIMD filter prototype, stores outputs of chromosome
+ */
+typedef void (*fitness_filter_func_t)(
+    const img_planes_t *noisy,
+    ga_chr_t chr,
+    int offset,
+    int length,
+    img_pixel_t *filtered);
+
+
+/**
+ * SIMD fitness evaluator prototype for compiled chromosomes
+ */
+typedef double (*fitness_jit_func_t)(
+    img_pixel_t *original,
+    const img_planes_t *noisy,
+    ga_chr_t chr,
+    cgp_jit_func_t code,
+    int offset,
+    int length);
+
+
+/**
+ * SIMD fitness evaluator prototype for pixels selected by mask, chromosome
+ * is compiled (or `code` is NULL and it is interpreted)
+ */
+typedef double (*fitness_masked_func_t)(
+    img_pixel_t *original,
+    const img_planes_t *noisy,
+    ga_chr_t chr,
+    cgp_jit_func_t code,
+    const pred_bitset_word_t *mask,
+    int offset,
+    int length);
+
+
+/**
+ * SIMD fitness evaluator prototype for runs of pixels (see `pred_run_t`),
+ * chromosome is compiled (or `code` is NULL and it is interpreted)
+ */
+typedef double (*fitness_runs_func_t)(
+    img_pixel_t *original,
+    const img_planes_t *noisy,
+    ga_chr_t chr,
+    cgp_jit_func_t code,
+    const pred_run_t *runs,
+    int count);
+
+
+/**
+ * SIMD fitness evaluator prototype for offspring of common parent,
+ * evaluated incrementally (see cgp_compile_delta)
+ */
+typedef void (*fitness_delta_func_t)(
+    img_pixel_t *original,
+    const img_planes_t *noisy,
+    ga_chr_t *chrs,
+    int count,
+    cgp_jit_func_t parent_code,
+    cgp_jit_func_t *delta_codes,
+    int offset,
+    int length,
+    double *sums);
+
+
+/**
+ * Calculates sum of squared differences between original and filtered
+ * pixels using SSE2 instructions.
  *
- * One call equals 16 CGP evaluations.
+ * Data are processed in FITNESS_SSE2_STEP blocks, differences are
+ * accumulated in vector registers and summed only once at the end.
+ * Rows of window planes are walked separately, last block of each row
+ * is masked.
  *
  * @param  original_image
- * @param  noisy_image_simd
+ * @param  noisy Window planes
  * @param  chr
  * @param  offset Where to start in arrays
- * @param  block_size How many pixels to process
+ * @param  length How many pixels to process
  * @return
  */
 double _fitness_get_sqdiffsum_sse(
     img_pixel_t *original,
-    img_pixel_t *noisy[WINDOW_SIZE],
+    const img_planes_t *noisy,
     ga_chr_t chr,
     int offset,
-    int block_size);
+    int length);
 
 
 /**
- * Calculates difference between original and filtered pixel using AVX2
- * instructions.
- *
- * One call equals 32 CGP evaluations.
- *
- * @param  chr
- * @param  w
- * @return
+ * Same as `_fitness_get_sqdiffsum_sse`, but uses AVX2 instructions
  */
 double _fitness_get_sqdiffsum_avx(
-    img_image_t _original_image,
-    img_pixel_t *_noisy_image_simd[WINDOW_SIZE],
+    img_pixel_t *original,
+    const img_planes_t *noisy,
+    ga_chr_t chr,
+    int offset,
+    int length);
+
+
+/**
+ * Same as `_fitness_get_sqdiffsum_avx`, but evaluates `blocks` vectors
+ * (at most CGP_AVX_MAX_BLOCKS) in one pass through the chromosome,
+ * so their independent operations can be executed in parallel
+ */
+double _fitness_get_sqdiffsum_avx_multi(
+    img_pixel_t *original,
+    const img_planes_t *noisy,
+    ga_chr_t chr,
+    int blocks,
+    int offset,
+    int length);
+
+
+/**
+ * Same as `_fitness_get_sqdiffsum_sse`, but uses compiled chromosome
+ * (see cgp_jit.h)
+ */
+double _fitness_get_sqdiffsum_sse_jit(
+    img_pixel_t *original,
+    const img_planes_t *noisy,
+    ga_chr_t chr,
+    cgp_jit_func_t code,
+    int offset,
+    int length);
+
+
+/**
+ * Same as `_fitness_get_sqdiffsum_avx`, but uses compiled chromosome
+ * (see cgp_jit.h)
+ */
+double _fitness_get_sqdiffsum_avx_jit(
+    img_pixel_t *original,
+    const img_planes_t *noisy,
+    ga_chr_t chr,
+    cgp_jit_func_t code,
+    int offset,
+    int length);
+
+
+/**
+ * Evaluates offspring of common parent incrementally using SSE2
+ * instructions - parent's phenotype is evaluated once and only nodes
+ * affected by mutation are recalculated for each chromosome.
+ *
+ * Squared differences are added to `sums`.
+ */
+void _fitness_get_sqdiffsum_sse_delta(
+    img_pixel_t *original,
+    const img_planes_t *noisy,
+    ga_chr_t *chrs,
+    int count,
+    cgp_jit_func_t parent_code,
+    cgp_jit_func_t *delta_codes,
+    int offset,
+    int length,
+    double *sums);
+
+
+/**
+ * Same as `_fitness_get_sqdiffsum_sse_delta`, but uses AVX2 instructions
+ */
+void _fitness_get_sqdiffsum_avx_delta(
+    img_pixel_t *original,
+    const img_planes_t *noisy,
+    ga_chr_t *chrs,
+    int count,
+    cgp_jit_func_t parent_code,
+    cgp_jit_func_t *delta_codes,
+    int offset,
+    int length,
+    double *sums);
+
+
+/**
+ * Calculates sum of squared differences between original and filtered
+ * pixels marked in `mask` using SSE2 instructions. Whole window planes
+ * are evaluated, differences of unmarked pixels are zeroed.
+ */
+double _fitness_get_sqdiffsum_sse_masked(
+    img_pixel_t *original,
+    const img_planes_t *noisy,
     ga_chr_t chr,
-    int offset);
+    cgp_jit_func_t code,
+    const pred_bitset_word_t *mask,
+    int offset,
+    int length);
+
+
+/**
+ * Same as `_fitness_get_sqdiffsum_sse_masked`, but uses AVX2 instructions
+ */
+double _fitness_get_sqdiffsum_avx_masked(
+    img_pixel_t *original,
+    const img_planes_t *noisy,
+    ga_chr_t chr,
+    cgp_jit_func_t code,
+    const pred_bitset_word_t *mask,
+    int offset,
+    int length);
+
+
+/**
+ * Calculates sum of squared differences between original and filtered
+ * pixels of given runs using SSE2 instructions. Runs are read straight
+ * from window planes, differences are accumulated across all of them.
+ */
+double _fitness_get_sqdiffsum_sse_runs(
+    img_pixel_t *original,
+    const img_planes_t *noisy,
+    ga_chr_t chr,
+    cgp_jit_func_t code,
+    const pred_run_t *runs,
+    int count);
+
+
+/**
+ * Same as `_fitness_get_sqdiffsum_sse_runs`, but uses AVX2 instructions
+ */
+double _fitness_get_sqdiffsum_avx_runs(
+    img_pixel_t *original,
+    const img_planes_t *noisy,
+    ga_chr_t chr,
+    cgp_jit_func_t code,
+    const pred_run_t *runs,
+    int count);
+
+
+/**
+ * Filters pixels of window planes using SSE2 instructions (without
+ * compiling the chromosome)
+ */
+void _fitness_filter_sse(
+    const img_planes_t *noisy,
+    ga_chr_t chr,
+    int offset,
+    int length,
+    img_pixel_t *filtered);
+
+
+/**
+ * Same as `_fitness_filter_sse`, but uses AVX2 instructions
+ */
+void _fitness_filter_avx(
+    const img_planes_t *noisy,
+    ga_chr_t chr,
+    int offset,
+    int length,
+    img_pixel_t *filtered);
+
+
+/**
+ * Sums rows of error table on given indices using AVX2 instructions,
+ * see `_fitness_sum_archive_errors`
+ */
+void _fitness_sum_errors_avx(
+    const fitness_error_t *errors,
+    int stride,
+    const pred_gene_t *indices,
+    int count,
+    double *sums);
 
 
 /**
- * Fills simd-friendly predictor arrays with correct image data
+ * Fills simd-friendly arrays with image data of predictor's pixels
  * @param  genome
+ * @param  prepared Arrays of at least `used_pixels` items
  */
-void fitness_prepare_predictor_for_simd(pred_genome_t predictor);
+void fitness_prepare_predictor_for_simd(pred_genome_t predictor,
+    fitness_prepared_t *prepared);
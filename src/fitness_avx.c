@@ -18,41 +18,623 @@
  */
 
 
+#include <string.h>
+#include <assert.h>
+
+#include "cpu.h"
 #include "fitness.h"
 #include "cgp/cgp_avx.h"
 
 
+#ifdef AVX2
+
+/**
+ * Loading this array from index FITNESS_AVX2_STEP - n gives mask
+ * selecting first n bytes of a vector
+ */
+static const unsigned char _tail_mask[2 * 32] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+
 /**
- * Calculates difference between original and filtered pixel using AVX2
- * instructions.
+ * Loads FITNESS_AVX2_STEP pixels of original image. Last block of data
+ * may be shorter, pixels out of data are zeroed then and `mask` selects
+ * the valid ones.
  *
- * One call equals 32 CGP evaluations.
+ * @param  original
+ * @param  remaining Number of pixels left in data
+ * @param  mask
+ * @return
+ */
+CPU_TARGET_AVX2
+static inline __m256i _fitness_load_original_avx(img_pixel_t *original,
+    int remaining, __m256i *mask)
+{
+    if (remaining >= FITNESS_AVX2_STEP) {
+        *mask = _mm256_set1_epi8(0xFF);
+        return _mm256_loadu_si256((__m256i*) original);
+    }
+
+    unsigned char tail[32] = {0};
+    memcpy(tail, original, remaining);
+    *mask = _mm256_loadu_si256((__m256i*) &_tail_mask[FITNESS_AVX2_STEP - remaining]);
+    return _mm256_loadu_si256((__m256i*) tail);
+}
+
+
+/**
+ * Calculates squared differences of 32 pixels, summed into 8 32-bit lanes
+ * (4 pixels each)
+ */
+CPU_TARGET_AVX2
+static inline __m256i _fitness_sqdiff_avx(__m256i a, __m256i b)
+{
+    __m256i zero = _mm256_setzero_si256();
+
+    // |a - b| fits into unsigned byte
+    __m256i diff = _mm256_sub_epi8(_mm256_max_epu8(a, b), _mm256_min_epu8(a, b));
+
+    // widen to 16 bits and multiply-add pairs
+    __m256i lo = _mm256_unpacklo_epi8(diff, zero);
+    __m256i hi = _mm256_unpackhi_epi8(diff, zero);
+    return _mm256_add_epi32(_mm256_madd_epi16(lo, lo), _mm256_madd_epi16(hi, hi));
+}
+
+
+/**
+ * Adds 32-bit lanes of `acc32` to 64-bit lanes of `acc64`
+ */
+CPU_TARGET_AVX2
+static inline __m256i _fitness_widen_avx(__m256i acc64, __m256i acc32)
+{
+    __m256i zero = _mm256_setzero_si256();
+    acc64 = _mm256_add_epi64(acc64, _mm256_unpacklo_epi32(acc32, zero));
+    acc64 = _mm256_add_epi64(acc64, _mm256_unpackhi_epi32(acc32, zero));
+    return acc64;
+}
+
+
+/**
+ * Horizontal sum of 64-bit lanes
+ */
+CPU_TARGET_AVX2
+static inline double _fitness_hsum_avx(__m256i acc64)
+{
+    __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(acc64),
+        _mm256_extracti128_si256(acc64, 1));
+    sum = _mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum));
+    return (double) _mm_cvtsi128_si64(sum);
+}
+
+
+/**
+ * Expands 32 bits of predictor's mask to 32 bytes, 0xFF where bit is set
+ */
+CPU_TARGET_AVX2
+static inline __m256i _fitness_expand_mask_avx(uint32_t bits)
+{
+    // byte i holds bits of i / 8-th byte
+    __m256i bytes = _mm256_shuffle_epi8(_mm256_set1_epi32(bits),
+        _mm256_setr_epi8(
+            0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+            2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3));
+
+    __m256i select = _mm256_set1_epi64x(0x8040201008040201);
+    return _mm256_cmpeq_epi8(_mm256_and_si256(bytes, select), select);
+}
+
+#endif
+
+
+/**
+ * Calculates sum of squared differences between original and filtered
+ * pixels using AVX2 instructions.
  *
+ * Data are processed in FITNESS_AVX2_STEP blocks, differences are
+ * accumulated in vector registers and summed only once at the end.
+ * Rows of window planes are walked separately, last block of each row
+ * is masked.
+ *
+ * @param  original_image
+ * @param  noisy Window planes
  * @param  chr
- * @param  w
+ * @param  offset Where to start in arrays
+ * @param  length How many pixels to process
  * @return
  */
+CPU_TARGET_AVX2
 double _fitness_get_sqdiffsum_avx(
-    img_image_t _original_image,
-    img_pixel_t *_noisy_image_simd[WINDOW_SIZE],
+    img_pixel_t *original,
+    const img_planes_t *noisy,
+    ga_chr_t chr,
+    int offset,
+    int length)
+{
+#ifndef AVX2
+    assert(false);
+    return 0;
+#else
+    __m256i_aligned avx_inputs[CGP_INPUTS];
+    __m256i_aligned avx_outputs[CGP_OUTPUTS];
+    __m256i acc32 = _mm256_setzero_si256();
+    __m256i acc64 = _mm256_setzero_si256();
+    __m256i mask;
+    int blocks = 0;
+
+    for (int pos = offset, seg = 0, index; pos < offset + length; pos += seg) {
+        seg = img_planes_segment(noisy, pos, offset + length, &index);
+
+        for (int k = 0; k < seg; k += FITNESS_AVX2_STEP) {
+            for (int i = 0; i < CGP_INPUTS; i++) {
+                avx_inputs[i] = _mm256_loadu_si256((__m256i*)(&noisy->planes[i][index + k]));
+            }
+
+            cgp_get_output_avx(chr, avx_inputs, avx_outputs);
+
+            __m256i orig = _fitness_load_original_avx(&original[pos + k],
+                seg - k, &mask);
+            __m256i out = _mm256_and_si256(avx_outputs[0], mask);
+            acc32 = _mm256_add_epi32(acc32, _fitness_sqdiff_avx(out, orig));
+
+            if (++blocks == FITNESS_SQDIFF_FLUSH) {
+                acc64 = _fitness_widen_avx(acc64, acc32);
+                acc32 = _mm256_setzero_si256();
+                blocks = 0;
+            }
+        }
+    }
+
+    return _fitness_hsum_avx(_fitness_widen_avx(acc64, acc32));
+#endif
+}
+
+
+/**
+ * Same as `_fitness_get_sqdiffsum_avx`, but evaluates `blocks` vectors
+ * (at most CGP_AVX_MAX_BLOCKS) in one pass through the chromosome,
+ * so their independent operations can be executed in parallel
+ *
+ * @param  original_image
+ * @param  noisy Window planes
+ * @param  chr
+ * @param  blocks
+ * @param  offset Where to start in arrays
+ * @param  length How many pixels to process
+ * @return
+ */
+CPU_TARGET_AVX2
+double _fitness_get_sqdiffsum_avx_multi(
+    img_pixel_t *original,
+    const img_planes_t *noisy,
+    ga_chr_t chr,
+    int blocks,
+    int offset,
+    int length)
+{
+#ifndef AVX2
+    assert(false);
+    return 0;
+#else
+    cgp_genome_t genome = (cgp_genome_t) chr->genome;
+    cgp_avx_blocks_t values[CGP_SLOTS];
+    int output_slot = genome->output_slots[0];
+    int pass_size = blocks * FITNESS_AVX2_STEP;
+    __m256i acc32 = _mm256_setzero_si256();
+    __m256i acc64 = _mm256_setzero_si256();
+    __m256i mask;
+    int flush = 0;
+
+    for (int pos = offset, seg = 0, index; pos < offset + length; pos += seg) {
+        seg = img_planes_segment(noisy, pos, offset + length, &index);
+
+        for (int k = 0; k < seg; k += pass_size) {
+            // last pass of a row may be shorter
+            int remaining = seg - k;
+            int n = (remaining < pass_size)?
+                (remaining + FITNESS_AVX2_STEP - 1) / FITNESS_AVX2_STEP : blocks;
+
+            for (int i = 0; i < CGP_INPUTS; i++) {
+                for (int b = 0; b < n; b++) {
+                    values[i][b] = _mm256_loadu_si256((__m256i*)(
+                        &noisy->planes[i][index + k + b * FITNESS_AVX2_STEP]));
+                }
+            }
+
+            cgp_eval_instrs_avx_multi(genome->instrs, genome->instr_count,
+                CGP_INPUTS, values, n);
+
+            for (int b = 0; b < n; b++) {
+                int start = k + b * FITNESS_AVX2_STEP;
+                __m256i orig = _fitness_load_original_avx(&original[pos + start],
+                    seg - start, &mask);
+                __m256i out = _mm256_and_si256(values[output_slot][b], mask);
+                acc32 = _mm256_add_epi32(acc32, _fitness_sqdiff_avx(out, orig));
+
+                if (++flush == FITNESS_SQDIFF_FLUSH) {
+                    acc64 = _fitness_widen_avx(acc64, acc32);
+                    acc32 = _mm256_setzero_si256();
+                    flush = 0;
+                }
+            }
+        }
+    }
+
+    return _fitness_hsum_avx(_fitness_widen_avx(acc64, acc32));
+#endif
+}
+
+
+/**
+ * Same as `_fitness_get_sqdiffsum_avx`, but uses compiled chromosome
+ * (see cgp_jit.h)
+ */
+CPU_TARGET_AVX2
+double _fitness_get_sqdiffsum_avx_jit(
+    img_pixel_t *original,
+    const img_planes_t *noisy,
+    ga_chr_t chr,
+    cgp_jit_func_t code,
+    int offset,
+    int length)
+{
+#ifndef AVX2
+    assert(false);
+    return 0;
+#else
+    cgp_genome_t genome = (cgp_genome_t) chr->genome;
+    __m256i_aligned values[CGP_SLOTS];
+    __m256i acc32 = _mm256_setzero_si256();
+    __m256i acc64 = _mm256_setzero_si256();
+    __m256i mask;
+    int blocks = 0;
+
+    for (int pos = offset, seg = 0, index; pos < offset + length; pos += seg) {
+        seg = img_planes_segment(noisy, pos, offset + length, &index);
+
+        for (int k = 0; k < seg; k += FITNESS_AVX2_STEP) {
+            for (int i = 0; i < CGP_INPUTS; i++) {
+                values[i] = _mm256_loadu_si256((__m256i*)(&noisy->planes[i][index + k]));
+            }
+
+            code(values, cgp_jit_constants);
+
+            __m256i orig = _fitness_load_original_avx(&original[pos + k],
+                seg - k, &mask);
+            __m256i out = _mm256_and_si256(values[genome->output_slots[0]], mask);
+            acc32 = _mm256_add_epi32(acc32, _fitness_sqdiff_avx(out, orig));
+
+            if (++blocks == FITNESS_SQDIFF_FLUSH) {
+                acc64 = _fitness_widen_avx(acc64, acc32);
+                acc32 = _mm256_setzero_si256();
+                blocks = 0;
+            }
+        }
+    }
+
+    return _fitness_hsum_avx(_fitness_widen_avx(acc64, acc32));
+#endif
+}
+
+
+/**
+ * Same as `_fitness_get_sqdiffsum_sse_masked`, but uses AVX2 instructions
+ */
+CPU_TARGET_AVX2
+double _fitness_get_sqdiffsum_avx_masked(
+    img_pixel_t *original,
+    const img_planes_t *noisy,
+    ga_chr_t chr,
+    cgp_jit_func_t code,
+    const pred_bitset_word_t *mask,
+    int offset,
+    int length)
+{
+#ifndef AVX2
+    assert(false);
+    return 0;
+#else
+    cgp_genome_t genome = (cgp_genome_t) chr->genome;
+    __m256i_aligned values[CGP_SLOTS];
+    __m256i_aligned avx_outputs[CGP_OUTPUTS];
+    __m256i acc32 = _mm256_setzero_si256();
+    __m256i acc64 = _mm256_setzero_si256();
+    __m256i tail;
+    int blocks = 0;
+
+    for (int pos = offset, seg = 0, index; pos < offset + length; pos += seg) {
+        seg = img_planes_segment(noisy, pos, offset + length, &index);
+
+        for (int k = 0; k < seg; k += FITNESS_AVX2_STEP) {
+            for (int i = 0; i < CGP_INPUTS; i++) {
+                values[i] = _mm256_loadu_si256((__m256i*)(&noisy->planes[i][index + k]));
+            }
+
+            __m256i out;
+            if (code) {
+                code(values, cgp_jit_constants);
+                out = values[genome->output_slots[0]];
+            } else {
+                cgp_get_output_avx(chr, values, avx_outputs);
+                out = avx_outputs[0];
+            }
+
+            __m256i orig = _fitness_load_original_avx(&original[pos + k],
+                seg - k, &tail);
+            __m256i selected = _mm256_and_si256(tail,
+                _fitness_expand_mask_avx(fitness_mask_bits(mask, pos + k)));
+            orig = _mm256_and_si256(orig, selected);
+            out = _mm256_and_si256(out, selected);
+            acc32 = _mm256_add_epi32(acc32, _fitness_sqdiff_avx(out, orig));
+
+            if (++blocks == FITNESS_SQDIFF_FLUSH) {
+                acc64 = _fitness_widen_avx(acc64, acc32);
+                acc32 = _mm256_setzero_si256();
+                blocks = 0;
+            }
+        }
+    }
+
+    return _fitness_hsum_avx(_fitness_widen_avx(acc64, acc32));
+#endif
+}
+
+
+/**
+ * Same as `_fitness_get_sqdiffsum_sse_runs`, but uses AVX2 instructions
+ */
+CPU_TARGET_AVX2
+double _fitness_get_sqdiffsum_avx_runs(
+    img_pixel_t *original,
+    const img_planes_t *noisy,
     ga_chr_t chr,
-    int offset)
+    cgp_jit_func_t code,
+    const pred_run_t *runs,
+    int count)
 {
+#ifndef AVX2
+    assert(false);
+    return 0;
+#else
+    cgp_genome_t genome = (cgp_genome_t) chr->genome;
+    __m256i_aligned values[CGP_SLOTS];
+    __m256i_aligned avx_outputs[CGP_OUTPUTS];
+    __m256i acc32 = _mm256_setzero_si256();
+    __m256i acc64 = _mm256_setzero_si256();
+    __m256i mask;
+    int blocks = 0;
+
+    for (int r = 0; r < count; r++) {
+        int pos = runs[r].offset;
+        int seg = runs[r].length;
+        int index = pos + runs[r].row * (noisy->stride - noisy->width);
+
+        for (int k = 0; k < seg; k += FITNESS_AVX2_STEP) {
+            for (int i = 0; i < CGP_INPUTS; i++) {
+                values[i] = _mm256_loadu_si256((__m256i*)(&noisy->planes[i][index + k]));
+            }
+
+            __m256i out;
+            if (code) {
+                code(values, cgp_jit_constants);
+                out = values[genome->output_slots[0]];
+            } else {
+                cgp_get_output_avx(chr, values, avx_outputs);
+                out = avx_outputs[0];
+            }
+
+            __m256i orig = _fitness_load_original_avx(&original[pos + k],
+                seg - k, &mask);
+            out = _mm256_and_si256(out, mask);
+            acc32 = _mm256_add_epi32(acc32, _fitness_sqdiff_avx(out, orig));
+
+            if (++blocks == FITNESS_SQDIFF_FLUSH) {
+                acc64 = _fitness_widen_avx(acc64, acc32);
+                acc32 = _mm256_setzero_si256();
+                blocks = 0;
+            }
+        }
+    }
+
+    return _fitness_hsum_avx(_fitness_widen_avx(acc64, acc32));
+#endif
+}
+
+
+/**
+ * Evaluates offspring of common parent incrementally using AVX2
+ * instructions - parent's phenotype is evaluated once and only nodes
+ * affected by mutation are recalculated for each chromosome
+ * (see cgp_compile_delta).
+ *
+ * Squared differences are added to `sums`.
+ *
+ * @param  original
+ * @param  noisy
+ * @param  chrs Chromosomes with the same parent
+ * @param  count
+ * @param  parent_code Compiled parent's phenotype or NULL
+ * @param  delta_codes Compiled delta instructions (items may be NULL)
+ * @param  offset Where to start in arrays
+ * @param  length How many pixels to process
+ * @param  sums
+ */
+CPU_TARGET_AVX2
+void _fitness_get_sqdiffsum_avx_delta(
+    img_pixel_t *original,
+    const img_planes_t *noisy,
+    ga_chr_t *chrs,
+    int count,
+    cgp_jit_func_t parent_code,
+    cgp_jit_func_t *delta_codes,
+    int offset,
+    int length,
+    double *sums)
+{
+#ifndef AVX2
+    assert(false);
+#else
+    cgp_genome_t first = (cgp_genome_t) chrs[0]->genome;
+    int first_slot = CGP_INPUTS + first->parent_instr_count;
+    __m256i_aligned values[CGP_DELTA_SLOTS];
+    __m256i acc32[count];
+    __m256i acc64[count];
+    __m256i mask;
+    int blocks = 0;
+
+    for (int c = 0; c < count; c++) {
+        acc32[c] = _mm256_setzero_si256();
+        acc64[c] = _mm256_setzero_si256();
+    }
+
+    for (int pos = offset, seg = 0, index; pos < offset + length; pos += seg) {
+        seg = img_planes_segment(noisy, pos, offset + length, &index);
+
+        for (int k = 0; k < seg; k += FITNESS_AVX2_STEP) {
+            for (int i = 0; i < CGP_INPUTS; i++) {
+                values[i] = _mm256_loadu_si256((__m256i*)(&noisy->planes[i][index + k]));
+            }
+
+            if (parent_code) {
+                parent_code(values, cgp_jit_constants);
+            } else {
+                cgp_eval_instrs_avx(first->parent_instrs, first->parent_instr_count,
+                    CGP_INPUTS, values);
+            }
+
+            __m256i orig = _fitness_load_original_avx(&original[pos + k],
+                seg - k, &mask);
+
+            for (int c = 0; c < count; c++) {
+                cgp_genome_t genome = (cgp_genome_t) chrs[c]->genome;
+
+                if (delta_codes[c]) {
+                    delta_codes[c](values, cgp_jit_constants);
+                } else {
+                    cgp_eval_instrs_avx(genome->delta_instrs, genome->delta_count,
+                        first_slot, values);
+                }
+
+                __m256i out = _mm256_and_si256(values[genome->delta_output_slots[0]], mask);
+                acc32[c] = _mm256_add_epi32(acc32[c], _fitness_sqdiff_avx(out, orig));
+            }
+
+            if (++blocks == FITNESS_SQDIFF_FLUSH) {
+                for (int c = 0; c < count; c++) {
+                    acc64[c] = _fitness_widen_avx(acc64[c], acc32[c]);
+                    acc32[c] = _mm256_setzero_si256();
+                }
+                blocks = 0;
+            }
+        }
+    }
+
+    for (int c = 0; c < count; c++) {
+        sums[c] += _fitness_hsum_avx(_fitness_widen_avx(acc64[c], acc32[c]));
+    }
+#endif
+}
+
+
+/**
+ * Same as `_fitness_filter_sse`, but uses AVX2 instructions
+ *
+ * @param  noisy Window planes
+ * @param  chr
+ * @param  offset Where to start in arrays
+ * @param  length How many pixels to process
+ * @param  filtered Output array, first item belongs to pixel `offset`
+ */
+CPU_TARGET_AVX2
+void _fitness_filter_avx(
+    const img_planes_t *noisy,
+    ga_chr_t chr,
+    int offset,
+    int length,
+    img_pixel_t *filtered)
+{
+#ifndef AVX2
+    assert(false);
+#else
     __m256i_aligned avx_inputs[CGP_INPUTS];
     __m256i_aligned avx_outputs[CGP_OUTPUTS];
-    unsigned char *outputs_ptr = (unsigned char*) &avx_outputs;
 
-    for (int i = 0; i < CGP_INPUTS; i++) {
-        avx_inputs[i] = _mm256_load_si256((__m256i*)(&_noisy_image_simd[i][offset]));
+    for (int pos = offset, seg = 0, index; pos < offset + length; pos += seg) {
+        seg = img_planes_segment(noisy, pos, offset + length, &index);
+
+        for (int k = 0; k < seg; k += FITNESS_AVX2_STEP) {
+            for (int i = 0; i < CGP_INPUTS; i++) {
+                avx_inputs[i] = _mm256_loadu_si256((__m256i*)(&noisy->planes[i][index + k]));
+            }
+
+            cgp_get_output_avx(chr, avx_inputs, avx_outputs);
+
+            int count = seg - k < FITNESS_AVX2_STEP? seg - k : FITNESS_AVX2_STEP;
+            memcpy(&filtered[pos - offset + k], &avx_outputs[0], count);
+        }
     }
+#endif
+}
+
+
+/**
+ * Sums rows of error table on given indices using AVX2 instructions.
+ *
+ * Each row (FITNESS_ERRORS_ROW_ALIGN errors of different circuits) is
+ * loaded by single instruction, widened to 32 bits and accumulated,
+ * lanes are added to 64-bit sums before they could overflow.
+ *
+ * @param  errors Error table, aligned to SIMD_PADDING_BYTES
+ * @param  stride Number of errors in row, multiple of FITNESS_ERRORS_ROW_ALIGN
+ * @param  indices Rows to sum
+ * @param  count
+ * @param  sums Sums of columns, `stride` items
+ */
+CPU_TARGET_AVX2
+void _fitness_sum_errors_avx(
+    const fitness_error_t *errors,
+    int stride,
+    const pred_gene_t *indices,
+    int count,
+    double *sums)
+{
+#ifndef AVX2
+    assert(false);
+#else
+    for (int col = 0; col < stride; col += FITNESS_ERRORS_ROW_ALIGN) {
+        // errors of columns col .. col + 7 and col + 8 .. col + 15
+        __m256i acc32[2] = {_mm256_setzero_si256(), _mm256_setzero_si256()};
+        uint64_t acc64[FITNESS_ERRORS_ROW_ALIGN] = {0};
+        uint32_t lanes[FITNESS_ERRORS_ROW_ALIGN];
+        int blocks = 0;
+
+        for (int i = 0; i < count; i++) {
+            __m256i row = _mm256_load_si256(
+                (__m256i*) &errors[(size_t) indices[i] * stride + col]);
+
+            acc32[0] = _mm256_add_epi32(acc32[0],
+                _mm256_cvtepu16_epi32(_mm256_castsi256_si128(row)));
+            acc32[1] = _mm256_add_epi32(acc32[1],
+                _mm256_cvtepu16_epi32(_mm256_extracti128_si256(row, 1)));
 
-    cgp_get_output_avx(chr, avx_inputs, avx_outputs);
+            // one error per lane and row, less than in `_fitness_sqdiff_avx`
+            if (++blocks == FITNESS_SQDIFF_FLUSH || i == count - 1) {
+                _mm256_storeu_si256((__m256i*) &lanes[0], acc32[0]);
+                _mm256_storeu_si256((__m256i*) &lanes[8], acc32[1]);
+                for (int k = 0; k < FITNESS_ERRORS_ROW_ALIGN; k++) {
+                    acc64[k] += lanes[k];
+                }
+                acc32[0] = acc32[1] = _mm256_setzero_si256();
+                blocks = 0;
+            }
+        }
 
-    // store
-    double sum = 0;
-    for (int i = 0; i < 32; i++) {
-        int diff = outputs_ptr[i] - _original_image->data[offset + i];
-        sum += diff * diff;
+        for (int k = 0; k < FITNESS_ERRORS_ROW_ALIGN; k++) {
+            sums[col + k] = acc64[k];
+        }
     }
-    return sum;
+#endif
 }
@@ -18,45 +18,475 @@
  */
 
 
+#include <string.h>
+#include <assert.h>
+
+#include "cpu.h"
 #include "fitness.h"
 #include "cgp/cgp_sse.h"
 
 
 /**
- * Calculates difference between original and filtered pixel using SSE2
- * instructions.
+ * Loading this array from index FITNESS_SSE2_STEP - n gives mask
+ * selecting first n bytes of a vector
+ */
+static const unsigned char _tail_mask[2 * 16] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+
+/**
+ * Loads FITNESS_SSE2_STEP pixels of original image. Last block of data
+ * may be shorter, pixels out of data are zeroed then and `mask` selects
+ * the valid ones.
+ *
+ * @param  original
+ * @param  remaining Number of pixels left in data
+ * @param  mask
+ * @return
+ */
+CPU_TARGET_SSE2
+static inline __m128i _fitness_load_original_sse(img_pixel_t *original,
+    int remaining, __m128i *mask)
+{
+    if (remaining >= FITNESS_SSE2_STEP) {
+        *mask = _mm_set1_epi8(0xFF);
+        return _mm_loadu_si128((__m128i*) original);
+    }
+
+    unsigned char tail[16] = {0};
+    memcpy(tail, original, remaining);
+    *mask = _mm_loadu_si128((__m128i*) &_tail_mask[FITNESS_SSE2_STEP - remaining]);
+    return _mm_loadu_si128((__m128i*) tail);
+}
+
+
+/**
+ * Calculates squared differences of 16 pixels, summed into 4 32-bit lanes
+ * (4 pixels each)
+ */
+CPU_TARGET_SSE2
+static inline __m128i _fitness_sqdiff_sse(__m128i a, __m128i b)
+{
+    __m128i zero = _mm_setzero_si128();
+
+    // |a - b| fits into unsigned byte
+    __m128i diff = _mm_sub_epi8(_mm_max_epu8(a, b), _mm_min_epu8(a, b));
+
+    // widen to 16 bits and multiply-add pairs
+    __m128i lo = _mm_unpacklo_epi8(diff, zero);
+    __m128i hi = _mm_unpackhi_epi8(diff, zero);
+    return _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi));
+}
+
+
+/**
+ * Adds 32-bit lanes of `acc32` to 64-bit lanes of `acc64`
+ */
+CPU_TARGET_SSE2
+static inline __m128i _fitness_widen_sse(__m128i acc64, __m128i acc32)
+{
+    __m128i zero = _mm_setzero_si128();
+    acc64 = _mm_add_epi64(acc64, _mm_unpacklo_epi32(acc32, zero));
+    acc64 = _mm_add_epi64(acc64, _mm_unpackhi_epi32(acc32, zero));
+    return acc64;
+}
+
+
+/**
+ * Horizontal sum of 64-bit lanes
+ */
+CPU_TARGET_SSE2
+static inline double _fitness_hsum_sse(__m128i acc64)
+{
+    acc64 = _mm_add_epi64(acc64, _mm_unpackhi_epi64(acc64, acc64));
+    return (double) _mm_cvtsi128_si64(acc64);
+}
+
+
+/**
+ * Calculates sum of squared differences between original and filtered
+ * pixels using SSE2 instructions.
  *
- * One call equals 16 CGP evaluations.
+ * Data are processed in FITNESS_SSE2_STEP blocks, differences are
+ * accumulated in vector registers and summed only once at the end.
+ * Rows of window planes are walked separately, last block of each row
+ * is masked.
  *
  * @param  original_image
- * @param  noisy_image_simd
+ * @param  noisy Window planes
  * @param  chr
  * @param  offset Where to start in arrays
- * @param  block_size How many pixels to process
+ * @param  length How many pixels to process
  * @return
  */
+CPU_TARGET_SSE2
 double _fitness_get_sqdiffsum_sse(
     img_pixel_t *original,
-    img_pixel_t *noisy[WINDOW_SIZE],
+    const img_planes_t *noisy,
     ga_chr_t chr,
     int offset,
-    int block_size)
+    int length)
 {
     __m128i_aligned sse_inputs[CGP_INPUTS];
     __m128i_aligned sse_outputs[CGP_OUTPUTS];
-    unsigned char *outputs_ptr = (unsigned char*) &sse_outputs;
+    __m128i acc32 = _mm_setzero_si128();
+    __m128i acc64 = _mm_setzero_si128();
+    __m128i mask;
+    int blocks = 0;
+
+    for (int pos = offset, seg = 0, index; pos < offset + length; pos += seg) {
+        seg = img_planes_segment(noisy, pos, offset + length, &index);
+
+        for (int k = 0; k < seg; k += FITNESS_SSE2_STEP) {
+            for (int i = 0; i < CGP_INPUTS; i++) {
+                sse_inputs[i] = _mm_loadu_si128((__m128i*)(&noisy->planes[i][index + k]));
+            }
+
+            cgp_get_output_sse(chr, sse_inputs, sse_outputs);
+
+            __m128i orig = _fitness_load_original_sse(&original[pos + k],
+                seg - k, &mask);
+            __m128i out = _mm_and_si128(sse_outputs[0], mask);
+            acc32 = _mm_add_epi32(acc32, _fitness_sqdiff_sse(out, orig));
+
+            if (++blocks == FITNESS_SQDIFF_FLUSH) {
+                acc64 = _fitness_widen_sse(acc64, acc32);
+                acc32 = _mm_setzero_si128();
+                blocks = 0;
+            }
+        }
+    }
+
+    return _fitness_hsum_sse(_fitness_widen_sse(acc64, acc32));
+}
+
+
+/**
+ * Same as `_fitness_get_sqdiffsum_sse`, but uses compiled chromosome
+ * (see cgp_jit.h)
+ */
+CPU_TARGET_SSE2
+double _fitness_get_sqdiffsum_sse_jit(
+    img_pixel_t *original,
+    const img_planes_t *noisy,
+    ga_chr_t chr,
+    cgp_jit_func_t code,
+    int offset,
+    int length)
+{
+    cgp_genome_t genome = (cgp_genome_t) chr->genome;
+    __m128i_aligned values[CGP_SLOTS];
+    __m128i acc32 = _mm_setzero_si128();
+    __m128i acc64 = _mm_setzero_si128();
+    __m128i mask;
+    int blocks = 0;
+
+    for (int pos = offset, seg = 0, index; pos < offset + length; pos += seg) {
+        seg = img_planes_segment(noisy, pos, offset + length, &index);
+
+        for (int k = 0; k < seg; k += FITNESS_SSE2_STEP) {
+            for (int i = 0; i < CGP_INPUTS; i++) {
+                values[i] = _mm_loadu_si128((__m128i*)(&noisy->planes[i][index + k]));
+            }
+
+            code(values, cgp_jit_constants);
+
+            __m128i orig = _fitness_load_original_sse(&original[pos + k],
+                seg - k, &mask);
+            __m128i out = _mm_and_si128(values[genome->output_slots[0]], mask);
+            acc32 = _mm_add_epi32(acc32, _fitness_sqdiff_sse(out, orig));
+
+            if (++blocks == FITNESS_SQDIFF_FLUSH) {
+                acc64 = _fitness_widen_sse(acc64, acc32);
+                acc32 = _mm_setzero_si128();
+                blocks = 0;
+            }
+        }
+    }
+
+    return _fitness_hsum_sse(_fitness_widen_sse(acc64, acc32));
+}
+
+
+/**
+ * Expands 16 bits of predictor's mask to 16 bytes, 0xFF where bit is set
+ */
+CPU_TARGET_SSE2
+static inline __m128i _fitness_expand_mask_sse(uint32_t bits)
+{
+    // byte i holds bits of i / 8-th byte
+    __m128i bytes = _mm_cvtsi32_si128(bits);
+    bytes = _mm_unpacklo_epi8(bytes, bytes);
+    bytes = _mm_unpacklo_epi16(bytes, bytes);
+    bytes = _mm_unpacklo_epi32(bytes, bytes);
+
+    __m128i select = _mm_set1_epi64x(0x8040201008040201);
+    return _mm_cmpeq_epi8(_mm_and_si128(bytes, select), select);
+}
+
+
+/**
+ * Calculates sum of squared differences between original and filtered
+ * pixels marked in `mask` using SSE2 instructions. Window planes are
+ * streamed as in `_fitness_get_sqdiffsum_sse_jit`, differences of
+ * unmarked pixels are zeroed before they are accumulated.
+ *
+ * @param  original_image
+ * @param  noisy Window planes
+ * @param  chr
+ * @param  code Compiled chromosome or NULL to interpret it
+ * @param  mask Pixels to evaluate, padded by one word
+ * @param  offset Where to start in arrays
+ * @param  length How many pixels to process
+ * @return
+ */
+CPU_TARGET_SSE2
+double _fitness_get_sqdiffsum_sse_masked(
+    img_pixel_t *original,
+    const img_planes_t *noisy,
+    ga_chr_t chr,
+    cgp_jit_func_t code,
+    const pred_bitset_word_t *mask,
+    int offset,
+    int length)
+{
+    cgp_genome_t genome = (cgp_genome_t) chr->genome;
+    __m128i_aligned values[CGP_SLOTS];
+    __m128i_aligned sse_outputs[CGP_OUTPUTS];
+    __m128i acc32 = _mm_setzero_si128();
+    __m128i acc64 = _mm_setzero_si128();
+    __m128i tail;
+    int blocks = 0;
 
-    for (int i = 0; i < CGP_INPUTS; i++) {
-        sse_inputs[i] = _mm_load_si128((__m128i*)(&noisy[i][offset]));
+    for (int pos = offset, seg = 0, index; pos < offset + length; pos += seg) {
+        seg = img_planes_segment(noisy, pos, offset + length, &index);
+
+        for (int k = 0; k < seg; k += FITNESS_SSE2_STEP) {
+            for (int i = 0; i < CGP_INPUTS; i++) {
+                values[i] = _mm_loadu_si128((__m128i*)(&noisy->planes[i][index + k]));
+            }
+
+            __m128i out;
+            if (code) {
+                code(values, cgp_jit_constants);
+                out = values[genome->output_slots[0]];
+            } else {
+                cgp_get_output_sse(chr, values, sse_outputs);
+                out = sse_outputs[0];
+            }
+
+            __m128i orig = _fitness_load_original_sse(&original[pos + k],
+                seg - k, &tail);
+            __m128i selected = _mm_and_si128(tail,
+                _fitness_expand_mask_sse(fitness_mask_bits(mask, pos + k)));
+            orig = _mm_and_si128(orig, selected);
+            out = _mm_and_si128(out, selected);
+            acc32 = _mm_add_epi32(acc32, _fitness_sqdiff_sse(out, orig));
+
+            if (++blocks == FITNESS_SQDIFF_FLUSH) {
+                acc64 = _fitness_widen_sse(acc64, acc32);
+                acc32 = _mm_setzero_si128();
+                blocks = 0;
+            }
+        }
     }
 
-    cgp_get_output_sse(chr, sse_inputs, sse_outputs);
+    return _fitness_hsum_sse(_fitness_widen_sse(acc64, acc32));
+}
+
+
+/**
+ * Calculates sum of squared differences between original and filtered
+ * pixels of given runs using SSE2 instructions. Runs are read straight
+ * from window planes, differences are accumulated across all of them.
+ *
+ * @param  original
+ * @param  noisy Window planes
+ * @param  chr
+ * @param  code Compiled chromosome or NULL
+ * @param  runs Runs of pixels, each within single row
+ * @param  count Number of runs
+ * @return
+ */
+CPU_TARGET_SSE2
+double _fitness_get_sqdiffsum_sse_runs(
+    img_pixel_t *original,
+    const img_planes_t *noisy,
+    ga_chr_t chr,
+    cgp_jit_func_t code,
+    const pred_run_t *runs,
+    int count)
+{
+    cgp_genome_t genome = (cgp_genome_t) chr->genome;
+    __m128i_aligned values[CGP_SLOTS];
+    __m128i_aligned sse_outputs[CGP_OUTPUTS];
+    __m128i acc32 = _mm_setzero_si128();
+    __m128i acc64 = _mm_setzero_si128();
+    __m128i mask;
+    int blocks = 0;
+
+    for (int r = 0; r < count; r++) {
+        int pos = runs[r].offset;
+        int seg = runs[r].length;
+        int index = pos + runs[r].row * (noisy->stride - noisy->width);
+
+        for (int k = 0; k < seg; k += FITNESS_SSE2_STEP) {
+            for (int i = 0; i < CGP_INPUTS; i++) {
+                values[i] = _mm_loadu_si128((__m128i*)(&noisy->planes[i][index + k]));
+            }
 
-    double sum = 0;
-    for (int i = 0; i < block_size; i++) {
-        int diff = outputs_ptr[i] - original[offset + i];
-        sum += diff * diff;
+            __m128i out;
+            if (code) {
+                code(values, cgp_jit_constants);
+                out = values[genome->output_slots[0]];
+            } else {
+                cgp_get_output_sse(chr, values, sse_outputs);
+                out = sse_outputs[0];
+            }
+
+            __m128i orig = _fitness_load_original_sse(&original[pos + k],
+                seg - k, &mask);
+            out = _mm_and_si128(out, mask);
+            acc32 = _mm_add_epi32(acc32, _fitness_sqdiff_sse(out, orig));
+
+            if (++blocks == FITNESS_SQDIFF_FLUSH) {
+                acc64 = _fitness_widen_sse(acc64, acc32);
+                acc32 = _mm_setzero_si128();
+                blocks = 0;
+            }
+        }
     }
-    return sum;
+
+    return _fitness_hsum_sse(_fitness_widen_sse(acc64, acc32));
 }
 
+
+/**
+ * Evaluates offspring of common parent incrementally using SSE2
+ * instructions - parent's phenotype is evaluated once and only nodes
+ * affected by mutation are recalculated for each chromosome
+ * (see cgp_compile_delta).
+ *
+ * Squared differences are added to `sums`.
+ *
+ * @param  original
+ * @param  noisy
+ * @param  chrs Chromosomes with the same parent
+ * @param  count
+ * @param  parent_code Compiled parent's phenotype or NULL
+ * @param  delta_codes Compiled delta instructions (items may be NULL)
+ * @param  offset Where to start in arrays
+ * @param  length How many pixels to process
+ * @param  sums
+ */
+CPU_TARGET_SSE2
+void _fitness_get_sqdiffsum_sse_delta(
+    img_pixel_t *original,
+    const img_planes_t *noisy,
+    ga_chr_t *chrs,
+    int count,
+    cgp_jit_func_t parent_code,
+    cgp_jit_func_t *delta_codes,
+    int offset,
+    int length,
+    double *sums)
+{
+    cgp_genome_t first = (cgp_genome_t) chrs[0]->genome;
+    int first_slot = CGP_INPUTS + first->parent_instr_count;
+    __m128i_aligned values[CGP_DELTA_SLOTS];
+    __m128i acc32[count];
+    __m128i acc64[count];
+    __m128i mask;
+    int blocks = 0;
+
+    for (int c = 0; c < count; c++) {
+        acc32[c] = _mm_setzero_si128();
+        acc64[c] = _mm_setzero_si128();
+    }
+
+    for (int pos = offset, seg = 0, index; pos < offset + length; pos += seg) {
+        seg = img_planes_segment(noisy, pos, offset + length, &index);
+
+        for (int k = 0; k < seg; k += FITNESS_SSE2_STEP) {
+            for (int i = 0; i < CGP_INPUTS; i++) {
+                values[i] = _mm_loadu_si128((__m128i*)(&noisy->planes[i][index + k]));
+            }
+
+            if (parent_code) {
+                parent_code(values, cgp_jit_constants);
+            } else {
+                cgp_eval_instrs_sse(first->parent_instrs, first->parent_instr_count,
+                    CGP_INPUTS, values);
+            }
+
+            __m128i orig = _fitness_load_original_sse(&original[pos + k],
+                seg - k, &mask);
+
+            for (int c = 0; c < count; c++) {
+                cgp_genome_t genome = (cgp_genome_t) chrs[c]->genome;
+
+                if (delta_codes[c]) {
+                    delta_codes[c](values, cgp_jit_constants);
+                } else {
+                    cgp_eval_instrs_sse(genome->delta_instrs, genome->delta_count,
+                        first_slot, values);
+                }
+
+                __m128i out = _mm_and_si128(values[genome->delta_output_slots[0]], mask);
+                acc32[c] = _mm_add_epi32(acc32[c], _fitness_sqdiff_sse(out, orig));
+            }
+
+            if (++blocks == FITNESS_SQDIFF_FLUSH) {
+                for (int c = 0; c < count; c++) {
+                    acc64[c] = _fitness_widen_sse(acc64[c], acc32[c]);
+                    acc32[c] = _mm_setzero_si128();
+                }
+                blocks = 0;
+            }
+        }
+    }
+
+    for (int c = 0; c < count; c++) {
+        sums[c] += _fitness_hsum_sse(_fitness_widen_sse(acc64[c], acc32[c]));
+    }
+}
+
+
+/**
+ * Filters pixels of window planes using SSE2 instructions (without
+ * compiling the chromosome)
+ *
+ * @param  noisy Window planes
+ * @param  chr
+ * @param  offset Where to start in arrays
+ * @param  length How many pixels to process
+ * @param  filtered Output array, first item belongs to pixel `offset`
+ */
+CPU_TARGET_SSE2
+void _fitness_filter_sse(
+    const img_planes_t *noisy,
+    ga_chr_t chr,
+    int offset,
+    int length,
+    img_pixel_t *filtered)
+{
+    __m128i_aligned sse_inputs[CGP_INPUTS];
+    __m128i_aligned sse_outputs[CGP_OUTPUTS];
+
+    for (int pos = offset, seg = 0, index; pos < offset + length; pos += seg) {
+        seg = img_planes_segment(noisy, pos, offset + length, &index);
+
+        for (int k = 0; k < seg; k += FITNESS_SSE2_STEP) {
+            for (int i = 0; i < CGP_INPUTS; i++) {
+                sse_inputs[i] = _mm_loadu_si128((__m128i*)(&noisy->planes[i][index + k]));
+            }
+
+            cgp_get_output_sse(chr, sse_inputs, sse_outputs);
+
+            int count = seg - k < FITNESS_SSE2_STEP? seg - k : FITNESS_SSE2_STEP;
+            memcpy(&filtered[pos - offset + k], &sse_outputs[0], count);
+        }
+    }
+}
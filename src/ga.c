@@ -69,6 +69,22 @@ void _ga_free_chromosomes(ga_chr_t * arr, int size, ga_free_genome_func_t free_f
 }
 
 
+/**
+ * Frees fitness cache including phenotype keys of its entries
+ * @param cache
+ */
+void _ga_free_fitness_cache(ga_fitness_cache_t *cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+    for (int i = 0; i < GA_FITNESS_CACHE_SIZE; i++) {
+        free(cache->entries[i].key);
+    }
+    free(cache);
+}
+
+
 /**
  * Create a new CGP population with given size. The genomes are not
  * initialized at this point.
@@ -105,12 +121,24 @@ ga_pop_t ga_create_pop(int size, ga_problem_type_t type, ga_func_vect_t methods)
         return NULL;
     }
 
+    /* fitness cache is used only if phenotype can be hashed and compared */
+    new_pop->fitness_cache = NULL;
+    if (methods.phenotype_hash != NULL && methods.phenotype_key != NULL) {
+        new_pop->fitness_cache = (ga_fitness_cache_t*) calloc(1, sizeof(ga_fitness_cache_t));
+        if (new_pop->fitness_cache == NULL) {
+            _ga_free_chromosomes(new_pop->chromosomes, size, methods.free_genome);
+            free(new_pop);
+            return NULL;
+        }
+    }
+
     /* allocate children array */
     new_pop->children = _ga_allocate_chromosomes(size, methods.alloc_genome,
         methods.free_genome);
 
     if (new_pop->children == NULL) {
         _ga_free_chromosomes(new_pop->chromosomes, size, methods.free_genome);
+        _ga_free_fitness_cache(new_pop->fitness_cache);
         free(new_pop);
         return NULL;
     }
@@ -143,6 +171,7 @@ void ga_destroy_pop(ga_pop_t pop)
         }
         free(pop->chromosomes);
         free(pop->children);
+        _ga_free_fitness_cache(pop->fitness_cache);
     }
     free(pop);
 }
@@ -170,6 +199,7 @@ ga_chr_t ga_alloc_chr(ga_alloc_genome_func_t alloc_func)
     }
 
     new_chr->has_fitness = false;
+    new_chr->is_rejected = false;
     new_chr->genome = new_genome;
     return new_chr;
 }
@@ -197,6 +227,7 @@ void ga_copy_chr(ga_chr_t dst, ga_chr_t src, ga_copy_genome_func_t copy_func)
     copy_func(dst->genome, src->genome);
     dst->has_fitness = src->has_fitness;
     dst->fitness = src->fitness;
+    dst->is_rejected = src->is_rejected;
 }
 
 
@@ -235,15 +266,128 @@ void _ga_find_new_best(ga_pop_t pop)
 }
 
 
+/**
+ * Writes phenotype key of given chromosome into buffer, key which does
+ * not fit into it is allocated
+ * @param pop
+ * @param chr
+ * @param buffer GA_PHENOTYPE_KEY_BUFFER bytes
+ * @param length key length is stored here
+ * @return key (buffer or allocated one), NULL if allocation fails
+ */
+void *_ga_phenotype_key(ga_pop_t pop, ga_chr_t chr, unsigned char *buffer,
+    size_t *length)
+{
+    *length = pop->methods.phenotype_key(chr, buffer, GA_PHENOTYPE_KEY_BUFFER);
+    if (*length <= GA_PHENOTYPE_KEY_BUFFER) {
+        return buffer;
+    }
+
+    void *key = malloc(*length);
+    if (key != NULL) {
+        pop->methods.phenotype_key(chr, key, *length);
+    }
+    return key;
+}
+
+
+/**
+ * Looks up chromosome's fitness in fitness cache. On hit, the fitness
+ * is set. Hit requires both hash and phenotype key to match.
+ * @param pop
+ * @param chr
+ * @return whether fitness was found
+ */
+bool _ga_cache_lookup(ga_pop_t pop, ga_chr_t chr)
+{
+    if (pop->fitness_cache == NULL) {
+        return false;
+    }
+
+    ga_hash_t hash = pop->methods.phenotype_hash(chr);
+    ga_fitness_cache_entry_t *entry = &pop->fitness_cache->entries[hash % GA_FITNESS_CACHE_SIZE];
+    unsigned char buffer[GA_PHENOTYPE_KEY_BUFFER];
+    size_t length;
+    void *key = _ga_phenotype_key(pop, chr, buffer, &length);
+    if (key == NULL) {
+        return false;
+    }
+
+    bool found = false;
+
+    #pragma omp critical (GA_FITNESS_CACHE)
+    {
+        if (entry->valid && entry->hash == hash
+            && entry->version == pop->fitness_cache->version
+            && entry->key_length == length
+            && memcmp(entry->key, key, length) == 0)
+        {
+            chr->fitness = entry->fitness;
+            chr->has_fitness = true;
+            found = true;
+        }
+    }
+
+    if (key != buffer) free(key);
+    return found;
+}
+
+
+/**
+ * Stores chromosome's fitness into fitness cache. Key of the entry is
+ * reallocated only if it is shorter than the stored one.
+ * @param pop
+ * @param chr
+ */
+void _ga_cache_store(ga_pop_t pop, ga_chr_t chr)
+{
+    if (pop->fitness_cache == NULL) {
+        return;
+    }
+
+    ga_hash_t hash = pop->methods.phenotype_hash(chr);
+    ga_fitness_cache_entry_t *entry = &pop->fitness_cache->entries[hash % GA_FITNESS_CACHE_SIZE];
+    unsigned char buffer[GA_PHENOTYPE_KEY_BUFFER];
+    size_t length;
+    void *key = _ga_phenotype_key(pop, chr, buffer, &length);
+    if (key == NULL) {
+        return;
+    }
+
+    #pragma omp critical (GA_FITNESS_CACHE)
+    {
+        if (entry->key_capacity < length) {
+            void *grown = realloc(entry->key, length);
+            if (grown != NULL) {
+                entry->key = grown;
+                entry->key_capacity = length;
+            }
+        }
+
+        // entry is left invalid if its key cannot hold the new one
+        entry->valid = entry->key_capacity >= length;
+        if (entry->valid) {
+            memcpy(entry->key, key, length);
+            entry->hash = hash;
+            entry->key_length = length;
+            entry->version = pop->fitness_cache->version;
+            entry->fitness = chr->fitness;
+        }
+    }
+
+    if (key != buffer) free(key);
+}
+
+
 /**
  * Calculate fitness of given chromosome, but only if its `has_fitness`
- * attribute is set to `false`
+ * attribute is set to `false` and its phenotype is not in fitness cache
  * @param pop
  * @param chr
  */
 ga_fitness_t ga_evaluate_chr(ga_pop_t pop, ga_chr_t chr)
 {
-    if (!chr->has_fitness) {
+    if (!chr->has_fitness && !_ga_cache_lookup(pop, chr)) {
         return ga_reevaluate_chr(pop, chr);
     } else {
         return chr->fitness;
@@ -262,15 +406,20 @@ ga_fitness_t ga_reevaluate_chr(ga_pop_t pop, ga_chr_t chr)
     assert(pop->methods.fitness != NULL);
     chr->fitness = pop->methods.fitness(chr);
     chr->has_fitness = true;
+    chr->is_rejected = false;
+    _ga_cache_store(pop, chr);
     return chr->fitness;
 }
 
 
 /**
- * Set `has_fitness` flag for all chromosomes to false
+ * Set `has_fitness` flag for all chromosomes to false and invalidate
+ * fitness cache
  */
 void ga_invalidate_fitness(ga_pop_t pop)
 {
+    ga_invalidate_fitness_cache(pop);
+
     #pragma omp parallel for
     for (int i = 0; i < pop->size; i++) {
         pop->chromosomes[i]->has_fitness = false;
@@ -278,16 +427,80 @@ void ga_invalidate_fitness(ga_pop_t pop)
 }
 
 
+/**
+ * Invalidate fitness cache - should be called whenever fitness function
+ * changes (e.g. it depends on some external data, which were modified)
+ */
+void ga_invalidate_fitness_cache(ga_pop_t pop)
+{
+    if (pop->fitness_cache == NULL) {
+        return;
+    }
+
+    #pragma omp critical (GA_FITNESS_CACHE)
+    {
+        pop->fitness_cache->version++;
+    }
+}
+
+
+/**
+ * Calculate fitness of chromosomes using `batch_fitness` method
+ *
+ * When evaluating only chromosomes without fitness, current best
+ * fitness is passed as a bound, so the evaluation of worse chromosomes
+ * may be stopped early.
+ *
+ * @param pop
+ * @param all Whether to include chromosomes with `has_fitness` set
+ */
+void _ga_evaluate_batch(ga_pop_t pop, bool all)
+{
+    ga_chr_t pending[pop->size];
+    int count = 0;
+
+    for (int i = 0; i < pop->size; i++) {
+        ga_chr_t chr = pop->chromosomes[i];
+        if (all || !(chr->has_fitness || _ga_cache_lookup(pop, chr))) {
+            pending[count++] = chr;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        pending[i]->is_rejected = false;
+    }
+
+    if (count > 0) {
+        ga_fitness_t bound = pop->best_fitness;
+        bool use_bound = !all && pop->best_chr_index >= 0;
+        pop->methods.batch_fitness(pending, count, use_bound? &bound : NULL);
+    }
+
+    for (int i = 0; i < count; i++) {
+        pending[i]->has_fitness = true;
+        if (!pending[i]->is_rejected) {
+            _ga_cache_store(pop, pending[i]);
+        }
+    }
+}
+
+
 /**
  * Calculate fitness of whole population, using `ga_evaluate_chr`
+ * or `batch_fitness` method, if available
  * @param chr
  */
 void ga_evaluate_pop(ga_pop_t pop)
 {
     // evaluate population
-    #pragma omp parallel for
-    for (int i = 0; i < pop->size; i++) {
-        ga_evaluate_chr(pop, pop->chromosomes[i]);
+    if (pop->methods.batch_fitness != NULL) {
+        _ga_evaluate_batch(pop, false);
+
+    } else {
+        #pragma omp parallel for
+        for (int i = 0; i < pop->size; i++) {
+            ga_evaluate_chr(pop, pop->chromosomes[i]);
+        }
     }
 
     /* find new best chromosome */
@@ -297,14 +510,23 @@ void ga_evaluate_pop(ga_pop_t pop)
 
 /**
  * Re-calculate fitness of whole population, using `ga_reevaluate_chr`
+ * or `batch_fitness` method, if available
  * @param chr
  */
 void ga_reevaluate_pop(ga_pop_t pop)
 {
+    // fitness function has probably changed, cached values are useless
+    ga_invalidate_fitness_cache(pop);
+
     // reevaluate population
-    #pragma omp parallel for
-    for (int i = 0; i < pop->size; i++) {
-        ga_reevaluate_chr(pop, pop->chromosomes[i]);
+    if (pop->methods.batch_fitness != NULL) {
+        _ga_evaluate_batch(pop, true);
+
+    } else {
+        #pragma omp parallel for
+        for (int i = 0; i < pop->size; i++) {
+            ga_reevaluate_chr(pop, pop->chromosomes[i]);
+        }
     }
 
     /* find new best chromosome */
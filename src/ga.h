@@ -28,6 +28,17 @@
 
 static const double FITNESS_EPSILON = 1e-10;
 
+/**
+ * Number of entries of fitness cache (see `ga_hash_func_t`)
+ */
+#define GA_FITNESS_CACHE_SIZE 1024
+
+/**
+ * Phenotype keys up to this length are built on stack when fitness cache
+ * is searched, longer ones are allocated (see `ga_phenotype_key_func_t`)
+ */
+#define GA_PHENOTYPE_KEY_BUFFER 4096
+
 /**
  * Fitness value
  */
@@ -40,6 +51,8 @@ typedef double ga_fitness_t;
 struct ga_chr {
     bool has_fitness;
     ga_fitness_t fitness;
+    /* fitness is not exact, only known to be worse than a bound */
+    bool is_rejected;
     void *genome;
 };
 typedef struct ga_chr* ga_chr_t;
@@ -109,6 +122,62 @@ typedef void (*ga_copy_genome_func_t)(void *dst, void* src);
 typedef ga_fitness_t (*ga_fitness_func_t)(ga_chr_t chromosome);
 
 
+/**
+ * Batch fitness function
+ *
+ * This function should calculate fitness of all given chromosomes and
+ * store it into their `fitness` attribute. It must give the same
+ * results as `ga_fitness_func_t` called on each chromosome separately.
+ *
+ * If `bound` is not NULL, it points to fitness of current best
+ * chromosome. Evaluation of chromosomes, which are certainly worse than
+ * the bound, may be stopped early - such chromosomes must get
+ * `is_rejected` flag and fitness worse than the bound (but not exact).
+ *
+ * @param  chromosomes
+ * @param  count
+ * @param  bound
+ */
+typedef void (*ga_batch_fitness_func_t)(ga_chr_t *chromosomes, int count,
+    ga_fitness_t *bound);
+
+
+/**
+ * Phenotype hash
+ */
+typedef unsigned long long ga_hash_t;
+
+
+/**
+ * Phenotype hash function
+ *
+ * Chromosomes with the same phenotype must have the same hash. If set
+ * together with `ga_phenotype_key_func_t`, fitness values are cached by
+ * phenotype and chromosomes with already known phenotype are not
+ * evaluated again.
+ *
+ * @param  chromosome
+ * @return phenotype hash
+ */
+typedef ga_hash_t (*ga_hash_func_t)(ga_chr_t chromosome);
+
+
+/**
+ * Phenotype key function
+ *
+ * Writes compact representation of chromosome's phenotype to `key`,
+ * if it fits into `size` bytes. Cached fitness is used only if keys are
+ * equal, so hash collisions cannot return fitness of another phenotype.
+ *
+ * @param  chromosome
+ * @param  key buffer, may be NULL to get key length only
+ * @param  size of the buffer
+ * @return key length in bytes
+ */
+typedef size_t (*ga_phenotype_key_func_t)(ga_chr_t chromosome, void *key,
+    size_t size);
+
+
 /**
  * New generation population generator function
  *
@@ -170,6 +239,13 @@ typedef struct {
     /* fitness function */
     ga_fitness_func_t fitness;
 
+    /* optional, evaluates more chromosomes at once */
+    ga_batch_fitness_func_t batch_fitness;
+
+    /* optional, both enable fitness cache */
+    ga_hash_func_t phenotype_hash;
+    ga_phenotype_key_func_t phenotype_key;
+
     /* children generator */
     ga_offspring_func_t offspring;
 
@@ -180,6 +256,32 @@ typedef struct {
 } ga_func_vect_t;
 
 
+/**
+ * Fitness cache entry
+ */
+typedef struct {
+    bool valid;
+    unsigned int version;
+    ga_hash_t hash;
+    void *key;
+    size_t key_length;
+    size_t key_capacity;
+    ga_fitness_t fitness;
+} ga_fitness_cache_entry_t;
+
+
+/**
+ * Fitness cache - direct mapped, indexed by phenotype hash.
+ *
+ * Entries of older version are ignored, version is changed every time
+ * the fitness function changes.
+ */
+typedef struct {
+    unsigned int version;
+    ga_fitness_cache_entry_t entries[GA_FITNESS_CACHE_SIZE];
+} ga_fitness_cache_t;
+
+
 /**
  * Population
  */
@@ -205,6 +307,9 @@ struct ga_pop {
 
     /* problem-specific metadata, e.g. pre-calculated values */
     void *metadata;
+
+    /* fitness values of known phenotypes, NULL if disabled */
+    ga_fitness_cache_t *fitness_cache;
 };
 
 
@@ -279,14 +384,22 @@ ga_fitness_t ga_reevaluate_chr(ga_pop_t pop, ga_chr_t chr);
 
 
 /**
- * Set `has_fitness` flag for all chromosomes to false
+ * Set `has_fitness` flag for all chromosomes to false and invalidate
+ * fitness cache
  */
 void ga_invalidate_fitness(ga_pop_t pop);
 
 
+/**
+ * Invalidate fitness cache - should be called whenever fitness function
+ * changes (e.g. it depends on some external data, which were modified)
+ */
+void ga_invalidate_fitness_cache(ga_pop_t pop);
+
+
 /**
  * Calculate fitness of whole population, using `ga_evaluate_chr`
- * in single thread
+ * or `batch_fitness` method, if available
  * @param chr
  */
 void ga_evaluate_pop(ga_pop_t pop);
@@ -294,6 +407,7 @@ void ga_evaluate_pop(ga_pop_t pop);
 
 /**
  * Re-calculate fitness of whole population, using `ga_reevaluate_chr`
+ * or `batch_fitness` method, if available
  * @param chr
  */
 void ga_reevaluate_pop(ga_pop_t pop);
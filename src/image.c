@@ -115,16 +115,15 @@ void img_destroy(img_image_t img) {
 
 
 /**
- * Clears all data associated with image windows from memory
+ * Clears all data associated with padded image from memory
  * @param img
  */
-void img_windows_destroy(img_window_array_t arr) {
-    if (arr != NULL) free(arr->windows);
-    free(arr);
+void img_padded_destroy(img_padded_t img) {
+    if (img != NULL) free(img->buffer);
+    free(img);
 }
 
 
-
 /**
  * Returns index of neighbour with given offset
  * @param  baseX
@@ -147,85 +146,67 @@ static inline int get_neighbour_index(int baseX, int baseY, int width, int heigh
 
 
 /**
- * Splits image into windows
- * @param  filename
- * @return
+ * Creates padded copy of image (with replicated borders)
+ *
+ * Rows are aligned to SIMD_PADDING_BYTES and there is enough space
+ * after the last row, so that vector loads of neighbourhood of any
+ * pixel never read out of buffer.
+ *
+ * @param  img
+ * @return NULL on failure
  */
-img_window_array_t img_split_windows(img_image_t img) {
-    int size = img->width * img->height;
-    img_window_t *windows = (img_window_t*) malloc(sizeof(img_window_t) * size);
-    if (windows == NULL) return NULL;
-
-    img_window_array_t arr = (img_window_array_t) malloc(sizeof(struct img_window_array));
-    if (arr == NULL) {
-        free(windows);
+img_padded_t img_pad(img_image_t img)
+{
+    img_padded_t padded = (img_padded_t) malloc(sizeof(struct img_padded));
+    if (padded == NULL) return NULL;
+
+    // room for left and right border
+    int stride = img->width + 2;
+    stride += SIMD_PADDING_BYTES - 1;
+    stride -= stride % SIMD_PADDING_BYTES;
+
+    // top border row and its left border pixel before data, bottom
+    // border row and one vector after them
+    int lead = stride + SIMD_PADDING_BYTES;
+    int size = lead + (img->height + 1) * stride + 2 * SIMD_PADDING_BYTES;
+
+    padded->buffer = (img_pixel_t*) cpu_alloc_simd(sizeof(img_pixel_t) * size);
+    if (padded->buffer == NULL) {
+        free(padded);
         return NULL;
     }
 
-    arr->size = size;
-    arr->windows = windows;
-
-    for (int x = 0; x < img->width; x++) {
-        for (int y = 0; y < img->height; y++) {
-            int index = img_pixel_index(img, x, y);
-            windows[index].pos_x = x;
-            windows[index].pos_y = y;
-            windows[index].pixels[0] = img->data[get_neighbour_index(x, y, img->width, img->height, -1, -1)];
-            windows[index].pixels[1] = img->data[get_neighbour_index(x, y, img->width, img->height,  0, -1)];
-            windows[index].pixels[2] = img->data[get_neighbour_index(x, y, img->width, img->height, +1, -1)];
-            windows[index].pixels[3] = img->data[get_neighbour_index(x, y, img->width, img->height, -1,  0)];
-            windows[index].pixels[4] = img->data[get_neighbour_index(x, y, img->width, img->height,  0,  0)];
-            windows[index].pixels[5] = img->data[get_neighbour_index(x, y, img->width, img->height, +1,  0)];
-            windows[index].pixels[6] = img->data[get_neighbour_index(x, y, img->width, img->height, -1, +1)];
-            windows[index].pixels[7] = img->data[get_neighbour_index(x, y, img->width, img->height,  0, +1)];
-            windows[index].pixels[8] = img->data[get_neighbour_index(x, y, img->width, img->height, +1, +1)];
+    padded->data = padded->buffer + lead;
+    padded->width = img->width;
+    padded->height = img->height;
+    padded->stride = stride;
+
+    for (int y = -1; y <= img->height; y++) {
+        for (int x = -1; x <= img->width; x++) {
+            padded->data[y * stride + x] = img->data[
+                get_neighbour_index(x, y, img->width, img->height, 0, 0)];
         }
     }
 
-    return arr;
+    return padded;
 }
 
 
 /**
- * Splits image into windows, suitably for SIMD processing
- * @param  filename
- * @return 0 on success
+ * Fills window planes of padded image, no data are copied
+ * @param img
+ * @param planes
  */
-int img_split_windows_simd(img_image_t img, img_pixel_t *out[WINDOW_SIZE])
+void img_padded_planes(img_padded_t img, img_planes_t *planes)
 {
-    // align length to 256bits
-    int size = img->width * img->height;
-    int padding = SIMD_PADDING_BYTES - (size % SIMD_PADDING_BYTES);
-
     for (int i = 0; i < WINDOW_SIZE; i++) {
-        out[i] = (img_pixel_t*) malloc(sizeof(img_pixel_t) * (size + padding));
-        if (out[i] == NULL) {
-            // TODO: dealloc
-            return -1;
-        }
-    }
-
-    for (int x = 0; x < img->width; x++) {
-        for (int y = 0; y < img->height; y++) {
-            int index = img_pixel_index(img, x, y);
-            out[0][index] = img->data[get_neighbour_index(x, y, img->width, img->height, -1, -1)];
-            out[1][index] = img->data[get_neighbour_index(x, y, img->width, img->height,  0, -1)];
-            out[2][index] = img->data[get_neighbour_index(x, y, img->width, img->height, +1, -1)];
-            out[3][index] = img->data[get_neighbour_index(x, y, img->width, img->height, -1,  0)];
-            out[4][index] = img->data[get_neighbour_index(x, y, img->width, img->height,  0,  0)];
-            out[5][index] = img->data[get_neighbour_index(x, y, img->width, img->height, +1,  0)];
-            out[6][index] = img->data[get_neighbour_index(x, y, img->width, img->height, -1, +1)];
-            out[7][index] = img->data[get_neighbour_index(x, y, img->width, img->height,  0, +1)];
-            out[8][index] = img->data[get_neighbour_index(x, y, img->width, img->height, +1, +1)];
-        }
-    }
-
-    // set padding bits to zero
-    for (int i = 0; i < 9; i++) {
-        memset(&(out[i][size]), 0, sizeof(img_pixel_t) * padding);
+        int off_x = i % 3 - 1;
+        int off_y = i / 3 - 1;
+        planes->planes[i] = img->data + off_y * img->stride + off_x;
     }
 
-    return 0;
+    planes->width = img->width;
+    planes->stride = img->stride;
 }
 
 
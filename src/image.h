@@ -20,6 +20,8 @@
 
 #pragma once
 
+#include <string.h>
+
 
 #define WINDOW_SIZE 9
 #define WINDOW_CENTER 4
@@ -36,18 +38,35 @@ struct img_image {
 typedef struct img_image* img_image_t;
 
 
-typedef struct {
-    int pos_x;
-    int pos_y;
-    img_pixel_t pixels[WINDOW_SIZE];
-} img_window_t;
+/**
+ * Image surrounded by one pixel wide frame of replicated border pixels.
+ * Whole 3x3 neighbourhood of any pixel can then be read without bound
+ * checks, neighbours of pixel at `data + index` are at offsets -1, +1,
+ * -stride and +stride.
+ */
+struct img_padded {
+    img_pixel_t *buffer;
+    img_pixel_t *data;
+    int width;
+    int height;
+    int stride;
+};
+typedef struct img_padded* img_padded_t;
 
 
-typedef struct img_window_array {
-    int size;
-    img_window_t *windows;
-} _img_window_array;
-typedef struct img_window_array* img_window_array_t;
+/**
+ * Window planes - i-th pixel of window around pixel in row `y` and
+ * column `x` is `planes[i][y * stride + x]`, first `width` pixels of
+ * each row are valid.
+ *
+ * Planes of padded image are just shifted pointers to its data (see
+ * `img_padded_planes`), dense arrays of windows form a single row.
+ */
+typedef struct {
+    img_pixel_t *planes[WINDOW_SIZE];
+    int width;
+    int stride;
+} img_planes_t;
 
 
 /**
@@ -67,18 +86,19 @@ img_image_t img_load(char const *filename);
 
 
 /**
- * Splits image into windows
- * @param  filename
- * @return
+ * Creates padded copy of image (with replicated borders)
+ * @param  img
+ * @return NULL on failure
  */
-img_window_array_t img_split_windows(img_image_t img);
+img_padded_t img_pad(img_image_t img);
 
 
 /**
- * Splits image into windows, suitably for SIMD processing
- * @return
+ * Fills window planes of padded image, no data are copied
+ * @param img
+ * @param planes
  */
-int img_split_windows_simd(img_image_t img, img_pixel_t *out[WINDOW_SIZE]);
+void img_padded_planes(img_padded_t img, img_planes_t *planes);
 
 
 /**
@@ -114,10 +134,10 @@ void img_destroy(img_image_t img);
 
 
 /**
- * Clears all data associated with image windows from memory
+ * Clears all data associated with padded image from memory
  * @param img
  */
-void img_windows_destroy(img_window_array_t arr);
+void img_padded_destroy(img_padded_t img);
 
 
 /**
@@ -156,3 +176,64 @@ static inline img_pixel_t img_get_pixel(img_image_t img, int x, int y) {
 static inline void img_set_pixel(img_image_t img, int x, int y, img_pixel_t value) {
     img->data[img_pixel_index(img, x, y)] = value;
 }
+
+
+/**
+ * Returns length of contiguous part of pixels [pos, end) which lies
+ * in a single row of window planes, and index of its first pixel in planes
+ * @param  planes
+ * @param  pos Pixel index (row-major, without padding)
+ * @param  end
+ * @param  index
+ * @return
+ */
+static inline int img_planes_segment(const img_planes_t *planes,
+    int pos, int end, int *index)
+{
+    int y = pos / planes->width;
+    int x = pos - y * planes->width;
+    int length = planes->width - x;
+
+    *index = y * planes->stride + x;
+    return (end - pos < length)? end - pos : length;
+}
+
+
+/**
+ * Reads window of given pixel from window planes
+ * @param planes
+ * @param pos Pixel index (row-major, without padding)
+ * @param window
+ */
+static inline void img_planes_get_window(const img_planes_t *planes,
+    int pos, img_pixel_t window[WINDOW_SIZE])
+{
+    int index;
+    img_planes_segment(planes, pos, pos + 1, &index);
+
+    for (int i = 0; i < WINDOW_SIZE; i++) {
+        window[i] = planes->planes[i][index];
+    }
+}
+
+
+/**
+ * Copies windows of `count` pixels starting at `pos` from window planes
+ * into separate arrays (one per window pixel)
+ * @param planes
+ * @param pos Pixel index (row-major, without padding)
+ * @param count
+ * @param out
+ */
+static inline void img_planes_read(const img_planes_t *planes,
+    int pos, int count, img_pixel_t *out[WINDOW_SIZE])
+{
+    for (int done = 0, seg = 0, index; done < count; done += seg) {
+        seg = img_planes_segment(planes, pos + done, pos + count, &index);
+
+        for (int i = 0; i < WINDOW_SIZE; i++) {
+            memcpy(&out[i][done], &planes->planes[i][index],
+                sizeof(img_pixel_t) * seg);
+        }
+    }
+}
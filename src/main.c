@@ -52,6 +52,9 @@ static config_t config = {
     .cgp_mutate_genes = 5,
     .cgp_population_size = 8,
     .cgp_archive_size = 10,
+    .cgp_cols = CGP_DEFAULT_COLS,
+    .cgp_rows = CGP_DEFAULT_ROWS,
+    .cgp_lback = CGP_DEFAULT_LBACK,
 
     .pred_size = 0.25,
     .pred_initial_size = 0,
@@ -60,6 +63,7 @@ static config_t config = {
     .pred_offspring_elite = 0.25,
     .pred_offspring_combine = 0.5,
     .pred_genome_type = permuted,
+    .pred_sorted = false,
 
     .bw_interval = 0,
     .bw_config = {
@@ -204,13 +208,23 @@ int main(int argc, char *argv[])
     rand_init_seed(config.random_seed);
 
     // cgp evolution
-    cgp_init(config.cgp_mutate_genes, fitness_eval_or_predict_cgp);
+    cgp_set_geometry(config.cgp_cols, config.cgp_rows, config.cgp_lback);
+    cgp_init(config.cgp_mutate_genes, fitness_eval_or_predict_cgp,
+        fitness_eval_or_predict_cgp_batch);
 
     // predictors population and both archives
     if (config.algorithm != simple_cgp) {
 
-        // calculate absolute predictors sizes
-        int img_size = work_data.img_original->width * work_data.img_original->height;
+        // calculate absolute predictors sizes, genes of tiled genotype
+        // select tiles instead of pixels
+        int img_width = work_data.img_original->width;
+        int img_height = work_data.img_original->height;
+        int img_size = img_width * img_height;
+        const char *gene_units = "pixels";
+        if (config.pred_genome_type == tiled) {
+            img_size = pred_tiles_count(img_width, img_height);
+            gene_units = "tiles";
+        }
         int pred_min_size = config.pred_min_size * img_size;
         int pred_max_size = config.pred_size * img_size;
         int pred_initial_size;
@@ -238,16 +252,16 @@ int main(int argc, char *argv[])
                 config.bw_config.increase_fast_increment = pred_max_size * config.bw_increase_fast_increment_percent;
 
                 printf("Absolute increments are:\n"
-                    "Base: %d pixels\n"
-                    "Zero: %d pixels\n"
-                    "Decrease: %d pixels\n"
-                    "Slow increase: %d pixels\n"
-                    "Fast increase: %d pixels\n",
-                    config.bw_config.absolute_increment_base,
-                    config.bw_config.zero_increment,
-                    config.bw_config.decrease_increment,
-                    config.bw_config.increase_slow_increment,
-                    config.bw_config.increase_fast_increment
+                    "Base: %d %s\n"
+                    "Zero: %d %s\n"
+                    "Decrease: %d %s\n"
+                    "Slow increase: %d %s\n"
+                    "Fast increase: %d %s\n",
+                    config.bw_config.absolute_increment_base, gene_units,
+                    config.bw_config.zero_increment, gene_units,
+                    config.bw_config.decrease_increment, gene_units,
+                    config.bw_config.increase_slow_increment, gene_units,
+                    config.bw_config.increase_fast_increment, gene_units
                 );
             }
         }
@@ -259,6 +273,10 @@ int main(int argc, char *argv[])
         pred_metadata.mutation_rate = config.pred_mutation_rate;
         pred_metadata.offspring_elite = config.pred_offspring_elite;
         pred_metadata.offspring_combine = config.pred_offspring_combine;
+        pred_metadata.archive_capacity = config.cgp_archive_size;
+        pred_metadata.sorted_phenotype = config.pred_sorted;
+        pred_metadata.image_width = img_width;
+        pred_metadata.image_height = img_height;
 
         // predictors evolution
         pred_init(&pred_metadata);
@@ -269,6 +287,7 @@ int main(int argc, char *argv[])
             .free_genome = cgp_free_genome,
             .copy_genome = cgp_copy_genome,
             .fitness = fitness_eval_cgp,
+            .stored = fitness_cgp_archived,
         };
         work_data.cgp_archive = arc_create(config.cgp_archive_size, arc_cgp_methods, CGP_PROBLEM_TYPE);
         if (work_data.cgp_archive == NULL) {
@@ -282,6 +301,7 @@ int main(int argc, char *argv[])
             .free_genome = pred_free_genome,
             .copy_genome = pred_copy_genome,
             .fitness = NULL,
+            .stored = fitness_predictor_archived,
         };
         work_data.pred_archive = arc_create(1, arc_pred_methods, PRED_PROBLEM_TYPE);
         if (work_data.pred_archive == NULL) {
@@ -393,6 +413,7 @@ int main(int argc, char *argv[])
         arc_destroy(work_data.pred_archive);
     }
     cgp_deinit();
+    pred_deinit();
     fitness_deinit();
 
     img_destroy(work_data.img_original);
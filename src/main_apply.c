@@ -21,10 +21,12 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include <getopt.h>
 
 #include "image.h"
 #include "cgp/cgp.h"
+#include "cgp/cgp_vector.h"
 
 
 const char* help =
@@ -80,7 +82,8 @@ int main(int argc, char *argv[])
     static const char *short_options = "hc:i:o:";
 
     img_image_t input_image = NULL;
-    img_window_array_t input_image_windows = NULL;
+    img_padded_t input_image_padded = NULL;
+    img_planes_t input_image_planes;
     img_image_t output_image = NULL;
     FILE *output_image_file = NULL;
     ga_chr_t chromosome = ga_alloc_chr(cgp_alloc_genome);
@@ -140,8 +143,8 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    input_image_windows = img_split_windows(input_image);
-    if (!input_image_windows) {
+    input_image_padded = img_pad(input_image);
+    if (!input_image_padded) {
         fprintf(stderr, "Failed to preprocess input image.\n");
         return 1;
     }
@@ -166,14 +169,23 @@ int main(int argc, char *argv[])
         Filter image
     */
 
-    for (int i = 0; i < input_image_windows->size; i++) {
-        img_window_t *w = &input_image_windows->windows[i];
+    img_padded_planes(input_image_padded, &input_image_planes);
 
-        cgp_value_t *inputs = w->pixels;
-        cgp_value_t output_pixel;
-        cgp_get_output(chromosome, inputs, &output_pixel);
+    int size = input_image->width * input_image->height;
+    cgp_vector_t inputs[CGP_INPUTS] = {{0}};
+    cgp_vector_t output;
+    img_pixel_t *input_ptrs[WINDOW_SIZE];
 
-        img_set_pixel(output_image, w->pos_x, w->pos_y, output_pixel);
+    for (int i = 0; i < WINDOW_SIZE; i++) {
+        input_ptrs[i] = (img_pixel_t*) &inputs[i];
+    }
+
+    for (int pos = 0; pos < size; pos += CGP_VECTOR_BLOCK) {
+        int count = (size - pos < CGP_VECTOR_BLOCK)? size - pos : CGP_VECTOR_BLOCK;
+
+        img_planes_read(&input_image_planes, pos, count, input_ptrs);
+        cgp_get_output_vector(chromosome, inputs, &output);
+        memcpy(&output_image->data[pos], &output, sizeof(cgp_value_t) * count);
     }
 
     /*
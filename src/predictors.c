@@ -24,7 +24,6 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "cpu.h"
 #include "random.h"
 #include "fitness.h"
 #include "predictors.h"
@@ -32,6 +31,36 @@
 
 static pred_metadata_t *_metadata;
 
+// number of words of `_used_values` bitset
+static int _used_values_words;
+
+// maximal number of phenotype pixels
+static int _pixels_capacity;
+
+// number of tiles in one row of image, for tiled genotype
+static int _tile_columns;
+
+// working buffers of a thread, buffers of all threads are listed
+// to be freed by `pred_deinit`
+typedef struct _pred_buffers {
+    // unused values for sampling, see `_pred_sample_unused`
+    pred_gene_t *sample_pool;
+
+    // phenotype values of partially used permuted genotype, see
+    // `_pred_sort_permuted_phenotype`
+    pred_bitset_word_t *phenotype_set;
+
+    struct _pred_buffers *next;
+} _pred_buffers_t;
+
+static _Thread_local _pred_buffers_t *_buffers = NULL;
+
+// thread's buffers are valid only if they were allocated in current
+// generation, their sizes depend on metadata and older ones were freed
+static _Thread_local unsigned int _buffers_generation;
+static unsigned int _generation;
+static _pred_buffers_t *_all_buffers = NULL;
+
 
 #ifdef PRED_DEBUG
     #define VERBOSELOG(s, ...) fprintf(stderr, s "\n", __VA_ARGS__)
@@ -40,6 +69,10 @@ static pred_metadata_t *_metadata;
 #endif
 
 
+// number of genes compared at once when looking for changed pixels
+#define PRED_COMPARE_BLOCK 32
+
+
 enum _offspring_op {
     random_mutant,
     crossover_product,
@@ -50,13 +83,85 @@ enum _offspring_op {
 /* initialization *************************************************************/
 
 
+/**
+ * Frees working buffers of all threads
+ */
+static void _pred_free_buffers()
+{
+    #pragma omp critical (PRED_BUFFERS)
+    {
+        while (_all_buffers != NULL) {
+            _pred_buffers_t *buffers = _all_buffers;
+            _all_buffers = buffers->next;
+            free(buffers->sample_pool);
+            free(buffers->phenotype_set);
+            free(buffers);
+        }
+        _generation++;
+    }
+    _buffers = NULL;
+}
+
+
+/**
+ * Returns calling thread's working buffers, their contents are
+ * allocated on first use
+ * @return buffers, NULL on allocation failure
+ */
+static _pred_buffers_t *_pred_thread_buffers()
+{
+    if (_buffers == NULL || _buffers_generation != _generation) {
+        _buffers = (_pred_buffers_t*) calloc(1, sizeof(_pred_buffers_t));
+        if (_buffers == NULL) {
+            return NULL;
+        }
+        _buffers_generation = _generation;
+
+        #pragma omp critical (PRED_BUFFERS)
+        {
+            _buffers->next = _all_buffers;
+            _all_buffers = _buffers;
+        }
+    }
+    return _buffers;
+}
+
+
 /**
  * Initialize predictor internals
  */
 void pred_init(pred_metadata_t *metadata)
 {
+    // buffers of previous metadata may be too small
+    _pred_free_buffers();
+
     _metadata = metadata;
     assert(metadata->genotype_used_length <= metadata->genotype_length);
+
+    _used_values_words = (metadata->max_gene_value + PRED_BITSET_WORD_BITS)
+        / PRED_BITSET_WORD_BITS;
+
+    // phenotype has a pixel per gene, or whole tiles (which are unique,
+    // so they never cover more than whole image)
+    _pixels_capacity = metadata->genotype_length;
+    if (metadata->genome_type == tiled) {
+        assert(metadata->max_gene_value + 1 == pred_tiles_count(
+            metadata->image_width, metadata->image_height));
+        _tile_columns = (metadata->image_width + PRED_TILE_WIDTH - 1) / PRED_TILE_WIDTH;
+
+        long tiles_size = (long) metadata->genotype_length * PRED_TILE_WIDTH * PRED_TILE_HEIGHT;
+        long image_size = (long) metadata->image_width * metadata->image_height;
+        _pixels_capacity = (tiles_size < image_size)? tiles_size : image_size;
+    }
+}
+
+
+/**
+ * Releases sampling pools and phenotype sets of all threads
+ */
+void pred_deinit()
+{
+    _pred_free_buffers();
 }
 
 
@@ -69,8 +174,10 @@ void pred_init(pred_metadata_t *metadata)
 ga_pop_t pred_init_pop(int pop_size)
 {
     ga_fitness_func_t fitfunc = fitness_eval_predictor;
+    ga_batch_fitness_func_t batchfunc = fitness_eval_predictor_batch;
     if (_metadata->genome_type == circular) {
         fitfunc = fitness_eval_circular_predictor;
+        batchfunc = fitness_eval_circular_predictor_batch;
     }
 
     /* prepare methods vector */
@@ -80,6 +187,7 @@ ga_pop_t pred_init_pop(int pop_size)
         .init_genome = pred_randomize_genome,
 
         .fitness = fitfunc,
+        .batch_fitness = batchfunc,
         .offspring = pred_offspring,
     };
 
@@ -100,9 +208,36 @@ void* pred_alloc_genome()
         return NULL;
     }
 
-    genome->_genes = (pred_gene_t*) malloc(sizeof(pred_gene_t) * _metadata->genotype_length);
+    // all fields are initialized first, so that partially allocated
+    // genome can be freed by `pred_free_genome`
+    genome->_genes = NULL;
+    genome->_used_values = NULL;
+    genome->pixels = NULL;
+    genome->used_pixels = 0;
+
+    // tiles and their runs, every tile row is a run at most
+    genome->tiles = NULL;
+    genome->used_tiles = 0;
+    genome->runs = NULL;
+    genome->runs_count = 0;
+
+    // only archived predictor is prepared for predicting CGP fitness
+    genome->prepared = pred_unprepared;
+
+    // error sums of archived circuits and changes of phenotype since they
+    // were calculated, there is no point in summing more changes than
+    // pixels in phenotype
+    genome->_error_sums = NULL;
+    genome->_error_sums_version = 0;
+    genome->_added_pixels = NULL;
+    genome->_removed_pixels = NULL;
+    genome->_added_count = 0;
+    genome->_removed_count = 0;
+
+    // zeroed, `_used_values` are cleared using old genes
+    genome->_genes = (pred_gene_t*) calloc(_metadata->genotype_length, sizeof(pred_gene_t));
     if (genome->_genes == NULL) {
-        free(genome);
+        pred_free_genome(genome);
         return NULL;
     }
 
@@ -110,15 +245,15 @@ void* pred_alloc_genome()
         For permuted genotype: holds which values has been used.
         For repeated genotype: used for calculating genotype (also holds
             which values has been used in phenotype)
+        Genome is empty so far.
      */
-    genome->_used_values = (bool*) malloc(sizeof(bool) * (_metadata->max_gene_value + 1));
+    genome->_used_values = (pred_bitset_word_t*) calloc(_used_values_words, sizeof(pred_bitset_word_t));
     if (genome->_used_values == NULL) {
-        free(genome->_genes);
-        free(genome);
+        pred_free_genome(genome);
         return NULL;
     }
 
-    if (_metadata->genome_type == permuted) {
+    if (_metadata->genome_type == permuted && !_metadata->sorted_phenotype) {
 
         // one-to-one mapping
         // field genome->used_pixels must be updated manually after every change!
@@ -126,31 +261,31 @@ void* pred_alloc_genome()
 
     } else {
         // phenotype is different
-        genome->pixels = (unsigned int*) malloc(sizeof(unsigned int) * _metadata->genotype_length);
+        genome->pixels = (unsigned int*) malloc(sizeof(unsigned int) * _pixels_capacity);
         if (genome->pixels == NULL) {
-            free(genome->_genes);
-            free(genome);
+            pred_free_genome(genome);
             return NULL;
         }
     }
 
-    // allocate space for simd-friendly data using calloc, since we
-    // want initialized padding bits
-    if (can_use_simd()) {
-        int size = _metadata->genotype_length;
-        int padding = SIMD_PADDING_BYTES - (size % SIMD_PADDING_BYTES);
-        genome->original_simd = (img_pixel_t *) calloc(size + padding, sizeof(img_pixel_t));
-        if (genome->original_simd == NULL) {
-            // TODO: implement proper deallocation on failure
-            // Whatever, if it fails, everything fails, OS cleans it, so...
+    if (_metadata->genome_type == tiled) {
+        genome->tiles = (pred_gene_t*) malloc(sizeof(pred_gene_t) * _metadata->genotype_length);
+        genome->runs = (pred_run_t*) malloc(sizeof(pred_run_t) * _metadata->genotype_length * PRED_TILE_HEIGHT);
+        if (genome->tiles == NULL || genome->runs == NULL) {
+            pred_free_genome(genome);
             return NULL;
         }
+    }
 
-        for (int i = 0; i < WINDOW_SIZE; i++) {
-            genome->pixels_simd[i] = (img_pixel_t *) calloc(size + padding, sizeof(img_pixel_t));
-            if (genome->pixels_simd[i] == NULL) {
-                return NULL;
-            }
+    if (_metadata->archive_capacity > 0) {
+        int stride = fitness_errors_stride(_metadata->archive_capacity);
+        genome->_error_sums = (double*) malloc(sizeof(double) * stride);
+        genome->_added_pixels = (pred_gene_t*) malloc(sizeof(pred_gene_t) * _pixels_capacity);
+        genome->_removed_pixels = (pred_gene_t*) malloc(sizeof(pred_gene_t) * _pixels_capacity);
+        if (genome->_error_sums == NULL || genome->_added_pixels == NULL
+            || genome->_removed_pixels == NULL) {
+            pred_free_genome(genome);
+            return NULL;
         }
     }
 
@@ -168,14 +303,146 @@ void pred_free_genome(void *_genome)
     pred_genome_t genome = (pred_genome_t) _genome;
     free(genome->_used_values);
     free(genome->_genes);
-    if (_metadata->genome_type != permuted) free(genome->pixels);
-    if (can_use_simd()) {
-        free(genome->original_simd);
-        for (int i = 0; i < WINDOW_SIZE; i++) {
-            free(genome->pixels_simd[i]);
+    if (genome->pixels != genome->_genes) free(genome->pixels);
+    free(genome->tiles);
+    free(genome->runs);
+    free(genome->_error_sums);
+    free(genome->_added_pixels);
+    free(genome->_removed_pixels);
+    free(genome);
+}
+
+
+/**
+ * Draws unique values uniformly from those not in `used` set
+ */
+typedef struct {
+    pred_bitset_word_t *used;
+
+    /* whether to draw from list of unused values, see `_pred_sample_unused` */
+    bool use_list;
+
+    /* unused values, see `_pred_list_unused` */
+    pred_gene_t *pool;
+
+    /* number of unused values listed in `pool`, -1 if not listed */
+    int unused_count;
+} _pred_sampler_t;
+
+
+/**
+ * Prepares sampling of values not in given set
+ * @param used
+ * @param used_count Number of values in the set (at the end of sampling)
+ * @param samples Number of values which will be drawn
+ */
+static inline _pred_sampler_t _pred_sampler_init(pred_bitset_word_t *used,
+    int used_count, int samples)
+{
+    // drawing until unused value is found takes N / unused draws on
+    // average, listing unused values takes about unused steps
+    double unused = _metadata->max_gene_value + 1 - used_count;
+    double draws = (double) samples * (_metadata->max_gene_value + 1) / unused;
+
+    _pred_sampler_t sampler = {
+        .used = used,
+        .use_list = draws > unused,
+        .pool = NULL,
+        .unused_count = -1,
+    };
+    return sampler;
+}
+
+
+/**
+ * Lists values of set (or its complement) in ascending order
+ * @param set
+ * @param complement Whether to list values not in the set
+ * @param values
+ * @return number of listed values
+ */
+static int _pred_bitset_list(const pred_bitset_word_t *set, bool complement,
+    pred_gene_t *values)
+{
+    int count = 0;
+    for (int w = 0; w < _used_values_words; w++) {
+        pred_bitset_word_t bits = complement? ~set[w] : set[w];
+        while (bits) {
+            pred_gene_t value = w * PRED_BITSET_WORD_BITS + __builtin_ctzll(bits);
+            if (value > _metadata->max_gene_value) break;
+            values[count++] = value;
+            bits &= bits - 1;
         }
     }
-    free(genome);
+    return count;
+}
+
+
+/**
+ * Lists values not in used set into thread's sampling pool
+ * @return false on allocation failure
+ */
+static bool _pred_list_unused(_pred_sampler_t *sampler)
+{
+    _pred_buffers_t *buffers = _pred_thread_buffers();
+    if (buffers == NULL) return false;
+
+    if (buffers->sample_pool == NULL) {
+        buffers->sample_pool = (pred_gene_t*) malloc(sizeof(pred_gene_t) * (_metadata->max_gene_value + 1));
+        if (buffers->sample_pool == NULL) return false;
+    }
+
+    sampler->pool = buffers->sample_pool;
+    sampler->unused_count = _pred_bitset_list(sampler->used, true, sampler->pool);
+    return true;
+}
+
+
+/**
+ * Returns value not in used set and adds it there. Every unused value
+ * is equally likely.
+ *
+ * Values are drawn until unused one is found, unless there are too few
+ * of them. Then unused values are listed once and drawn from the list,
+ * which is then shortened by moving its last item in place of the drawn
+ * one. Either way it takes constant time per value on average.
+ *
+ * @param sampler
+ * @param replaced Value which is going to be removed from used set
+ *                 (and can be returned), or -1
+ */
+static pred_gene_t _pred_sample_unused(_pred_sampler_t *sampler, long replaced)
+{
+    pred_gene_t value;
+
+    if (!sampler->use_list || (sampler->unused_count < 0 && !_pred_list_unused(sampler))) {
+        do {
+            value = rand_urange(0, _metadata->max_gene_value);
+        } while (pred_bitset_get(sampler->used, value) && value != replaced);
+
+        if (replaced >= 0 && value != replaced) {
+            pred_bitset_clear(sampler->used, replaced);
+        }
+        pred_bitset_set(sampler->used, value);
+        return value;
+    }
+
+    // replaced value is the one past the end of list
+    int count = sampler->unused_count;
+    int index = rand_range(0, (replaced >= 0)? count : count - 1);
+    if (index == count) {
+        return replaced;
+    }
+
+    value = sampler->pool[index];
+    if (replaced >= 0) {
+        sampler->pool[index] = replaced;
+        pred_bitset_clear(sampler->used, replaced);
+    } else {
+        sampler->pool[index] = sampler->pool[--sampler->unused_count];
+    }
+    pred_bitset_set(sampler->used, value);
+    return value;
 }
 
 
@@ -190,29 +457,207 @@ int _pred_get_circular_index(pred_genome_t genome, int index)
 }
 
 
-void _pred_calculate_repeated_phenotype(pred_genome_t genome)
+/**
+ * Clears bitset of values (such as `_used_values`). If it contains given
+ * values only and there is less of them than words of the bitset, only
+ * their bits are cleared.
+ */
+static void _pred_clear_values(pred_bitset_word_t *set,
+    const pred_gene_t *values, int count)
+{
+    if (count < _used_values_words) {
+        for (int i = 0; i < count; i++) {
+            pred_bitset_clear(set, values[i]);
+        }
+
+    } else {
+        memset(set, 0, sizeof(pred_bitset_word_t) * _used_values_words);
+    }
+}
+
+
+static int _pred_compare_values(const void *a, const void *b)
+{
+    pred_gene_t x = *(const pred_gene_t*) a;
+    pred_gene_t y = *(const pred_gene_t*) b;
+    return (x > y) - (x < y);
+}
+
+
+/**
+ * Sorts unique values. Few of them are sorted directly, otherwise they
+ * are listed from the set holding exactly them (if available), which
+ * takes linear time.
+ *
+ * @param values
+ * @param count
+ * @param set Set of the values or NULL
+ */
+static void _pred_sort_values(pred_gene_t *values, int count,
+    const pred_bitset_word_t *set)
+{
+    if (set == NULL || count < _used_values_words) {
+        qsort(values, count, sizeof(pred_gene_t), _pred_compare_values);
+
+    } else {
+        _pred_bitset_list(set, false, values);
+    }
+}
+
+
+/**
+ * Calculates sorted phenotype of permuted genotype, which is its used
+ * part
+ */
+static void _pred_sort_permuted_phenotype(pred_genome_t genome)
+{
+    int count = _metadata->genotype_used_length;
+    pred_bitset_word_t *set = NULL;
+    pred_bitset_word_t *phenotype_set = NULL;
+
+    // `_used_values` holds whole genotype, values of its part are marked
+    // in thread's own set
+    if (count >= _used_values_words && count == _metadata->genotype_length) {
+        set = genome->_used_values;
+
+    } else if (count >= _used_values_words) {
+        _pred_buffers_t *buffers = _pred_thread_buffers();
+        if (buffers != NULL && buffers->phenotype_set == NULL) {
+            buffers->phenotype_set = (pred_bitset_word_t*) calloc(_used_values_words, sizeof(pred_bitset_word_t));
+        }
+        phenotype_set = (buffers != NULL)? buffers->phenotype_set : NULL;
+        set = phenotype_set;
+        for (int i = 0; set && i < count; i++) {
+            pred_bitset_set(set, genome->_genes[i]);
+        }
+    }
+
+    if (set == NULL) {
+        memcpy(genome->pixels, genome->_genes, sizeof(pred_gene_t) * count);
+        _pred_sort_values(genome->pixels, count, NULL);
+        return;
+    }
+
+    _pred_bitset_list(set, false, genome->pixels);
+    if (set == phenotype_set) {
+        _pred_clear_values(set, genome->_genes, count);
+    }
+}
+
+
+/**
+ * Lists unique values of used part of repeated genotype, in order of
+ * their first occurrence. `_used_values` holds exactly them afterwards.
+ *
+ * @param genome
+ * @param values Values listed previously, which are overwritten
+ * @param count Number of values listed previously
+ * @return number of listed values
+ */
+static int _pred_list_unique_genes(pred_genome_t genome, pred_gene_t *values,
+    int count)
 {
-    // clear used values helper
-    memset(genome->_used_values, 0, sizeof(bool) * (_metadata->max_gene_value + 1));
+    // clear used values helper, it holds old values
+    _pred_clear_values(genome->_used_values, values, count);
 
     int pheno_index = 0;
     for (int geno_index = 0; geno_index < _metadata->genotype_used_length; geno_index++) {
         int locus = _pred_get_circular_index(genome, geno_index);
         pred_gene_t value = genome->_genes[locus];
-        if (genome->_used_values[value]) {
+        if (pred_bitset_get(genome->_used_values, value)) {
             continue;
 
         } else {
-            genome->_used_values[value] = true;
-            genome->pixels[pheno_index] = value;
+            pred_bitset_set(genome->_used_values, value);
+            values[pheno_index] = value;
             pheno_index++;
         }
     }
-    genome->used_pixels = pheno_index;
+    return pheno_index;
+}
+
+
+void _pred_calculate_repeated_phenotype(pred_genome_t genome)
+{
+    genome->used_pixels = _pred_list_unique_genes(genome, genome->pixels,
+        genome->used_pixels);
+
+    if (_metadata->sorted_phenotype) {
+        _pred_sort_values(genome->pixels, genome->used_pixels, genome->_used_values);
+    }
+}
+
+
+/**
+ * Lists pixels of a tile, row by row
+ * @return number of pixels
+ */
+static int _pred_tile_pixels(pred_gene_t tile, pred_gene_t *pixels)
+{
+    int width = _metadata->image_width;
+    int x = tile % _tile_columns * PRED_TILE_WIDTH;
+    int y = tile / _tile_columns * PRED_TILE_HEIGHT;
+    int x_end = (x + PRED_TILE_WIDTH < width)? x + PRED_TILE_WIDTH : width;
+    int y_end = (y + PRED_TILE_HEIGHT < _metadata->image_height)?
+        y + PRED_TILE_HEIGHT : _metadata->image_height;
+
+    int count = 0;
+    for (int row = y; row < y_end; row++) {
+        for (int col = x; col < x_end; col++) {
+            pixels[count++] = row * width + col;
+        }
+    }
+    return count;
+}
+
 
-    if (can_use_simd()) {
-        fitness_prepare_predictor_for_simd(genome);
+/**
+ * Calculates phenotype of tiled genotype: unique tiles sorted by index,
+ * their rows merged into runs (neighbouring tiles form single run) and
+ * pixels of the runs, which are sorted by index as well
+ */
+static void _pred_calculate_tiled_phenotype(pred_genome_t genome)
+{
+    int count = _pred_list_unique_genes(genome, genome->tiles, genome->used_tiles);
+    _pred_sort_values(genome->tiles, count, genome->_used_values);
+    genome->used_tiles = count;
+
+    int width = _metadata->image_width;
+    int runs = 0;
+    int pixels = 0;
+
+    // tiles are walked by tile rows, each of them pixel row by pixel row
+    for (int first = 0, last; first < count; first = last) {
+        int tile_row = genome->tiles[first] / _tile_columns;
+        for (last = first; last < count && genome->tiles[last] / _tile_columns == tile_row; last++);
+
+        int y_end = (tile_row + 1) * PRED_TILE_HEIGHT;
+        if (y_end > _metadata->image_height) y_end = _metadata->image_height;
+
+        for (int y = tile_row * PRED_TILE_HEIGHT; y < y_end; y++) {
+            for (int t = first; t < last; t++) {
+                int x = genome->tiles[t] % _tile_columns * PRED_TILE_WIDTH;
+                int length = (x + PRED_TILE_WIDTH < width)? PRED_TILE_WIDTH : width - x;
+                int offset = y * width + x;
+
+                if (t > first && genome->tiles[t] == genome->tiles[t - 1] + 1) {
+                    genome->runs[runs - 1].length += length;
+                } else {
+                    genome->runs[runs].offset = offset;
+                    genome->runs[runs].length = length;
+                    genome->runs[runs].row = y;
+                    runs++;
+                }
+
+                for (int i = 0; i < length; i++) {
+                    genome->pixels[pixels++] = offset + i;
+                }
+            }
+        }
     }
+
+    genome->runs_count = runs;
+    genome->used_pixels = pixels;
 }
 
 
@@ -223,13 +668,25 @@ void pred_calculate_phenotype(pred_genome_t genome)
 {
     if (_metadata->genome_type == permuted) {
         genome->used_pixels = _metadata->genotype_used_length;
+        if (_metadata->sorted_phenotype) {
+            _pred_sort_permuted_phenotype(genome);
+        }
+
+    } else if (_metadata->genome_type == tiled) {
+        _pred_calculate_tiled_phenotype(genome);
 
     } else {
         _pred_calculate_repeated_phenotype(genome);
     }
 
-    if (can_use_simd()) {
-        fitness_prepare_predictor_for_simd(genome);
+    // error sums are not known for new phenotype
+    genome->_error_sums_version = 0;
+    genome->_added_count = 0;
+    genome->_removed_count = 0;
+
+    // only genomes used for predicting CGP fitness need to be prepared
+    if (genome->prepared != pred_unprepared) {
+        fitness_prepare_predictor(genome);
     }
 }
 
@@ -255,20 +712,19 @@ int pred_randomize_genome(ga_chr_t chromosome)
     pred_genome_t genome = (pred_genome_t) chromosome->genome;
 
     if (_metadata->genome_type == permuted) {
-        memset(genome->_used_values, 0, sizeof(bool) * (_metadata->max_gene_value + 1));
-    }
+        _pred_clear_values(genome->_used_values, genome->_genes, _metadata->genotype_length);
+        _pred_sampler_t sampler = _pred_sampler_init(genome->_used_values,
+            _metadata->genotype_length, _metadata->genotype_length);
 
-    for (int i = 0; i < _metadata->genotype_length; i++) {
-        pred_gene_t value = rand_urange(0, _metadata->max_gene_value);
-        if (_metadata->genome_type == permuted) {
-            // only unused is valid, so make corrections
-            while(genome->_used_values[value]) {
-                value = (value + 1) % (_metadata->max_gene_value + 1);
-            };
-            genome->_used_values[value] = true;
+        // only unused is valid
+        for (int i = 0; i < _metadata->genotype_length; i++) {
+            genome->_genes[i] = _pred_sample_unused(&sampler, -1);
         }
 
-        genome->_genes[i] = value;
+    } else {
+        for (int i = 0; i < _metadata->genotype_length; i++) {
+            genome->_genes[i] = rand_urange(0, _metadata->max_gene_value);
+        }
     }
 
     genome->_circular_offset = 0;
@@ -289,21 +745,34 @@ void pred_copy_genome(void *_dst, void *_src)
     pred_genome_t src = (pred_genome_t) _src;
 
     memcpy(dst->_genes, src->_genes, sizeof(pred_gene_t) * _metadata->genotype_length);
-    memcpy(dst->_used_values, src->_used_values, sizeof(bool) * _metadata->max_gene_value);
+    memcpy(dst->_used_values, src->_used_values, sizeof(pred_bitset_word_t) * _used_values_words);
 
-    if (_metadata->genome_type == repeated || _metadata->genome_type == circular) {
-        memcpy(dst->pixels, src->pixels, sizeof(pred_gene_t) * _metadata->genotype_length);
+    if (dst->pixels != dst->_genes) {
+        memcpy(dst->pixels, src->pixels, sizeof(pred_gene_t) * src->used_pixels);
     }
 
-    if (can_use_simd()) {
-        memcpy(dst->original_simd, src->original_simd, sizeof(img_pixel_t) * src->used_pixels);
-        for (int w = 0; w < WINDOW_SIZE; w++) {
-            memcpy(dst->pixels_simd[w], src->pixels_simd[w], sizeof(img_pixel_t) * src->used_pixels);
-        }
+    if (dst->tiles) {
+        memcpy(dst->tiles, src->tiles, sizeof(pred_gene_t) * src->used_tiles);
+        memcpy(dst->runs, src->runs, sizeof(pred_run_t) * src->runs_count);
     }
+    dst->used_tiles = src->used_tiles;
+    dst->runs_count = src->runs_count;
+
+    // prepared data are not copied, see `fitness_predictor_archived`
+    dst->prepared = pred_unprepared;
 
     dst->used_pixels = src->used_pixels;
     dst->_circular_offset = src->_circular_offset;
+
+    if (dst->_error_sums) {
+        memcpy(dst->_error_sums, src->_error_sums,
+            sizeof(double) * fitness_errors_stride(_metadata->archive_capacity));
+        memcpy(dst->_added_pixels, src->_added_pixels, sizeof(pred_gene_t) * src->_added_count);
+        memcpy(dst->_removed_pixels, src->_removed_pixels, sizeof(pred_gene_t) * src->_removed_count);
+    }
+    dst->_error_sums_version = src->_error_sums_version;
+    dst->_added_count = src->_added_count;
+    dst->_removed_count = src->_removed_count;
 }
 
 
@@ -320,6 +789,8 @@ void pred_mutate(pred_genome_t genome)
 {
     int max_changed_genes = _metadata->mutation_rate * _metadata->genotype_length;
     int genes_to_change = rand_range(0, max_changed_genes);
+    _pred_sampler_t sampler = _pred_sampler_init(genome->_used_values,
+        _metadata->genotype_length, genes_to_change);
 
     for (int i = 0; i < genes_to_change; i++) {
         // choose mutated gene
@@ -327,17 +798,18 @@ void pred_mutate(pred_genome_t genome)
         pred_gene_t old_value = genome->_genes[gene];
 
         // generate new value
-        pred_gene_t value = rand_urange(0, _metadata->max_gene_value);
+        pred_gene_t value;
         if (_metadata->genome_type == permuted) {
-            // either unused or same value is valid, so make corrections
-            while(genome->_used_values[value] && old_value != value) {
-                value = (value + 1) % (_metadata->max_gene_value + 1);
-            };
+            // either unused or same value is valid, `_used_values` holds
+            // exactly genotype values
+            value = _pred_sample_unused(&sampler, old_value);
+
+        } else {
+            value = rand_urange(0, _metadata->max_gene_value);
         }
 
         // rewrite gene
         genome->_genes[gene] = value;
-        genome->_used_values[value] = true;
     }
 
     pred_calculate_phenotype(genome);
@@ -379,7 +851,7 @@ void _tournament(ga_pop_t pop, ga_chr_t *winner, ga_chr_t red, ga_chr_t blue)
 }
 
 
-void _crossover1p_repeated(pred_genome_t baby, pred_genome_t mom, pred_genome_t dad)
+int _crossover1p_repeated(pred_genome_t baby, pred_genome_t mom, pred_genome_t dad)
 {
     const int split_point = rand_range(0, _metadata->genotype_length - 1);
 
@@ -391,16 +863,17 @@ void _crossover1p_repeated(pred_genome_t baby, pred_genome_t mom, pred_genome_t
         sizeof(pred_gene_t) * (_metadata->genotype_length - split_point));
 
     baby->_circular_offset = mom->_circular_offset;
+    return split_point;
 }
 
 
 
-void _crossover1p_permuted(pred_genome_t baby, pred_genome_t mom, pred_genome_t dad)
+int _crossover1p_permuted(pred_genome_t baby, pred_genome_t mom, pred_genome_t dad)
 {
     const int split_point = rand_range(0, _metadata->genotype_length - 1);
 
     // first clear usage flags
-    memset(baby->_used_values, 0, sizeof(bool) * (_metadata->max_gene_value + 1));
+    _pred_clear_values(baby->_used_values, baby->_genes, _metadata->genotype_length);
 
     // second copy everything we can from mom
     int geneIndex = 0;
@@ -409,9 +882,9 @@ void _crossover1p_permuted(pred_genome_t baby, pred_genome_t mom, pred_genome_t
     VERBOSELOG("Copying.");
     for (int i = 0; i < _metadata->genotype_length; i++) {
         pred_gene_t value = parent_genes[i];
-        if (!baby->_used_values[value]) {
+        if (!pred_bitset_get(baby->_used_values, value)) {
             baby->_genes[geneIndex] = value;
-            baby->_used_values[value] = true;
+            pred_bitset_set(baby->_used_values, value);
             geneIndex++;
         }
 
@@ -423,14 +896,144 @@ void _crossover1p_permuted(pred_genome_t baby, pred_genome_t mom, pred_genome_t
 
     VERBOSELOG("Finish with random values. Index: %d", geneIndex);
     // now create random values in place of duplicates
+    _pred_sampler_t sampler = _pred_sampler_init(baby->_used_values,
+        _metadata->genotype_length, _metadata->genotype_length - geneIndex);
     for (; geneIndex < _metadata->genotype_length; geneIndex++) {
-        pred_gene_t value = rand_urange(0, _metadata->max_gene_value);
-        while(baby->_used_values[value]) {
-            value = (value + 1) % (_metadata->max_gene_value + 1);
-        };
-        baby->_genes[geneIndex] = value;
-        baby->_used_values[value] = true;
+        baby->_genes[geneIndex] = _pred_sample_unused(&sampler, -1);
     }
+    return split_point;
+}
+
+
+/**
+ * Lets genome reuse error sums of its parent: copies them and records
+ * pixels by which their phenotypes differ, so that fitness function
+ * only sums those (see `fitness_eval_predictor_genome`).
+ *
+ * Gives up if the phenotypes differ in more pixels than genome's
+ * phenotype has, summing it from scratch is not slower then.
+ *
+ * @param genome Genome with calculated phenotype
+ * @param parent Evaluated genome
+ * @return whether the sums were inherited
+ */
+static bool _pred_inherit_error_sums(pred_genome_t genome, pred_genome_t parent)
+{
+    if (genome->_error_sums == NULL || parent->_error_sums_version == 0
+        || parent->_added_count || parent->_removed_count) {
+        return false;
+    }
+
+    unsigned int limit = genome->used_pixels;
+    unsigned int added = 0;
+    unsigned int removed = 0;
+
+    if (_metadata->genome_type == tiled) {
+        // sorted tiles are merged, pixels of tiles in just one of them
+        // differ (subsets of phenotypes, so they fit)
+        unsigned int i = 0, j = 0;
+        while (i < genome->used_tiles || j < parent->used_tiles) {
+            bool in_genome = i < genome->used_tiles;
+            bool in_parent = j < parent->used_tiles;
+
+            if (in_genome && in_parent && genome->tiles[i] == parent->tiles[j]) {
+                i++;
+                j++;
+
+            } else if (in_genome && (!in_parent || genome->tiles[i] < parent->tiles[j])) {
+                added += _pred_tile_pixels(genome->tiles[i++], &genome->_added_pixels[added]);
+
+            } else {
+                removed += _pred_tile_pixels(parent->tiles[j++], &genome->_removed_pixels[removed]);
+            }
+
+            if (added + removed > limit) {
+                return false;
+            }
+        }
+
+    } else if (_metadata->sorted_phenotype) {
+        // sorted phenotypes are merged, pixels in just one of them differ
+        // (without branching, it is impossible to predict what comes next)
+        unsigned int i = 0, j = 0;
+        while (i < genome->used_pixels && j < parent->used_pixels) {
+            if (added + removed >= limit) {
+                return false;
+            }
+
+            pred_gene_t in_genome = genome->pixels[i];
+            pred_gene_t in_parent = parent->pixels[j];
+            genome->_added_pixels[added] = in_genome;
+            genome->_removed_pixels[removed] = in_parent;
+            added += in_genome < in_parent;
+            removed += in_parent < in_genome;
+            i += in_genome <= in_parent;
+            j += in_parent <= in_genome;
+        }
+
+        // rest of the longer one
+        unsigned int rest_added = genome->used_pixels - i;
+        unsigned int rest_removed = parent->used_pixels - j;
+        if (added + removed + rest_added + rest_removed > limit) {
+            return false;
+        }
+        memcpy(&genome->_added_pixels[added], &genome->pixels[i], sizeof(pred_gene_t) * rest_added);
+        memcpy(&genome->_removed_pixels[removed], &parent->pixels[j], sizeof(pred_gene_t) * rest_removed);
+        added += rest_added;
+        removed += rest_removed;
+
+    } else if (_metadata->genome_type == permuted) {
+        // phenotypes are sets, so it is enough to compare them position
+        // by position - pixel which has only moved is removed and added
+        unsigned int length = genome->used_pixels;
+        if (parent->used_pixels > length) length = parent->used_pixels;
+
+        for (unsigned int i = 0; i < length; i++) {
+            bool in_genome = i < genome->used_pixels;
+            bool in_parent = i < parent->used_pixels;
+
+            // skip identical blocks quickly, most of them are
+            unsigned int block = PRED_COMPARE_BLOCK;
+            if (i % block == 0 && i + block <= genome->used_pixels
+                && i + block <= parent->used_pixels
+                && memcmp(&genome->pixels[i], &parent->pixels[i], sizeof(pred_gene_t) * block) == 0) {
+                i += block - 1;
+                continue;
+            }
+
+            if (in_genome && in_parent && genome->pixels[i] == parent->pixels[i]) {
+                continue;
+            }
+            if (added + removed + in_genome + in_parent > limit) {
+                return false;
+            }
+            if (in_genome) genome->_added_pixels[added++] = genome->pixels[i];
+            if (in_parent) genome->_removed_pixels[removed++] = parent->pixels[i];
+        }
+
+    } else {
+        // `_used_values` holds exactly phenotype pixels
+        for (unsigned int i = 0; i < genome->used_pixels; i++) {
+            pred_gene_t value = genome->pixels[i];
+            if (pred_bitset_get(parent->_used_values, value)) continue;
+            if (added + removed + 1 > limit) return false;
+            genome->_added_pixels[added++] = value;
+        }
+
+        for (unsigned int i = 0; i < parent->used_pixels; i++) {
+            pred_gene_t value = parent->pixels[i];
+            if (pred_bitset_get(genome->_used_values, value)) continue;
+            if (added + removed + 1 > limit) return false;
+            genome->_removed_pixels[removed++] = value;
+        }
+    }
+
+    memcpy(genome->_error_sums, parent->_error_sums,
+        sizeof(double) * fitness_errors_stride(_metadata->archive_capacity));
+    genome->_error_sums_version = parent->_error_sums_version;
+    genome->_added_count = added;
+    genome->_removed_count = removed;
+    return true;
 }
 
 
@@ -452,11 +1055,12 @@ void _create_combined(ga_pop_t pop, pred_genome_t children)
     pred_genome_t mom_genome = (pred_genome_t)mom->genome;
     pred_genome_t dad_genome = (pred_genome_t)dad->genome;
 
+    int split_point;
     if (_metadata->genome_type == permuted) {
-        _crossover1p_permuted(children, mom_genome, dad_genome);
+        split_point = _crossover1p_permuted(children, mom_genome, dad_genome);
 
     } else {
-        _crossover1p_repeated(children, mom_genome, dad_genome);
+        split_point = _crossover1p_repeated(children, mom_genome, dad_genome);
     }
 
     /*
@@ -477,6 +1081,17 @@ void _create_combined(ga_pop_t pop, pred_genome_t children)
     VERBOSELOG("Mutating newly created child.");
     pred_mutate(children);
 
+    // child differs from the parent it got most genes from just in the
+    // rest of them and in mutations - in permuted genotype it is always
+    // the mom, since dad's genes are shifted by those taken from mom
+    // (unless phenotypes are sorted and positions do not matter)
+    if (2 * split_point >= _metadata->genotype_length) {
+        _pred_inherit_error_sums(children, mom_genome);
+
+    } else if (_metadata->genome_type != permuted || _metadata->sorted_phenotype) {
+        _pred_inherit_error_sums(children, dad_genome);
+    }
+
     /*
     for (int i = 0; i < _metadata->genotype_length; i++) {
         printf("%4x ", children[i]);
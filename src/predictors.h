@@ -21,6 +21,9 @@
 #pragma once
 
 
+#include <stdint.h>
+#include <stdbool.h>
+
 #include "ga.h"
 #include "image.h"
 
@@ -33,6 +36,76 @@ static const ga_problem_type_t PRED_PROBLEM_TYPE = minimize;
 typedef unsigned int pred_gene_t;
 typedef pred_gene_t* pred_gene_array_t;
 
+
+/* set of gene values, one bit per value */
+typedef uint64_t pred_bitset_word_t;
+#define PRED_BITSET_WORD_BITS 64
+
+
+/**
+ * Returns whether value is in the set
+ */
+static inline bool pred_bitset_get(const pred_bitset_word_t *set, pred_gene_t value)
+{
+    return (set[value / PRED_BITSET_WORD_BITS] >> (value % PRED_BITSET_WORD_BITS)) & 1;
+}
+
+
+/**
+ * Adds value to the set
+ */
+static inline void pred_bitset_set(pred_bitset_word_t *set, pred_gene_t value)
+{
+    set[value / PRED_BITSET_WORD_BITS] |= (pred_bitset_word_t) 1 << (value % PRED_BITSET_WORD_BITS);
+}
+
+
+/**
+ * Removes value from the set
+ */
+static inline void pred_bitset_clear(pred_bitset_word_t *set, pred_gene_t value)
+{
+    set[value / PRED_BITSET_WORD_BITS] &= ~((pred_bitset_word_t) 1 << (value % PRED_BITSET_WORD_BITS));
+}
+
+
+/*
+    tiles selected by genes of tiled genotype, one tile row spans one
+    AVX2 vector (two SSE2 vectors), tiles in last column and row are
+    clipped by image borders
+*/
+#define PRED_TILE_WIDTH 32
+#define PRED_TILE_HEIGHT 4
+
+
+/**
+ * Returns number of tiles covering image of given size
+ */
+static inline int pred_tiles_count(int width, int height)
+{
+    int columns = (width + PRED_TILE_WIDTH - 1) / PRED_TILE_WIDTH;
+    int rows = (height + PRED_TILE_HEIGHT - 1) / PRED_TILE_HEIGHT;
+    return columns * rows;
+}
+
+
+/* contiguous pixels of image row `row`, starting at pixel index `offset` */
+typedef struct {
+    unsigned int offset;
+    unsigned int length;
+    unsigned int row;
+} pred_run_t;
+
+
+/* how are phenotype pixels prepared for predicting CGP fitness */
+typedef enum {
+    pred_unprepared,
+    pred_gathered,      /* pixels are gathered into simd-friendly arrays */
+    pred_masked,        /* phenotype pixels are marked in bitmap */
+    pred_tiled,         /* `runs` are read straight from image */
+} pred_prepared_t;
+
+
 struct pred_genome {
     /* genotype */
     pred_gene_array_t _genes;
@@ -41,7 +114,7 @@ struct pred_genome {
         for permuted genotype: which gene values were already used?
         for repeated genotype: used to generate phenotype to avoid duplicities
     */
-    bool *_used_values;
+    pred_bitset_word_t *_used_values;
 
     /* how many pixels are in the phenotype */
     unsigned int used_pixels;
@@ -49,12 +122,38 @@ struct pred_genome {
     /* for circular repeated genotype: phenotype starting locus */
     unsigned int _circular_offset;
 
-    /* phenotype */
+    /* phenotype (sorted if `sorted_phenotype` is set) */
     unsigned int *pixels;
 
-    /* simd-friendly prepared image data */
-    img_pixel_t *original_simd;
-    img_pixel_t *pixels_simd[WINDOW_SIZE];
+    /*
+        for tiled genotype: phenotype tiles (sorted, `_used_values` holds
+        them) and their pixels merged into runs, row by row
+    */
+    pred_gene_t *tiles;
+    unsigned int used_tiles;
+    pred_run_t *runs;
+    unsigned int runs_count;
+
+    /*
+        phenotype prepared for predicting CGP fitness, see
+        `fitness_prepare_predictor`, set only for archived predictor
+        (prepared data are kept by fitness module)
+    */
+    pred_prepared_t prepared;
+
+    /*
+        errors of archived circuits summed on phenotype pixels (indexed
+        by real archive index), valid for given version of the errors
+        table (0 = invalid), see `fitness_eval_predictor_genome`
+    */
+    double *_error_sums;
+    unsigned int _error_sums_version;
+
+    /* phenotype changes not yet applied to `_error_sums` */
+    pred_gene_t *_added_pixels;
+    pred_gene_t *_removed_pixels;
+    unsigned int _added_count;
+    unsigned int _removed_count;
 };
 typedef struct pred_genome* pred_genome_t;
 
@@ -66,14 +165,23 @@ typedef enum {
     permuted,
     repeated,
     circular,
+    tiled,
 } pred_genome_type_t;
 
 
+static const char * const pred_genome_type_names[] = {
+    "permuted",
+    "repeated",
+    "repeated-circular",
+    "tiled",
+};
+
+
 typedef struct {
     /* genome type */
     pred_genome_type_t genome_type;
 
-    /* maximal gene value (inclusive) */
+    /* maximal gene value (inclusive), pixel or tile index */
     pred_gene_t max_gene_value;
 
     /* genotype length */
@@ -88,6 +196,17 @@ typedef struct {
     /* relative number of elite and crossovered children */
     float offspring_elite;
     float offspring_combine;
+
+    /* CGP archive capacity, genomes keep error sums of archived
+       circuits if set */
+    int archive_capacity;
+
+    /* keep phenotype sorted by pixel index */
+    bool sorted_phenotype;
+
+    /* image size, needed by tiled genotype only */
+    int image_width;
+    int image_height;
 } pred_metadata_t;
 
 
@@ -100,6 +219,13 @@ typedef struct {
 void pred_init(pred_metadata_t *metadata);
 
 
+/**
+ * Releases working buffers of all threads, no thread may be breeding
+ * predictors meanwhile
+ */
+void pred_deinit();
+
+
 /**
  * Create a new predictors population with given size
  * @param  size
@@ -126,6 +252,8 @@ void pred_free_genome(void *genome);
 
 /**
  * Recalculates phenotype for repeated genotype
+ *
+ * Genome which was prepared for predicting CGP fitness is prepared again.
  */
 void pred_calculate_phenotype(pred_genome_t genome);
 
@@ -0,0 +1,101 @@
+/**
+ * Microbenchmark of CGP evaluators on random 8x4 genomes.
+ * Prints ns/pixel of scalar interpreter `cgp_get_output` (reference)
+ * and portable block evaluator, and checks that both of them give
+ * the same outputs.
+ * "Stand-alone" test executable - no expected output provided.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../random.h"
+#include "../cgp/cgp.h"
+#include "../cgp/cgp_vector.h"
+
+
+#define CHROMOSOMES 100
+#define PIXELS (16 * CGP_VECTOR_BLOCK)
+#define REPEATS 20
+
+
+static cgp_value_t _inputs[PIXELS][CGP_INPUTS];
+static cgp_vector_t _vector_inputs[PIXELS / CGP_VECTOR_BLOCK][CGP_INPUTS];
+static cgp_value_t _expected[CHROMOSOMES][PIXELS];
+
+
+static double _now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+int main(int argc, char const *argv[])
+{
+    rand_init_seed(42);
+    cgp_set_geometry(8, 4, 1);
+    cgp_init(5, NULL, NULL);
+
+    struct ga_chr chrs[CHROMOSOMES];
+    for (int c = 0; c < CHROMOSOMES; c++) {
+        chrs[c].genome = cgp_alloc_genome();
+        cgp_randomize_genome(&chrs[c]);
+    }
+
+    for (int p = 0; p < PIXELS; p++) {
+        for (int i = 0; i < CGP_INPUTS; i++) {
+            _inputs[p][i] = rand_range(0, 255);
+            _vector_inputs[p / CGP_VECTOR_BLOCK][i][p % CGP_VECTOR_BLOCK] = _inputs[p][i];
+        }
+    }
+
+    int retval = 0;
+    volatile cgp_value_t sink;
+    double start, time_scalar, time_vector;
+
+    // reference
+    start = _now();
+    for (int r = 0; r < REPEATS; r++) {
+        for (int c = 0; c < CHROMOSOMES; c++) {
+            for (int p = 0; p < PIXELS; p++) {
+                cgp_get_output(&chrs[c], _inputs[p], &_expected[c][p]);
+            }
+        }
+    }
+    time_scalar = _now() - start;
+
+    // block evaluator
+    start = _now();
+    for (int r = 0; r < REPEATS; r++) {
+        for (int c = 0; c < CHROMOSOMES; c++) {
+            for (int b = 0; b < PIXELS / CGP_VECTOR_BLOCK; b++) {
+                cgp_vector_t output;
+                cgp_get_output_vector(&chrs[c], _vector_inputs[b], &output);
+                sink = output[0];
+
+                for (int k = 0; r == 0 && k < CGP_VECTOR_BLOCK; k++) {
+                    if (output[k] != _expected[c][b * CGP_VECTOR_BLOCK + k]) {
+                        fprintf(stderr, "Failure (vector, chromosome %d, pixel %d)\n",
+                            c, b * CGP_VECTOR_BLOCK + k);
+                        retval = 1;
+                    }
+                }
+            }
+        }
+    }
+    time_vector = _now() - start;
+    (void) sink;
+
+    double pixels = (double) REPEATS * CHROMOSOMES * PIXELS;
+    printf("scalar: %6.2f ns/pixel\n", time_scalar * 1e9 / pixels);
+    printf("vector: %6.2f ns/pixel\n", time_vector * 1e9 / pixels);
+
+    for (int c = 0; c < CHROMOSOMES; c++) {
+        cgp_free_genome(chrs[c].genome);
+    }
+    cgp_deinit();
+    return retval;
+}
@@ -1,13 +1,12 @@
 /**
  * Tests CGP evaluation = calculation of the outputs.
  * Compile with -DTEST_EVAL
- * Source files cgp_core.c cgp_dump.c ga.c
  */
 
 #include <stdlib.h>
 #include <stdio.h>
 
-#include "../cgp.h"
+#include "../cgp/cgp.h"
 
 
 int main(int argc, char const *argv[])
@@ -15,7 +14,7 @@ int main(int argc, char const *argv[])
     cgp_value_t inputs[CGP_INPUTS] = {0, 1, 2, 3, 4, 5, 6, 7, 8};
     cgp_value_t outputs[CGP_OUTPUTS] = {};
 
-    cgp_init(0, NULL);
+    cgp_init(0, NULL, NULL);
 
     cgp_genome_t genome = (cgp_genome_t) cgp_alloc_genome();
     struct ga_chr chr = {
@@ -30,16 +29,20 @@ int main(int argc, char const *argv[])
             n->inputs[0] = i + CGP_INPUTS - y - y - 1;
             n->inputs[1] = i + CGP_INPUTS - CGP_ROWS;
             n->function = (cgp_func_t) (i % CGP_FUNC_COUNT);
+            n->is_active = true;
         }
     }
 
     // define outputs
     genome->outputs[0] = 13;
 
+    // all nodes are evaluated
+    cgp_compile_phenotype(genome);
+
     cgp_dump_chr_asciiart(&chr, stdout, false);
     putchar('\n');
     cgp_get_output(&chr, inputs, outputs);
 
-    free(genome);
+    cgp_free_genome(genome);
     cgp_deinit();
 }
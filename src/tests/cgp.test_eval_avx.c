@@ -1,7 +1,6 @@
 /**
  * Tests CGP evaluation = calculation of the outputs.
  * Compile with -DTEST_EVAL_AVX -DAVX2
- * Source files cgp_core.c cgp_dump.c cgp_avx.c cpu.c ga.c
  */
 
 #include <stdlib.h>
@@ -9,8 +8,8 @@
 #include <immintrin.h>
 
 #include "../cpu.h"
-#include "../cgp.h"
-#include "../cgp_avx.h"
+#include "../cgp/cgp.h"
+#include "../cgp/cgp_avx.h"
 
 
 
@@ -24,6 +23,7 @@
 #define rep32(x) rep16((x)), rep16((x))
 
 
+CPU_TARGET_AVX2
 int main(int argc, char const *argv[])
 {
     // pre-flight check
@@ -49,10 +49,10 @@ int main(int argc, char const *argv[])
     __m256i_aligned outputs[CGP_OUTPUTS];
 
     for (int i = 0; i < CGP_INPUTS; i++) {
-        inputs[i] = _mm256_load_si256((__m256i*)(&_inputs[i]));
+        inputs[i] = _mm256_loadu_si256((__m256i*)(&_inputs[i]));
     };
 
-    cgp_init(0, NULL);
+    cgp_init(0, NULL, NULL);
 
     cgp_genome_t genome = (cgp_genome_t) cgp_alloc_genome();
     struct ga_chr chr = {
@@ -67,16 +67,20 @@ int main(int argc, char const *argv[])
             n->inputs[0] = i + CGP_INPUTS - y - y - 1;
             n->inputs[1] = i + CGP_INPUTS - CGP_ROWS;
             n->function = (cgp_func_t) (i % CGP_FUNC_COUNT);
+            n->is_active = true;
         }
     }
 
     // define outputs
     genome->outputs[0] = 13;
 
+    // all nodes are evaluated
+    cgp_compile_phenotype(genome);
+
     cgp_dump_chr_asciiart(&chr, stdout, false);
     putchar('\n');
     cgp_get_output_avx(&chr, inputs, outputs);
 
-    free(genome);
+    cgp_free_genome(genome);
     cgp_deinit();
 }
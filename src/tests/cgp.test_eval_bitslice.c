@@ -0,0 +1,94 @@
+/**
+ * Tests that bit-sliced evaluator gives exactly the same outputs as the
+ * SSE one, for random chromosomes using all functions, and that pixels
+ * converted to bit-planes and back are unchanged.
+ * Compile with -DBITSLICE -DSSE2
+ * "Stand-alone" test executable - no expected output provided.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <immintrin.h>
+
+#include "../cpu.h"
+#include "../random.h"
+#include "../cgp/cgp.h"
+#include "../cgp/cgp_sse.h"
+#include "../cgp/cgp_bitslice.h"
+
+
+#define CHROMOSOMES 1000
+#define SSE_BLOCK (int)(sizeof(__m128i) / sizeof(cgp_value_t))
+#define SSE_VECTORS (CGP_BITSLICE_BLOCK / SSE_BLOCK)
+
+
+int main(int argc, char const *argv[])
+{
+    // pre-flight check
+    if (!can_use_sse2()) {
+        fprintf(stderr, "%s", "SSE2 is not supported.\n");
+        exit(1);
+    }
+
+    rand_init_seed(42);
+    cgp_init(5, NULL, NULL);
+
+    struct ga_chr chr = {
+        .genome = cgp_alloc_genome(),
+    };
+
+    int retval = 0;
+
+    for (int c = 0; c < CHROMOSOMES && retval == 0; c++) {
+        cgp_randomize_genome(&chr);
+
+        cgp_value_t pixels[CGP_INPUTS][CGP_BITSLICE_BLOCK];
+        cgp_value_t converted[CGP_BITSLICE_BLOCK];
+        cgp_bitslice_value_t inputs[CGP_INPUTS];
+        cgp_bitslice_value_t output;
+
+        for (int i = 0; i < CGP_INPUTS; i++) {
+            for (int p = 0; p < CGP_BITSLICE_BLOCK; p++) {
+                pixels[i][p] = rand_range(0, 255);
+            }
+            cgp_bitslice_from_pixels(pixels[i], &inputs[i]);
+            cgp_bitslice_to_pixels(&inputs[i], converted);
+
+            for (int p = 0; p < CGP_BITSLICE_BLOCK; p++) {
+                if (converted[p] != pixels[i][p]) {
+                    fprintf(stderr, "Round-trip failure (chromosome %d, input %d, pixel %d). Expected %u, obtained %u\n",
+                        c, i, p, pixels[i][p], converted[p]);
+                    retval = 1;
+                }
+            }
+        }
+
+        cgp_get_output_bitslice(&chr, inputs, &output);
+        cgp_bitslice_to_pixels(&output, converted);
+
+        for (int v = 0; v < SSE_VECTORS; v++) {
+            __m128i_aligned sse_inputs[CGP_INPUTS];
+            __m128i_aligned sse_output;
+
+            for (int i = 0; i < CGP_INPUTS; i++) {
+                sse_inputs[i] = _mm_loadu_si128(
+                    (__m128i*) &pixels[i][v * SSE_BLOCK]);
+            }
+            cgp_get_output_sse(&chr, sse_inputs, &sse_output);
+
+            cgp_value_t *expected = (cgp_value_t*) &sse_output;
+            for (int p = 0; p < SSE_BLOCK; p++) {
+                cgp_value_t obtained = converted[v * SSE_BLOCK + p];
+                if (obtained != expected[p]) {
+                    fprintf(stderr, "Failure (chromosome %d, pixel %d). Expected %u, obtained %u\n",
+                        c, v * SSE_BLOCK + p, expected[p], obtained);
+                    retval = 1;
+                }
+            }
+        }
+    }
+
+    cgp_free_genome(chr.genome);
+    cgp_deinit();
+    return retval;
+}
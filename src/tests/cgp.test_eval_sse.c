@@ -1,7 +1,6 @@
 /**
  * Tests CGP evaluation = calculation of the outputs.
  * Compile with -DTEST_EVAL_SSE2 -DSSE2
- * Source files cgp_core.c cgp_dump.c cgp_sse.c cpu.c ga.c
  */
 
 #include <stdlib.h>
@@ -9,8 +8,8 @@
 #include <immintrin.h>
 
 #include "../cpu.h"
-#include "../cgp.h"
-#include "../cgp_sse.h"
+#include "../cgp/cgp.h"
+#include "../cgp/cgp_sse.h"
 
 
 
@@ -50,7 +49,7 @@ int main(int argc, char const *argv[])
         inputs[i] = _mm_load_si128((__m128i*)(&_inputs[i]));
     };
 
-    cgp_init(0, NULL);
+    cgp_init(0, NULL, NULL);
 
     cgp_genome_t genome = (cgp_genome_t) cgp_alloc_genome();
     struct ga_chr chr = {
@@ -72,10 +71,13 @@ int main(int argc, char const *argv[])
     // define outputs
     genome->outputs[0] = 13;
 
+    // all nodes are evaluated
+    cgp_compile_phenotype(genome);
+
     cgp_dump_chr_asciiart(&chr, stdout, false);
     putchar('\n');
     cgp_get_output_sse(&chr, inputs, outputs);
 
-    free(genome);
+    cgp_free_genome(genome);
     cgp_deinit();
 }
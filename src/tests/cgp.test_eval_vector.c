@@ -0,0 +1,62 @@
+/**
+ * Tests that portable block evaluator gives exactly the same outputs
+ * as the scalar one, for random chromosomes using all functions.
+ * "Stand-alone" test executable - no expected output provided.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../random.h"
+#include "../cgp/cgp.h"
+#include "../cgp/cgp_vector.h"
+
+
+#define CHROMOSOMES 1000
+
+
+int main(int argc, char const *argv[])
+{
+    rand_init_seed(42);
+    cgp_init(5, NULL, NULL);
+
+    struct ga_chr chr = {
+        .genome = cgp_alloc_genome(),
+    };
+
+    int retval = 0;
+
+    for (int c = 0; c < CHROMOSOMES && retval == 0; c++) {
+        cgp_randomize_genome(&chr);
+
+        cgp_vector_t inputs[CGP_INPUTS];
+        cgp_vector_t output;
+        cgp_value_t *pixels = (cgp_value_t*) inputs;
+
+        for (int i = 0; i < CGP_INPUTS * CGP_VECTOR_BLOCK; i++) {
+            pixels[i] = rand_range(0, 255);
+        }
+
+        cgp_get_output_vector(&chr, inputs, &output);
+
+        for (int p = 0; p < CGP_VECTOR_BLOCK; p++) {
+            cgp_value_t window[CGP_INPUTS];
+            cgp_value_t expected;
+
+            for (int i = 0; i < CGP_INPUTS; i++) {
+                window[i] = inputs[i][p];
+            }
+            cgp_get_output(&chr, window, &expected);
+
+            if (output[p] != expected) {
+                fprintf(stderr, "Failure (chromosome %d, pixel %d). Expected %u, obtained %u\n",
+                    c, p, expected, output[p]);
+                retval = 1;
+            }
+        }
+    }
+
+    cgp_free_genome(chr.genome);
+    cgp_deinit();
+    return retval;
+}
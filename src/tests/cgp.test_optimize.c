@@ -0,0 +1,155 @@
+/**
+ * Tests that optimized phenotype (aliased identities, folded constants,
+ * shared repeated nodes) gives exactly the same outputs as plain list
+ * of active nodes, in scalar, vector and SSE engines, and that delta
+ * instructions of mutated chromosomes agree with full evaluation.
+ * "Stand-alone" test executable - no expected output provided.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../random.h"
+#include "../cgp/cgp.h"
+#include "../cgp/cgp_sse.h"
+#include "../cgp/cgp_vector.h"
+
+
+#define CHROMOSOMES 1000
+#define MUTATIONS 10
+
+
+/**
+ * Compiles active nodes one by one, without any optimization
+ */
+static void _compile_plain(cgp_genome_t genome)
+{
+    int slot_of[CGP_SLOTS];
+    int count = 0;
+
+    for (int i = 0; i < CGP_INPUTS; i++) {
+        slot_of[i] = i;
+    }
+
+    for (int i = 0; i < CGP_NODES; i++) {
+        cgp_node_t *n = &(genome->nodes[i]);
+        if (!n->is_active) continue;
+
+        genome->instrs[count].function = n->function;
+        for (int k = 0; k < CGP_FUNC_INPUTS; k++) {
+            genome->instrs[count].inputs[k] = slot_of[n->inputs[k]];
+        }
+        slot_of[CGP_INPUTS + i] = CGP_INPUTS + count++;
+    }
+
+    for (int i = 0; i < CGP_OUTPUTS; i++) {
+        genome->output_slots[i] = slot_of[genome->outputs[i]];
+    }
+    genome->instr_count = count;
+}
+
+
+static int _compare(const char *engine, int c, const cgp_value_t *expected,
+    const cgp_value_t *obtained, int count)
+{
+    for (int p = 0; p < count; p++) {
+        if (expected[p] != obtained[p]) {
+            fprintf(stderr, "Failure (%s, chromosome %d, pixel %d). Expected %u, obtained %u\n",
+                engine, c, p, expected[p], obtained[p]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+int main(int argc, char const *argv[])
+{
+    rand_init_seed(42);
+    // full l-back makes repeated nodes common
+    cgp_set_geometry(8, 4, 8);
+    cgp_init(5, NULL, NULL);
+
+    struct ga_chr chr = {
+        .genome = cgp_alloc_genome(),
+    };
+    struct ga_chr plain = {
+        .genome = cgp_alloc_genome(),
+    };
+    cgp_genome_t genome = (cgp_genome_t) chr.genome;
+
+    int retval = 0;
+    long plain_count = 0;
+    long optimized_count = 0;
+
+    for (int c = 0; c < CHROMOSOMES && retval == 0; c++) {
+        cgp_randomize_genome(&chr);
+        memcpy(plain.genome, chr.genome, sizeof(struct cgp_genome));
+        _compile_plain((cgp_genome_t) plain.genome);
+
+        plain_count += ((cgp_genome_t) plain.genome)->instr_count;
+        optimized_count += genome->instr_count;
+
+        cgp_vector_t inputs[CGP_INPUTS];
+        cgp_vector_t expected, obtained;
+        cgp_value_t *pixels = (cgp_value_t*) inputs;
+
+        for (int i = 0; i < CGP_INPUTS * CGP_VECTOR_BLOCK; i++) {
+            pixels[i] = rand_range(0, 255);
+        }
+
+        // scalar
+        for (int p = 0; p < CGP_VECTOR_BLOCK; p++) {
+            cgp_value_t window[CGP_INPUTS];
+            for (int i = 0; i < CGP_INPUTS; i++) {
+                window[i] = inputs[i][p];
+            }
+            cgp_get_output(&plain, window, &expected[p]);
+            cgp_get_output(&chr, window, &obtained[p]);
+        }
+        retval |= _compare("scalar", c, (cgp_value_t*) &expected,
+            (cgp_value_t*) &obtained, CGP_VECTOR_BLOCK);
+
+        // vector
+        cgp_get_output_vector(&plain, inputs, &expected);
+        cgp_get_output_vector(&chr, inputs, &obtained);
+        retval |= _compare("vector", c, (cgp_value_t*) &expected,
+            (cgp_value_t*) &obtained, CGP_VECTOR_BLOCK);
+
+        // SSE
+        __m128i_aligned sse_inputs[CGP_INPUTS];
+        __m128i_aligned sse_expected, sse_obtained;
+        for (int i = 0; i < CGP_INPUTS; i++) {
+            memcpy(&sse_inputs[i], &inputs[i], sizeof(__m128i));
+        }
+        cgp_get_output_sse(&plain, sse_inputs, &sse_expected);
+        cgp_get_output_sse(&chr, sse_inputs, &sse_obtained);
+        retval |= _compare("SSE", c, (cgp_value_t*) &sse_expected,
+            (cgp_value_t*) &sse_obtained, sizeof(__m128i));
+
+        // delta instructions on top of parent's values
+        for (int m = 0; m < MUTATIONS && retval == 0; m++) {
+            __m128i_aligned values[CGP_DELTA_SLOTS];
+            memcpy(values, sse_inputs, sizeof(sse_inputs));
+
+            cgp_mutate_chr(&chr);
+            cgp_eval_instrs_sse(genome->parent_instrs, genome->parent_instr_count,
+                CGP_INPUTS, values);
+            cgp_eval_instrs_sse(genome->delta_instrs, genome->delta_count,
+                CGP_INPUTS + genome->parent_instr_count, values);
+            cgp_get_output_sse(&chr, sse_inputs, &sse_expected);
+
+            retval |= _compare("delta", c, (cgp_value_t*) &sse_expected,
+                (cgp_value_t*) &values[genome->delta_output_slots[0]],
+                sizeof(__m128i));
+        }
+    }
+
+    printf("Instructions: %ld plain, %ld optimized\n", plain_count, optimized_count);
+
+    cgp_free_genome(chr.genome);
+    cgp_free_genome(plain.genome);
+    cgp_deinit();
+    return retval;
+}
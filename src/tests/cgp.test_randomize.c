@@ -11,7 +11,7 @@
 
 int main(int argc, char const *argv[])
 {
-    cgp_init(0, NULL);
+    cgp_init(0, NULL, NULL);
 
     cgp_genome_t genome = (cgp_genome_t) malloc(sizeof(struct cgp_genome));
     struct ga_chr chr = {
@@ -0,0 +1,271 @@
+/**
+ * Tests that SIMD evaluators (single, multi-block, compiled, batch,
+ * predictor subsets, masked predictors, runs of tiled predictors and
+ * errors of archived circuits)
+ * give exactly the same sum of squared differences as the scalar one.
+ * Scalar `avg` differs from SIMD one, so only limited function set is used.
+ * Compile with -DCGP_LIMIT_FUNCS
+ * "Stand-alone" test executable - no expected output provided.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../cpu.h"
+#include "../random.h"
+#include "../image.h"
+#include "../cgp/cgp.h"
+#include "../fitness.h"
+#include "../cgp/cgp_avx.h"
+
+
+// internal evaluators, see fitness.c
+double _fitness_get_sqdiffsum_scalar(ga_chr_t chr);
+double _fitness_get_sqdiffsum_simd(ga_chr_t chr, img_pixel_t *original,
+    const img_planes_t *noisy, int data_length);
+void _fitness_get_sqdiffsum_simd_batch(ga_chr_t *chrs, int count,
+    img_pixel_t *original, const img_planes_t *noisy, int data_length,
+    int *order, double max_sum, double *sums);
+double _fitness_predict_cgp_scalar(ga_chr_t cgp_chr, pred_genome_t predictor);
+ga_fitness_t fitness_predict_cgp_by_genome(ga_chr_t cgp_chr,
+    pred_genome_t predictor);
+void _fitness_sum_archive_errors(const pred_gene_t *pixels, int count,
+    double *sums);
+
+
+#define CHROMOSOMES 10
+#define ARCHIVE_CAPACITY 7
+
+
+static int check(const char *what, int width, int height, int index,
+    double expected, double obtained)
+{
+    if (expected != obtained) {
+        fprintf(stderr, "Failure (%s, %dx%d, chromosome %d). Expected %lf, obtained %lf\n",
+            what, width, height, index, expected, obtained);
+        return 1;
+    }
+    return 0;
+}
+
+
+int main(int argc, char const *argv[])
+{
+    // pre-flight check
+    if (!can_use_simd()) {
+        fprintf(stderr, "%s", "SIMD is not supported.\n");
+        exit(1);
+    }
+
+    // sizes not aligned to SIMD blocks, both shorter and longer than
+    // CGP_JIT_MIN_BLOCKS and FITNESS_BATCH_BLOCK
+    int sizes[][2] = {
+        {1, 1},
+        {5, 3},
+        {37, 23},
+        {61, 29},
+        {97, 67},
+    };
+
+    rand_init_seed(42);
+    cgp_init(5, NULL, NULL);
+
+    int retval = 0;
+
+    for (int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        int width = sizes[s][0];
+        int height = sizes[s][1];
+
+        img_image_t original = img_create(width, height, 1);
+        img_image_t noisy = img_create(width, height, 1);
+        img_padded_t noisy_padded;
+        img_planes_t noisy_planes;
+
+        for (int i = 0; i < width * height; i++) {
+            original->data[i] = rand_range(0, 255);
+            noisy->data[i] = rand_range(0, 255);
+        }
+
+        arc_func_vect_t archive_methods = {
+            .alloc_genome = cgp_alloc_genome,
+            .free_genome = cgp_free_genome,
+            .copy_genome = cgp_copy_genome,
+            .stored = fitness_cgp_archived,
+        };
+        archive_t archive = arc_create(ARCHIVE_CAPACITY, archive_methods,
+            CGP_PROBLEM_TYPE);
+
+        fitness_init(original, noisy, archive, NULL);
+        noisy_padded = img_pad(noisy);
+        img_padded_planes(noisy_padded, &noisy_planes);
+
+        // parent and its offspring, so batch is evaluated incrementally
+        struct ga_chr chrs[CHROMOSOMES];
+        ga_chr_t chr_ptrs[CHROMOSOMES];
+
+        for (int c = 0; c < CHROMOSOMES; c++) {
+            chrs[c].genome = cgp_alloc_genome();
+            chr_ptrs[c] = &chrs[c];
+        }
+
+        cgp_randomize_genome(&chrs[0]);
+        for (int c = 1; c < CHROMOSOMES; c++) {
+            cgp_copy_genome(chrs[c].genome, chrs[0].genome);
+            cgp_mutate_chr(&chrs[c]);
+        }
+
+        double expected[CHROMOSOMES];
+        double sums[CHROMOSOMES];
+
+        for (int c = 0; c < CHROMOSOMES; c++) {
+            expected[c] = _fitness_get_sqdiffsum_scalar(&chrs[c]);
+            double obtained = _fitness_get_sqdiffsum_simd(&chrs[c],
+                original->data, &noisy_planes, width * height);
+
+            retval |= check("single", width, height, c, expected[c], obtained);
+
+            if (cpu_simd_level() == cpu_simd_avx2) {
+                for (int blocks = 1; blocks <= CGP_AVX_MAX_BLOCKS; blocks++) {
+                    obtained = _fitness_get_sqdiffsum_avx_multi(original->data,
+                        &noisy_planes, &chrs[c], blocks, 0, width * height);
+                    retval |= check("multi", width, height, c, expected[c], obtained);
+                }
+            }
+        }
+
+        _fitness_get_sqdiffsum_simd_batch(chr_ptrs, CHROMOSOMES, original->data,
+            &noisy_planes, width * height, NULL, INFINITY, sums);
+
+        for (int c = 0; c < CHROMOSOMES; c++) {
+            retval |= check("batch", width, height, c, expected[c], sums[c]);
+        }
+
+        _fitness_get_sqdiffsum_simd_batch(&chr_ptrs[1], CHROMOSOMES - 1,
+            original->data, &noisy_planes, width * height, NULL, INFINITY, sums);
+
+        for (int c = 1; c < CHROMOSOMES; c++) {
+            retval |= check("delta", width, height, c, expected[c], sums[c - 1]);
+        }
+
+        // predictor = random subset of pixels
+        struct pred_genome predictor;
+        unsigned int pixels[width * height];
+        img_pixel_t original_simd[width * height + SIMD_PADDING_BYTES];
+        img_pixel_t pixels_simd[WINDOW_SIZE][width * height + SIMD_PADDING_BYTES];
+
+        fitness_prepared_t prepared = {
+            .original_simd = original_simd,
+            .capacity = width * height,
+        };
+
+        predictor.used_pixels = rand_range(1, width * height);
+        predictor.pixels = pixels;
+        predictor.runs = NULL;
+        predictor.prepared = pred_unprepared;
+        for (int i = 0; i < predictor.used_pixels; i++) {
+            pixels[i] = rand_range(0, width * height - 1);
+        }
+        for (int i = 0; i < WINDOW_SIZE; i++) {
+            prepared.pixels_simd[i] = pixels_simd[i];
+        }
+        fitness_prepare_predictor_for_simd(&predictor, &prepared);
+
+        img_planes_t predictor_planes = {
+            .width = predictor.used_pixels,
+            .stride = predictor.used_pixels,
+        };
+        for (int i = 0; i < WINDOW_SIZE; i++) {
+            predictor_planes.planes[i] = pixels_simd[i];
+        }
+
+        for (int c = 0; c < CHROMOSOMES; c++) {
+            double predicted = _fitness_predict_cgp_scalar(&chrs[c], &predictor);
+            double obtained = _fitness_get_sqdiffsum_simd(&chrs[c],
+                original_simd, &predictor_planes, predictor.used_pixels);
+
+            retval |= check("predictor", width, height, c, predicted, obtained);
+        }
+
+        // masked predictor = unique pixels covering most of the image,
+        // they are marked in bitmap when predicting (see
+        // FITNESS_MASK_MIN_DENSITY)
+        struct pred_genome masked = predictor;
+        unsigned int unique_pixels[width * height];
+        int skipped = rand_range(0, 19);
+
+        masked.pixels = unique_pixels;
+        masked.used_pixels = 0;
+        for (int i = 0; i < width * height; i++) {
+            if (i % 20 != skipped) {
+                unique_pixels[masked.used_pixels++] = i;
+            }
+        }
+
+        for (int c = 0; c < CHROMOSOMES && masked.used_pixels; c++) {
+            double coef = 255 * 255 * (double) masked.used_pixels;
+            double predicted = coef / _fitness_predict_cgp_scalar(&chrs[c], &masked);
+            double obtained = fitness_predict_cgp_by_genome(&chrs[c], &masked);
+
+            retval |= check("masked", width, height, c, predicted, obtained);
+        }
+
+        // tiled predictor = runs of pixels read straight from image
+        struct pred_genome tiled = predictor;
+        unsigned int run_pixels[width * height];
+        pred_run_t runs[height];
+
+        tiled.pixels = run_pixels;
+        tiled.used_pixels = 0;
+        tiled.runs = runs;
+        tiled.runs_count = 0;
+        for (int y = 0; y < height; y++) {
+            if (rand_range(0, 3) == 0) continue;
+
+            pred_run_t *run = &runs[tiled.runs_count++];
+            int x = rand_range(0, width - 1);
+            run->offset = y * width + x;
+            run->length = rand_range(1, width - x);
+            run->row = y;
+            for (int i = 0; i < run->length; i++) {
+                run_pixels[tiled.used_pixels++] = run->offset + i;
+            }
+        }
+
+        for (int c = 0; c < CHROMOSOMES && tiled.used_pixels; c++) {
+            double coef = 255 * 255 * (double) tiled.used_pixels;
+            double predicted = coef / _fitness_predict_cgp_scalar(&chrs[c], &tiled);
+            double obtained = fitness_predict_cgp_by_genome(&chrs[c], &tiled);
+
+            retval |= check("tiled", width, height, c, predicted, obtained);
+        }
+
+        // archived errors, some columns are overwritten
+        double errors[ARCHIVE_CAPACITY + FITNESS_ERRORS_ROW_ALIGN];
+        for (int c = 0; c < CHROMOSOMES; c++) {
+            arc_insert(archive, &chrs[c]);
+        }
+        _fitness_sum_archive_errors(predictor.pixels, predictor.used_pixels, errors);
+
+        for (int i = 0; i < archive->stored; i++) {
+            int c = CHROMOSOMES - archive->stored + i;
+            double predicted = _fitness_predict_cgp_scalar(&chrs[c], &predictor);
+            double obtained = errors[arc_real_index(archive, i)];
+
+            retval |= check("archive", width, height, c, predicted, obtained);
+        }
+
+        for (int c = 0; c < CHROMOSOMES; c++) {
+            cgp_free_genome(chrs[c].genome);
+        }
+        img_padded_destroy(noisy_padded);
+        arc_destroy(archive);
+        fitness_deinit();
+        img_destroy(original);
+        img_destroy(noisy);
+    }
+
+    cgp_deinit();
+    return retval;
+}
@@ -0,0 +1,157 @@
+/**
+ * Tests that predictors evaluated in batch (from error sums inherited
+ * from their parents plus added and removed pixels, split into chunks
+ * of pixels or archived circuits) have exactly the same fitness as when
+ * evaluated one by one from scratch, for all genome types (with and
+ * without sorted phenotype, with and without errors table of archived
+ * circuits) and while archive changes. Circular predictors must have
+ * the best of all phenotype starting loci.
+ * "Stand-alone" test executable - no expected output provided.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../random.h"
+#include "../image.h"
+#include "../cgp/cgp.h"
+#include "../fitness.h"
+#include "../archive.h"
+#include "../predictors.h"
+
+
+// predictors have more pixels than FITNESS_PRED_CHUNK
+#define WIDTH 131
+#define HEIGHT 127
+#define ARCHIVE_CAPACITY 7
+#define POPULATION_SIZE 10
+#define GENERATIONS 50
+
+
+int main(int argc, char const *argv[])
+{
+    rand_init_seed(42);
+    cgp_init(5, NULL, NULL);
+
+    img_image_t original = img_create(WIDTH, HEIGHT, 1);
+    img_image_t noisy = img_create(WIDTH, HEIGHT, 1);
+    for (int i = 0; i < WIDTH * HEIGHT; i++) {
+        original->data[i] = rand_range(0, 255);
+        noisy->data[i] = rand_range(0, 255);
+    }
+
+    int retval = 0;
+    pred_genome_type_t types[] = {permuted, repeated, circular, tiled};
+
+    for (int t = 0; t < sizeof(types) / sizeof(types[0]) * 4; t++) {
+        pred_genome_type_t type = types[t / 4];
+        bool sorted = t % 2;
+        bool use_table = (t / 2) % 2 == 0;
+        int values = WIDTH * HEIGHT;
+        if (type == tiled) {
+            values = pred_tiles_count(WIDTH, HEIGHT);
+        }
+
+        // circular predictors without table try random offsets
+        if (type == circular && !use_table) continue;
+
+        pred_metadata_t metadata = {
+            .genome_type = type,
+            .max_gene_value = values - 1,
+            .genotype_length = values / 4,
+            .genotype_used_length = (type == circular)? values / 8 : values / 4,
+            .mutation_rate = 0.05,
+            .offspring_elite = 0.25,
+            .offspring_combine = 0.5,
+            .archive_capacity = ARCHIVE_CAPACITY,
+            .sorted_phenotype = sorted,
+            .image_width = WIDTH,
+            .image_height = HEIGHT,
+        };
+        pred_init(&metadata);
+
+        arc_func_vect_t archive_methods = {
+            .alloc_genome = cgp_alloc_genome,
+            .free_genome = cgp_free_genome,
+            .copy_genome = cgp_copy_genome,
+            .fitness = fitness_eval_cgp,
+            .stored = use_table? fitness_cgp_archived : NULL,
+        };
+        archive_t archive = arc_create(ARCHIVE_CAPACITY, archive_methods,
+            CGP_PROBLEM_TYPE);
+        fitness_init(original, noisy, archive, NULL);
+
+        struct ga_chr circuit = {
+            .genome = cgp_alloc_genome(),
+        };
+        cgp_randomize_genome(&circuit);
+        arc_insert(archive, &circuit);
+
+        ga_pop_t pop = pred_init_pop(POPULATION_SIZE);
+        ga_evaluate_pop(pop);
+        ga_chr_t reference = ga_alloc_chr(pred_alloc_genome);
+
+        int inherited = 0;
+        int children = 0;
+
+        for (int g = 0; g < GENERATIONS && retval == 0; g++) {
+            // archive changes now and then
+            if (g % 10 == 9) {
+                cgp_randomize_genome(&circuit);
+                arc_insert(archive, &circuit);
+                ga_reevaluate_pop(pop);
+            }
+
+            pop->methods.offspring(pop);
+            for (int i = 0; i < pop->size; i++) {
+                pred_genome_t genome = (pred_genome_t) pop->chromosomes[i]->genome;
+                if (pop->chromosomes[i]->has_fitness) continue;
+                if (genome->_error_sums_version) inherited++;
+                children++;
+            }
+            ga_evaluate_pop(pop);
+
+            for (int i = 0; i < pop->size; i++) {
+                ga_chr_t chr = pop->chromosomes[i];
+                pred_copy_genome(reference->genome, chr->genome);
+                ((pred_genome_t) reference->genome)->_error_sums_version = 0;
+
+                ga_fitness_t expected = fitness_eval_predictor(reference);
+                if (expected != chr->fitness) {
+                    fprintf(stderr, "Failure (type %d, sorted %d, table %d, generation %d, predictor %d). Expected %.10g, obtained %.10g\n",
+                        type, sorted, use_table, g, i, expected, chr->fitness);
+                    retval = 1;
+                }
+
+                if (type != circular || g % 10) continue;
+
+                pred_genome_t genome = (pred_genome_t) reference->genome;
+                for (int offset = 0; offset < metadata.genotype_length; offset++) {
+                    genome->_circular_offset = offset;
+                    pred_calculate_phenotype(genome);
+
+                    ga_fitness_t fitness = fitness_eval_predictor(reference);
+                    if (fitness < chr->fitness) {
+                        fprintf(stderr, "Failure (generation %d, predictor %d). Offset %d is better: %.10g < %.10g\n",
+                            g, i, offset, fitness, chr->fitness);
+                        retval = 1;
+                    }
+                }
+            }
+        }
+
+        printf("Type %d, sorted %d, table %d: %d of %d children inherited error sums\n",
+            type, sorted, use_table, inherited, children);
+
+        ga_destroy_chr(reference, pred_free_genome);
+        ga_destroy_pop(pop);
+        cgp_free_genome(circuit.genome);
+        arc_destroy(archive);
+        fitness_deinit();
+    }
+
+    img_destroy(original);
+    img_destroy(noisy);
+    cgp_deinit();
+    return retval;
+}
@@ -0,0 +1,186 @@
+/**
+ * Tests that `_used_values` bitset holds exactly genotype values of
+ * permuted genomes, phenotype pixels of repeated ones and phenotype
+ * tiles of tiled ones (whose pixels and runs must match them), for short
+ * genomes (bits are cleared one by one) as well as long ones (whole
+ * bitset is cleared), and that permuted genomes have no repeated values
+ * even if they cover most or all of the image (unused values are
+ * sampled from a list). Sorted phenotypes must be ascending and hold
+ * the same pixels.
+ * "Stand-alone" test executable - no expected output provided.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../random.h"
+#include "../image.h"
+#include "../fitness.h"
+#include "../predictors.h"
+
+
+#define WIDTH 100
+#define HEIGHT 100
+#define POPULATION_SIZE 10
+#define GENERATIONS 20
+#define TILE_COLUMNS ((WIDTH + PRED_TILE_WIDTH - 1) / PRED_TILE_WIDTH)
+
+
+static int check(pred_metadata_t *metadata, ga_chr_t chr, int generation)
+{
+    pred_genome_t genome = (pred_genome_t) chr->genome;
+    const pred_gene_t *values = genome->pixels;
+    int count = genome->used_pixels;
+
+    if (metadata->genome_type == permuted) {
+        values = genome->_genes;
+        count = metadata->genotype_length;
+
+    } else if (metadata->genome_type == tiled) {
+        values = genome->tiles;
+        count = genome->used_tiles;
+    }
+
+    int expected[WIDTH * HEIGHT] = {0};
+    for (int i = 0; i < count; i++) {
+        if (expected[values[i]]++ && metadata->genome_type == permuted) {
+            fprintf(stderr, "Failure (type %d, length %d, generation %d). Value %u repeated\n",
+                metadata->genome_type, metadata->genotype_length, generation, values[i]);
+            return 1;
+        }
+    }
+
+    for (int v = 0; v <= metadata->max_gene_value; v++) {
+        if (pred_bitset_get(genome->_used_values, v) != (expected[v] > 0)) {
+            fprintf(stderr, "Failure (type %d, length %d, generation %d). Value %d expected %d\n",
+                metadata->genome_type, metadata->genotype_length, generation, v, expected[v] > 0);
+            return 1;
+        }
+    }
+
+    if (metadata->genome_type == tiled) {
+        // pixels of runs in order, each of them in its tile
+        int pixel = 0;
+        for (int r = 0; r < genome->runs_count; r++) {
+            for (int i = 0; i < genome->runs[r].length; i++, pixel++) {
+                int index = genome->runs[r].offset + i;
+                int tile = index / WIDTH / PRED_TILE_HEIGHT * TILE_COLUMNS
+                    + index % WIDTH / PRED_TILE_WIDTH;
+
+                if (genome->pixels[pixel] != index || !expected[tile]) {
+                    fprintf(stderr, "Failure (type %d, length %d, generation %d). Pixel %d not in tiles\n",
+                        metadata->genome_type, metadata->genotype_length, generation, index);
+                    return 1;
+                }
+            }
+        }
+
+        int area = 0;
+        for (int i = 0; i < genome->used_tiles; i++) {
+            int x = genome->tiles[i] % TILE_COLUMNS * PRED_TILE_WIDTH;
+            int y = genome->tiles[i] / TILE_COLUMNS * PRED_TILE_HEIGHT;
+            area += (x + PRED_TILE_WIDTH < WIDTH? PRED_TILE_WIDTH : WIDTH - x)
+                * (y + PRED_TILE_HEIGHT < HEIGHT? PRED_TILE_HEIGHT : HEIGHT - y);
+        }
+
+        if (pixel != genome->used_pixels || area != genome->used_pixels) {
+            fprintf(stderr, "Failure (type %d, length %d, generation %d). Expected %d pixels, obtained %d\n",
+                metadata->genome_type, metadata->genotype_length, generation, area, genome->used_pixels);
+            return 1;
+        }
+    }
+
+    if (!metadata->sorted_phenotype && metadata->genome_type != tiled) {
+        return 0;
+    }
+
+    for (int i = 1; i < genome->used_pixels; i++) {
+        if (genome->pixels[i - 1] >= genome->pixels[i]) {
+            fprintf(stderr, "Failure (type %d, length %d, generation %d). Pixel %d not sorted\n",
+                metadata->genome_type, metadata->genotype_length, generation, i);
+            return 1;
+        }
+    }
+
+    // permuted phenotype is used part of genotype
+    if (metadata->genome_type == permuted) {
+        int in_phenotype[WIDTH * HEIGHT] = {0};
+        for (int i = 0; i < genome->used_pixels; i++) {
+            in_phenotype[genome->pixels[i]] = 1;
+        }
+
+        for (int i = 0; i < metadata->genotype_used_length; i++) {
+            if (!in_phenotype[genome->_genes[i]] || genome->used_pixels != metadata->genotype_used_length) {
+                fprintf(stderr, "Failure (type %d, length %d, generation %d). Gene %d not in phenotype\n",
+                    metadata->genome_type, metadata->genotype_length, generation, i);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+
+int main(int argc, char const *argv[])
+{
+    rand_init_seed(42);
+
+    img_image_t original = img_create(WIDTH, HEIGHT, 1);
+    img_image_t noisy = img_create(WIDTH, HEIGHT, 1);
+    fitness_init(original, noisy, NULL, NULL);
+
+    int retval = 0;
+    pred_genome_type_t types[] = {permuted, repeated, tiled};
+
+    // sorted phenotypes of whole and partially used genotypes
+    struct {
+        bool sorted;
+        int used_percent;
+    } modes[] = {{false, 100}, {true, 100}, {true, 75}};
+
+    for (int t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+        int values = WIDTH * HEIGHT;
+        if (types[t] == tiled) {
+            values = pred_tiles_count(WIDTH, HEIGHT);
+        }
+        int lengths[] = {50, values / 4, values * 3 / 4, values};
+
+        for (int m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+            for (int l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+                pred_metadata_t metadata = {
+                    .genome_type = types[t],
+                    .max_gene_value = values - 1,
+                    .genotype_length = lengths[l],
+                    .genotype_used_length = lengths[l] * modes[m].used_percent / 100,
+                    .mutation_rate = 0.05,
+                    .offspring_elite = 0.25,
+                    .offspring_combine = 0.5,
+                    .sorted_phenotype = modes[m].sorted,
+                    .image_width = WIDTH,
+                    .image_height = HEIGHT,
+                };
+                pred_init(&metadata);
+
+                ga_pop_t pop = pred_init_pop(POPULATION_SIZE);
+
+                for (int g = 0; g < GENERATIONS && retval == 0; g++) {
+                    for (int i = 0; i < pop->size; i++) {
+                        pop->chromosomes[i]->fitness = rand_range(0, 100);
+                    }
+                    pop->methods.offspring(pop);
+
+                    for (int i = 0; i < pop->size && retval == 0; i++) {
+                        retval |= check(&metadata, pop->chromosomes[i], g);
+                    }
+                }
+
+                ga_destroy_pop(pop);
+            }
+        }
+    }
+
+    fitness_deinit();
+    img_destroy(original);
+    img_destroy(noisy);
+    return retval;
+}
@@ -50,11 +50,7 @@ def red(s):
 
 
 def split_and_filter_cflags(line):
-    return (
-        f
-        for f in re.split('[\s*,]', line.strip('\\' + string.whitespace))
-        if f != '-DAVX2'
-    )
+    return re.split('[\s*,]', line.strip('\\' + string.whitespace))
 
 
 def split_and_filter_libs(line):
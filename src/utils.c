@@ -189,4 +189,10 @@ void print_sysinfo()
     #else
         printf("SSE2 is not compiled. Recompile with -DSSE2 defined to enable.\n");
     #endif
+
+    #ifdef BITSLICE
+        printf("Bit-sliced evaluation is compiled.\n");
+    #else
+        printf("Bit-sliced evaluation is not compiled. Recompile with -DBITSLICE defined to enable.\n");
+    #endif
 }